@@ -0,0 +1,45 @@
+#ifndef ADDATA_HPP
+#define ADDATA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "AdvParser.hpp"
+
+// EIR/AD Data Types
+#define EIR_FLAGS                   0x01
+#define EIR_NAME_SHORT              0x08
+#define EIR_NAME_COMPLETE           0x09
+#define EIR_TX_POWER                0x0A
+
+struct DeviceData {
+    std::string mac;
+    std::string name;
+    int rssi;
+    int tx_power;
+    bool has_tx_power;
+};
+
+// Function to parse the advertising data
+inline void parse_ad_data(const uint8_t *data, size_t len, DeviceData &device) {
+    AdFieldParser fields(ByteSpan{ data, len });
+    AdField field;
+    while (fields.next(field)) {
+        switch (field.type) {
+            case EIR_NAME_SHORT:
+            case EIR_NAME_COMPLETE:
+                if (device.name.empty() || field.type == EIR_NAME_COMPLETE) {
+                    device.name.assign((const char*)field.value.data, field.value.size);
+                }
+                break;
+            case EIR_TX_POWER:
+                if (field.value.size == 1) {
+                    device.tx_power = (int8_t)field.value.data[0];
+                    device.has_tx_power = true;
+                }
+                break;
+        }
+    }
+}
+
+#endif // ADDATA_HPP
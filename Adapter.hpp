@@ -0,0 +1,36 @@
+#ifndef ADAPTER_HPP
+#define ADAPTER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <bluetooth/bluetooth.h>
+
+// Everything the daemon needs from a Bluetooth controller. HciDevice and
+// BlueProximity only talk to the radio through this, so the monitoring
+// logic runs the same against BlueZ or a simulated adapter.
+class Adapter {
+public:
+    // fd is a connected, non-blocking stream on success; otherwise fd is
+    // -1 and err holds the errno of the failed connect
+    using ConnectHandler = std::function<void(int fd, int err)>;
+
+    virtual ~Adapter() = default;
+
+    virtual const char* name() const = 0;
+
+    // A descriptor that reads one H4 event packet (type byte first) per
+    // read(), or -1. Only the events HciDevice listens for are delivered.
+    virtual int open_hci() = 0;
+    virtual void close_hci() = 0;
+    virtual int get_dev_id() const = 0;
+    virtual int send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) = 0;
+    virtual int get_conn_handle(const bdaddr_t& addr) = 0;
+
+    // Starts an RFCOMM connect. Returns an id for cancel_rfcomm(), or -1
+    // with errno set if the attempt failed before it started. The handler
+    // is never called from inside connect_rfcomm() itself.
+    virtual int connect_rfcomm(const bdaddr_t& addr, int channel, ConnectHandler handler) = 0;
+    virtual void cancel_rfcomm(int id) = 0;
+};
+
+#endif // ADAPTER_HPP
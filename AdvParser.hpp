@@ -0,0 +1,220 @@
+#ifndef ADVPARSER_HPP
+#define ADVPARSER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+// A view into a buffer owned by someone else; valid as long as it is
+struct ByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+};
+
+// One report of an LE Advertising Report event. addr and data point into
+// the event buffer; nothing is copied or formatted.
+struct AdvReport {
+    uint8_t evt_type;
+    uint8_t addr_type;
+    const bdaddr_t* addr;
+    ByteSpan data;
+    int rssi;
+};
+
+// Walks the reports of one HCI event in place (buf starts at the packet
+// type byte). Any other event simply has no reports. Every length is
+// checked against both the event header and the received length before
+// it is used; the first one that does not fit ends the walk and sets
+// malformed(), so nothing past the buffer is ever read.
+class AdvReportParser {
+public:
+    AdvReportParser(const unsigned char* buf, size_t len) : pos(nullptr), end(nullptr), remaining(0), bad(false) {
+        const size_t meta_off = 1 + HCI_EVENT_HDR_SIZE;
+        if (len < meta_off + 2 || buf[0] != HCI_EVENT_PKT || buf[1] != EVT_LE_META_EVENT) return;
+        if (buf[meta_off] != EVT_LE_ADVERTISING_REPORT) return;
+
+        size_t plen = buf[2];
+        if (plen < 2 || meta_off + plen > len) {
+            bad = true;
+            return;
+        }
+        remaining = buf[meta_off + 1];
+        pos = buf + meta_off + 2;
+        end = buf + meta_off + plen;
+    }
+
+    bool next(AdvReport& report) {
+        if (remaining == 0) return false;
+
+        // Header (evt_type, bdaddr_type, bdaddr, length) must fit before we trust length
+        if ((size_t)(end - pos) < LE_ADVERTISING_INFO_SIZE) return fail();
+        const le_advertising_info* info = (const le_advertising_info*)pos;
+        // RSSI is the byte after the data
+        size_t size = LE_ADVERTISING_INFO_SIZE + info->length + 1;
+        if ((size_t)(end - pos) < size) return fail();
+
+        report.evt_type = info->evt_type;
+        report.addr_type = info->bdaddr_type;
+        report.addr = &info->bdaddr;
+        report.data.data = info->data;
+        report.data.size = info->length;
+        report.rssi = (int8_t)info->data[info->length];
+
+        pos += size;
+        remaining--;
+        return true;
+    }
+
+    bool malformed() const { return bad; }
+
+private:
+    const unsigned char* pos;
+    const unsigned char* end;
+    int remaining;
+    bool bad;
+
+    bool fail() {
+        bad = true;
+        remaining = 0;
+        return false;
+    }
+};
+
+// One response of an Inquiry Result, Inquiry Result with RSSI or
+// Extended Inquiry Result event. addr and eir point into the event buffer.
+struct InquiryResult {
+    const bdaddr_t* addr;
+    uint8_t pscan_rep_mode;
+    uint32_t dev_class;
+    uint16_t clock_offset;
+    int rssi;       // -255 when the event carries none (plain Inquiry Result)
+    ByteSpan eir;   // Extended Inquiry Result only; AD structures, as in adverts
+};
+
+// Walks the responses of one inquiry result event in place, with the same
+// bounds checks as AdvReportParser. Responses are read as consecutive
+// records, as the kernel does; controllers send one per event in practice,
+// where that and the spec's parameter arrays are the same bytes.
+class InquiryResultParser {
+public:
+    InquiryResultParser(const unsigned char* buf, size_t len)
+        : event(0), stride(0), pos(nullptr), end(nullptr), remaining(0), bad(false) {
+        const size_t off = 1 + HCI_EVENT_HDR_SIZE;
+        if (len < off + 1 || buf[0] != HCI_EVENT_PKT) return;
+        event = buf[1];
+        if (event == EVT_INQUIRY_RESULT) stride = INQUIRY_INFO_SIZE;
+        else if (event == EVT_INQUIRY_RESULT_WITH_RSSI) stride = INQUIRY_INFO_WITH_RSSI_SIZE;
+        else if (event == EVT_EXTENDED_INQUIRY_RESULT) stride = EXTENDED_INQUIRY_INFO_SIZE;
+        else return;
+
+        size_t plen = buf[2];
+        if (plen < 1 || off + plen > len) {
+            bad = true;
+            return;
+        }
+        remaining = buf[off];
+        pos = buf + off + 1;
+        end = buf + off + plen;
+    }
+
+    bool next(InquiryResult& result) {
+        if (remaining == 0) return false;
+        if ((size_t)(end - pos) < stride) {
+            bad = true;
+            remaining = 0;
+            return false;
+        }
+
+        // The address and page scan repetition mode lead every layout
+        result.addr = (const bdaddr_t*)pos;
+        result.pscan_rep_mode = pos[6];
+        result.rssi = -255;
+        result.eir = ByteSpan();
+        const uint8_t* cls;
+        if (event == EVT_INQUIRY_RESULT) {
+            const inquiry_info* info = (const inquiry_info*)pos;
+            cls = info->dev_class;
+            result.clock_offset = btohs(info->clock_offset);
+        } else if (event == EVT_INQUIRY_RESULT_WITH_RSSI) {
+            const inquiry_info_with_rssi* info = (const inquiry_info_with_rssi*)pos;
+            cls = info->dev_class;
+            result.clock_offset = btohs(info->clock_offset);
+            result.rssi = info->rssi;
+        } else {
+            const extended_inquiry_info* info = (const extended_inquiry_info*)pos;
+            cls = info->dev_class;
+            result.clock_offset = btohs(info->clock_offset);
+            result.rssi = info->rssi;
+            result.eir.data = info->data;
+            result.eir.size = sizeof(info->data);
+        }
+        result.dev_class = cls[0] | cls[1] << 8 | (uint32_t)cls[2] << 16;
+
+        pos += stride;
+        remaining--;
+        return true;
+    }
+
+    bool malformed() const { return bad; }
+
+private:
+    uint8_t event;
+    size_t stride;
+    const unsigned char* pos;
+    const unsigned char* end;
+    int remaining;
+    bool bad;
+};
+
+struct AdField {
+    uint8_t type;
+    ByteSpan value;
+};
+
+// Walks the AD structures (length, type, value) of one report's data.
+// A zero length ends the data early, as the spec allows for padding; a
+// length past the end stops the walk and sets malformed().
+class AdFieldParser {
+public:
+    explicit AdFieldParser(ByteSpan data) : pos(data.data), end(data.data + data.size), bad(false) {}
+
+    bool next(AdField& field) {
+        if (pos >= end || pos[0] == 0) return false;
+        size_t length = pos[0];
+        if ((size_t)(end - pos) < 1 + length) {
+            bad = true;
+            pos = end;
+            return false;
+        }
+        field.type = pos[1];
+        field.value.data = pos + 2;
+        field.value.size = length - 1;
+        pos += 1 + length;
+        return true;
+    }
+
+    bool malformed() const { return bad; }
+
+private:
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool bad;
+};
+
+// First field of the given type; false if there is none
+inline bool find_ad_field(ByteSpan data, uint8_t type, ByteSpan& value) {
+    AdFieldParser fields(data);
+    AdField field;
+    while (fields.next(field)) {
+        if (field.type == type) {
+            value = field.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // ADVPARSER_HPP
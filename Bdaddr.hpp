@@ -0,0 +1,101 @@
+#ifndef BDADDR_HPP
+#define BDADDR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+
+// Hash/equality so a binary bdaddr_t can key an unordered container
+// without formatting it through ba2str() first.
+struct BdaddrHash {
+    size_t operator()(const bdaddr_t& addr) const {
+        uint64_t v = 0;
+        memcpy(&v, addr.b, sizeof(addr.b));
+        return std::hash<uint64_t>()(v);
+    }
+};
+
+struct BdaddrEqual {
+    bool operator()(const bdaddr_t& a, const bdaddr_t& b) const {
+        return bacmp(&a, &b) == 0;
+    }
+};
+
+// Address -> value table for lookups on every advertising report. A
+// 256-bit filter turns away almost every foreign address with one bit
+// test; the rest are found by binary search over packed 48-bit keys.
+// Inserts and erases are O(n) and meant for configuration changes only.
+template <typename T>
+class BdaddrTable {
+public:
+    T* find(const bdaddr_t& addr) {
+        uint64_t k = key(addr);
+        unsigned bit = filter_bit(k);
+        if (!(filter[bit >> 6] & (1ULL << (bit & 63)))) return nullptr;
+        auto it = std::lower_bound(keys.begin(), keys.end(), k);
+        if (it == keys.end() || *it != k) return nullptr;
+        return &values[it - keys.begin()];
+    }
+
+    // Inserts, or replaces the value of an address already present
+    void set(const bdaddr_t& addr, T value) {
+        uint64_t k = key(addr);
+        auto it = std::lower_bound(keys.begin(), keys.end(), k);
+        size_t i = it - keys.begin();
+        if (it != keys.end() && *it == k) {
+            values[i] = std::move(value);
+            return;
+        }
+        keys.insert(it, k);
+        values.insert(values.begin() + i, std::move(value));
+        unsigned bit = filter_bit(k);
+        filter[bit >> 6] |= 1ULL << (bit & 63);
+    }
+
+    bool erase(const bdaddr_t& addr) {
+        uint64_t k = key(addr);
+        auto it = std::lower_bound(keys.begin(), keys.end(), k);
+        if (it == keys.end() || *it != k) return false;
+        values.erase(values.begin() + (it - keys.begin()));
+        keys.erase(it);
+
+        // Other keys may share the bit; rebuild rather than clear it
+        memset(filter, 0, sizeof(filter));
+        for (uint64_t other : keys) {
+            unsigned bit = filter_bit(other);
+            filter[bit >> 6] |= 1ULL << (bit & 63);
+        }
+        return true;
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) {
+        for (auto& value : values) fn(value);
+    }
+
+    size_t size() const { return keys.size(); }
+    bool empty() const { return keys.empty(); }
+
+private:
+    std::vector<uint64_t> keys;
+    std::vector<T> values;
+    uint64_t filter[4] = {};
+
+    static uint64_t key(const bdaddr_t& addr) {
+        uint64_t k = 0;
+        memcpy(&k, addr.b, sizeof(addr.b));
+        return k;
+    }
+
+    static unsigned filter_bit(uint64_t k) {
+        // Vendors share the OUI half; mix so the device half decides
+        k ^= k >> 24;
+        k *= 0x9E3779B97F4A7C15ULL;
+        return (unsigned)(k >> 56);
+    }
+};
+
+#endif // BDADDR_HPP
@@ -0,0 +1,122 @@
+#include "BleScanner.hpp"
+#include "BlueProximity.hpp"
+#include "AdData.hpp"
+#include "Log.hpp"
+
+BleScanner::BleScanner(HciDevice& hci) : hci(hci), wanted(false), scanning(false), reads(0) {
+    hci.add_listener(this);
+}
+
+BleScanner::~BleScanner() {
+    stop();
+    hci.remove_listener(this);
+}
+
+void BleScanner::add_monitor(BlueProximity* monitor) {
+    monitors.set(monitor->get_bdaddr(), monitor);
+    // Joining a scan already running: time the first advert from now
+    if (scanning) monitor->on_scan_started();
+}
+
+void BleScanner::remove_monitor(BlueProximity* monitor) {
+    BlueProximity** found = monitors.find(monitor->get_bdaddr());
+    if (found && *found == monitor) {
+        monitors.erase(monitor->get_bdaddr());
+    }
+}
+
+bool BleScanner::has_monitors() const {
+    return !monitors.empty();
+}
+
+bool BleScanner::start() {
+    wanted = true;
+    if (!hci.is_open()) return false; // on_hci_open() retries
+
+    // Passive scan, interval=window=0x10 (10ms) - i.e. continuous.
+    le_set_scan_parameters_cp params = {};
+    params.type = 0x00;
+    params.interval = htobs(0x0010);
+    params.window = htobs(0x0010);
+    params.own_bdaddr_type = 0x00;
+    params.filter = 0x00;
+    hci.send_cmd(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS, LE_SET_SCAN_PARAMETERS_CP_SIZE, &params);
+
+    // Duplicate filtering must stay off: with one long-lived scan the
+    // controller would otherwise report each device exactly once.
+    le_set_scan_enable_cp enable = {};
+    enable.enable = 0x01;
+    enable.filter_dup = 0x00;
+    return hci.send_cmd(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE, LE_SET_SCAN_ENABLE_CP_SIZE, &enable) >= 0;
+}
+
+void BleScanner::stop() {
+    wanted = false;
+    if (!hci.is_open()) return;
+
+    le_set_scan_enable_cp enable = {};
+    enable.enable = 0x00;
+    enable.filter_dup = 0x00;
+    hci.send_cmd(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE, LE_SET_SCAN_ENABLE_CP_SIZE, &enable);
+    scanning = false;
+}
+
+bool BleScanner::is_scanning() const {
+    return scanning;
+}
+
+void BleScanner::on_hci_open() {
+    scanning = false;
+    if (wanted) start();
+}
+
+void BleScanner::on_hci_event(const unsigned char* buf, int len) {
+    switch (buf[1]) {
+        case EVT_LE_META_EVENT:
+            handle_advertising_report(buf, len);
+            break;
+        case EVT_CMD_COMPLETE:
+            handle_cmd_complete(buf, len);
+            break;
+    }
+}
+
+void BleScanner::handle_cmd_complete(const unsigned char* buf, int len) {
+    const int off = 1 + HCI_EVENT_HDR_SIZE;
+    if (len < off + EVT_CMD_COMPLETE_SIZE + 1) return;
+
+    const evt_cmd_complete* cc = (const evt_cmd_complete*)(buf + off);
+    if (btohs(cc->opcode) != cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE)) return;
+
+    uint8_t status = buf[off + EVT_CMD_COMPLETE_SIZE];
+    // 0x0C (Command Disallowed) means the controller was already scanning,
+    // e.g. left enabled by a previous run
+    if (status == 0x00 || status == 0x0C) {
+        bool started = wanted && !scanning;
+        scanning = wanted;
+        if (started) monitors.for_each([](BlueProximity* monitor) { monitor->on_scan_started(); });
+    } else {
+        Log::warn("LE scan enable failed, status 0x%x", status);
+        scanning = false;
+    }
+}
+
+void BleScanner::handle_advertising_report(const unsigned char* buf, int len) {
+    if (len <= 0) return;
+    reads++;
+
+    // Matched on the binary address in place; nothing is formatted or copied
+    AdvReportParser reports(buf, (size_t)len);
+    AdvReport report;
+    while (reports.next(report)) {
+        BlueProximity** monitor = monitors.find(*report.addr);
+        if (!monitor) continue;
+        (*monitor)->report_ble_rssi(report.rssi, reads);
+
+        // Only our own devices' adverts are walked for the TX power level
+        ByteSpan tx_power;
+        if (find_ad_field(report.data, EIR_TX_POWER, tx_power) && tx_power.size == 1) {
+            (*monitor)->report_ble_tx_power((int8_t)tx_power.data[0]);
+        }
+    }
+}
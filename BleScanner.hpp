@@ -0,0 +1,44 @@
+#ifndef BLESCANNER_HPP
+#define BLESCANNER_HPP
+
+#include "Bdaddr.hpp"
+#include "HciDevice.hpp"
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+class BlueProximity;
+
+// Owns one long-lived LE scan for all BLE monitors. Every advertising
+// report is read once and handed to the monitor registered for its address.
+class BleScanner : public HciDevice::Listener {
+public:
+    explicit BleScanner(HciDevice& hci);
+    ~BleScanner();
+
+    void add_monitor(BlueProximity* monitor);
+    void remove_monitor(BlueProximity* monitor);
+    bool has_monitors() const;
+
+    // Scan commands are queued on the shared HCI socket; the controller's
+    // Command Complete arrives through on_hci_event()
+    bool start();
+    void stop();
+    bool is_scanning() const;
+
+    void on_hci_event(const unsigned char* buf, int len) override;
+    void on_hci_open() override;
+
+private:
+    HciDevice& hci;
+    bool wanted;
+    bool scanning;
+    uint64_t reads;     // advertising events handled, numbering each for the monitors
+
+    BdaddrTable<BlueProximity*> monitors;
+
+    void handle_advertising_report(const unsigned char* buf, int len);
+    void handle_cmd_complete(const unsigned char* buf, int len);
+};
+
+#endif // BLESCANNER_HPP
@@ -1,7 +1,8 @@
-/* COnsider std::endl mitigation for perf. */
-
 #include "BlueProximity.hpp"
-#include <iostream>
+#include "AdvParser.hpp"
+#include "Clock.hpp"
+#include "Inquiry.hpp"
+#include "Log.hpp"
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
@@ -9,10 +10,10 @@
 #include <cerrno>
 #include <cstring>
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <sys/poll.h>
 #include <vector>
-#include <iomanip>
 #include <sys/wait.h>
 
 #define EIR_FLAGS                   0x01  /* flags */
@@ -27,251 +28,378 @@
 #define EIR_TX_POWER                0x0A  /* transmit power level */
 #define EIR_DEVICE_ID               0x10  /* device ID */
 
-std::vector<DeviceInfo> BlueProximity::scan_devices() {
+// Two page timeouts at the default 5.12 s; names still missing stay unknown
+static const int NAME_TIMEOUT_MS = 10240;
+
+std::vector<DeviceInfo> BlueProximity::scan_devices(std::string* error, const std::atomic<bool>* stop) {
     std::vector<DeviceInfo> devices;
     int dev_id = hci_get_route(NULL);
     int sock = hci_open_dev(dev_id);
     if (dev_id < 0 || sock < 0) {
-        std::cerr << "Error opening socket for scanning." << std::endl;
+        if (error) *error = "Error opening socket for scanning.";
         return devices;
     }
 
-    int len = 8;
-    int max_rsp = 255;
-    int flags = IREQ_CACHE_FLUSH;
-    inquiry_info *ii = (inquiry_info*)malloc(max_rsp * sizeof(inquiry_info));
-    
-    std::cout << "Scanning for devices..." << std::endl;
-    int num_rsp = hci_inquiry(dev_id, len, max_rsp, NULL, &ii, flags);
-    if (num_rsp < 0) perror("hci_inquiry");
-
-    for (int i = 0; i < num_rsp; i++) {
-        char addr[19] = {0};
-        char name[248] = {0};
-        ba2str(&(ii+i)->bdaddr, addr);
-        memset(name, 0, sizeof(name));
-        if (hci_read_remote_name(sock, &(ii+i)->bdaddr, sizeof(name), name, 0) < 0)
-            strcpy(name, "[unknown]");
-        
-        devices.push_back({std::string(addr), std::string(name)});
-    }
-
-    free(ii);
-    close(sock);
-    return devices;
-}
-
-static int read_ble_rssi_scan(int hci_sock, const std::string& target_mac) {
-    unsigned char buf[HCI_MAX_EVENT_SIZE];
-    struct hci_filter nf, of;
-    socklen_t olen;
-    int len;
-    
-    // Set filter to catch LE Meta Events
-    olen = sizeof(of);
-    if (getsockopt(hci_sock, SOL_HCI, HCI_FILTER, &of, &olen) < 0) {
-        return -255;
-    }
-
+    // In extended mode most devices send their name with the result
+    Inquiry::set_extended_mode(sock);
+    struct hci_filter nf;
     hci_filter_clear(&nf);
     hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
-    hci_filter_set_event(EVT_LE_META_EVENT, &nf);
-    if (setsockopt(hci_sock, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0) {
-        return -255;
-    }
+    Inquiry::add_events(nf);
+    setsockopt(sock, SOL_HCI, HCI_FILTER, &nf, sizeof(nf));
 
-    // Enable scanning
-    // Scan parameters: type=0 (passive), interval=0x10, window=0x10, own_type=0, filter=0
-    hci_le_set_scan_parameters(hci_sock, 0x00, 0x10, 0x10, 0x00, 0x00, 1000);
-    hci_le_set_scan_enable(hci_sock, 0x01, 1, 1000);
+    if (!Inquiry::start(sock, 10)) {
+        if (error) *error = std::string("Inquiry: ") + strerror(errno);
+        close(sock);
+        return devices;
+    }
 
-    int found_rssi = -255;
-    
-    // Poll for 1 second
-    struct pollfd p;
-    p.fd = hci_sock;
-    p.events = POLLIN;
-    
-    time_t start = time(NULL);
-    while (time(NULL) - start < 2) { // up to 2 seconds
-        int n = poll(&p, 1, 500); // 500ms timeout per poll
-        if (n < 0) break; // Error
-        if (n == 0) continue; // Timeout, check total time
-
-        if ((p.revents & POLLIN)) {
-            while ((len = read(hci_sock, buf, sizeof(buf))) < 0) {
-                if (errno == EAGAIN || errno == EINTR) continue;
-                break;
+    std::vector<Inquiry::NameRequest> requests;
+    unsigned char buf[HCI_MAX_EVENT_SIZE];
+    bool inquiring = true;
+    double deadline = monotonic_ms() + 12000; // 8 units of 1.28 s, and some slack
+    while (inquiring && !(stop && *stop)) {
+        int left = (int)(deadline - monotonic_ms());
+        if (left <= 0) break;
+        struct pollfd p = { sock, POLLIN, 0 };
+        int n = poll(&p, 1, stop ? std::min(left, Inquiry::STOP_POLL_MS) : left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) continue;
+        if (n < 0) break;
+        int len = read(sock, buf, sizeof(buf));
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (len <= 0) break;
+        if (len >= 2 && buf[0] == HCI_EVENT_PKT && buf[1] == EVT_INQUIRY_COMPLETE) inquiring = false;
+
+        InquiryResultParser results(buf, len);
+        InquiryResult result;
+        while (results.next(result)) {
+            size_t i = 0;
+            while (i < requests.size() && bacmp(&requests[i].addr, result.addr) != 0) i++;
+            if (i == requests.size()) {
+                char addr[19] = {0};
+                ba2str(result.addr, addr);
+                devices.push_back({std::string(addr), "", result.dev_class});
+                Inquiry::NameRequest request;
+                bacpy(&request.addr, result.addr);
+                requests.push_back(request);
             }
-            if (len < 0) break;
-
-            evt_le_meta_event *meta = (evt_le_meta_event *)(buf + (1 + HCI_EVENT_HDR_SIZE));
-            if (meta->subevent == EVT_LE_ADVERTISING_REPORT) {
-                // Ensure length check
-                // ...
-                le_advertising_info *info = (le_advertising_info *)(meta->data + 1);
-                char addr[18];
-                ba2str(&info->bdaddr, addr);
-                
-                if (target_mac == addr) {
-                    int reports = meta->data[0];
-                    void *offset = meta->data + 1;
-                    
-                    for (int i=0; i<reports; i++) {
-                        le_advertising_info *info_ptr = (le_advertising_info *)offset;
-                        char current_addr[18];
-                        ba2str(&info_ptr->bdaddr, current_addr);
-                        
-                        if (target_mac == current_addr) {
-                            // RSSI is the byte after the data
-                            int8_t rssi = *(int8_t*)(info_ptr->data + info_ptr->length);
-                            found_rssi = (int)rssi;
-                            goto cleanup;
-                        }
-                        
-                        offset = (uint8_t*)info_ptr + 1 + 1 + 6 + 1 + info_ptr->length + 1;
-                    }
-                }
+            requests[i].pscan_rep_mode = result.pscan_rep_mode;
+            requests[i].clock_offset = result.clock_offset;
+
+            ByteSpan value;
+            if (find_ad_field(result.eir, EIR_NAME_COMPLETE, value) || find_ad_field(result.eir, EIR_NAME_SHORT, value)) {
+                devices[i].name.assign((const char*)value.data, value.size);
+                requests[i].done = true;
             }
         }
     }
+    if (inquiring) Inquiry::cancel(sock);
 
-cleanup:
-    // Restore filter
-    setsockopt(hci_sock, SOL_HCI, HCI_FILTER, &of, sizeof(of));
-    // Disable scanning
-    hci_le_set_scan_enable(hci_sock, 0x00, 1, 1000);
-    
-    return found_rssi;
+    // Page for the rest together rather than one after another
+    if (!(stop && *stop)) Inquiry::resolve_names(sock, requests, NAME_TIMEOUT_MS, 4, nullptr, stop);
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!devices[i].name.empty()) continue;
+        devices[i].name = requests[i].name.empty() ? "[unknown]" : requests[i].name;
+    }
+
+    close(sock);
+    return devices;
 }
 
-BlueProximity::BlueProximity(Config config) : config(config), socket_fd(-1), hci_socket(-1), rssi_buffer_pos(0), last_keepalive_time(0) {
-    if (config.buffer_size < 1) config.buffer_size = 1;
-    rssi_buffer.resize(config.buffer_size, -255);
-    
-    // Open HCI socket for RSSI reading
-    dev_id = hci_get_route(NULL);
-    hci_socket = hci_open_dev(dev_id);
-    if (hci_socket < 0) {
-        std::cerr << "Failed to open HCI device" << std::endl;
+BlueProximity::BlueProximity(Config config, EventLoop& loop, HciDevice& hci)
+    : config(config), loop(loop), hci(hci), socket_fd(-1), link_state(LINK_DOWN),
+      connect_id(-1), connect_timer(-1), connect_started(0), next_connect_at(0), connect_failures(0),
+      connect_attempts(0), last_connect_latency(-1),
+      conn_handle(-1), rssi_pending(false), sample_rssi(-255),
+      best_window(std::max(config.buffer_size, 1)), average_rssi(RSSI_MISSING),
+      previous_average(RSSI_MISSING), ticks(0), next_sample_tick(0), last_sample_tick(0),
+      sample_interval(1), last_sample(-255), best_rssi(-255), sample_rate(1.0),
+      estimator(config.estimator), pending_ble_rssi(-255), last_ble_read(0), last_keepalive_time(0),
+      rssi_requested_at(-1), keepalive_sent_at(-1), scan_started_at(-1), first_rssi_at(-1) {
+    if (this->config.buffer_size < 1) this->config.buffer_size = 1;
+    if (this->config.sample_min < 1) this->config.sample_min = 1;
+    std::string error;
+    filter = make_rssi_filter(this->config.filter, this->config.buffer_size, &error);
+    if (!filter) {
+        Log::warn("Warning: %s: %s, using mean", this->config.mac_address, error);
+        filter = make_rssi_filter("mean", this->config.buffer_size);
     }
+    str2ba(this->config.mac_address.c_str(), &bdaddr);
+
+    // BLE devices are fed by the shared BleScanner; classic devices
+    // listen for their Read RSSI completions on the shared HCI socket
+    if (this->config.is_ble) return;
+    hci.add_listener(this);
+
+    // Disarmed until a connect is in flight
+    connect_timer = loop.add_timer(0, 0, [this](uint64_t) {
+        cost.total.wakeups++;
+        if (link_state == LINK_CONNECTING) connect_failed(ETIMEDOUT);
+    });
 }
 
 BlueProximity::~BlueProximity() {
     disconnect();
-    if (hci_socket >= 0) {
-        close(hci_socket);
-    }
+    if (config.is_ble) return;
+    loop.remove_timer(connect_timer);
+    hci.remove_listener(this);
 }
 
 void BlueProximity::disconnect() {
+    if (link_state == LINK_CONNECTING && connect_timer >= 0) {
+        loop.set_timer(connect_timer, 0, 0);
+        cost.total.syscalls++;
+    }
+    if (connect_id >= 0) {
+        hci.get_adapter().cancel_rfcomm(connect_id);
+        connect_id = -1;
+        cost.total.syscalls += 2; // epoll_ctl, close
+    }
     if (socket_fd >= 0) {
+        loop.remove(socket_fd);
         close(socket_fd);
         socket_fd = -1;
+        cost.total.syscalls += 2;
     }
+    link_state = LINK_DOWN;
+    conn_handle = -1;
+    rssi_pending = false;
+    rssi_requested_at = -1;
+    keepalive_sent_at = -1;
 }
 
 bool BlueProximity::connect() {
-    if (socket_fd >= 0) return true;
+    if (link_state != LINK_DOWN) return true;
+
+    connect_attempts++;
+    connect_started = monotonic_ms();
+    cost.total.connect_attempts++;
+    cost.total.syscalls += 3; // socket, connect, epoll_ctl
+
+    // The adapter reports the outcome through on_connect_result()
+    connect_id = hci.get_adapter().connect_rfcomm(bdaddr, config.channel,
+        [this](int fd, int err) { on_connect_result(fd, err); });
+    if (connect_id < 0) {
+        connect_failed(errno);
+        return false;
+    }
 
-    struct sockaddr_rc addr = { 0 };
-    int status;
+    link_state = LINK_CONNECTING;
+    if (connect_timer >= 0) {
+        loop.set_timer(connect_timer, config.connect_timeout_ms, 0);
+        cost.total.syscalls++;
+    }
+    return true;
+}
 
-    // Allocate a socket
-    socket_fd = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
-    if (socket_fd < 0) {
-        perror("socket");
-        return false;
+void BlueProximity::on_connect_result(int fd, int err) {
+    connect_id = -1;
+    cost.total.wakeups++;
+    cost.total.syscalls += 2; // getsockopt, epoll_ctl
+    if (fd < 0) {
+        connect_failed(err);
+        return;
     }
 
-    // Set the connection parameters (who to connect to)
-    addr.rc_family = AF_BLUETOOTH;
-    addr.rc_channel = (uint8_t) config.channel;
-    str2ba(config.mac_address.c_str(), &addr.rc_bdaddr);
-
-    // Connect to server
-    status = ::connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr));
-
-    if (status < 0) {
-        if (errno == EBUSY) {
-            if (config.debug) std::cout << "Device " << config.mac_address << " busy. Attempting to force disconnect via bluetoothctl..." << std::endl;
-            close(socket_fd);
-            socket_fd = -1;
-            
-            // Try to disconnect using bluetoothctl
-            std::string cmd = "bluetoothctl disconnect " + config.mac_address;
-            int ret = system(cmd.c_str());
-            if (ret == 0) {
-                 if (config.debug) std::cout << "Disconnect command sent successfully." << std::endl;
-                 // We can't immediately reconnect, let the next update cycle handle it
-            }
-            return false; 
-        }
+    socket_fd = fd;
+    cost.total.syscalls++;
+    if (!loop.add(socket_fd, EPOLLIN, [this](uint32_t events) { on_socket_event(events); })) {
+        connect_failed(ENOMEM);
+        return;
+    }
+    on_connected();
+}
 
-        if (config.debug) {
-            std::cerr << "Connect failed for " << config.mac_address << ": " << strerror(errno) << std::endl;
-        }
+void BlueProximity::connect_failed(int err) {
+    if (connect_timer >= 0) {
+        loop.set_timer(connect_timer, 0, 0);
+        cost.total.syscalls++;
+    }
+    if (connect_id >= 0) {
+        hci.get_adapter().cancel_rfcomm(connect_id);
+        connect_id = -1;
+        cost.total.syscalls += 2;
+    }
+    if (socket_fd >= 0) {
+        loop.remove(socket_fd);
         close(socket_fd);
         socket_fd = -1;
-        return false;
+        cost.total.syscalls += 2;
+    }
+    link_state = LINK_DOWN;
+
+    if (err == EBUSY) {
+        // A stale ACL link is in the way. Tear it down over HCI and retry
+        // on the shortest backoff step instead of shelling out.
+        Log::debug("Device %s busy. Forcing ACL disconnect...", config.mac_address);
+        force_acl_disconnect();
+        connect_failures = 0;
+    }
+
+    schedule_reconnect();
+
+    if (Log::enabled(Log::DEBUG)) {
+        Log::debug("Connect failed for %s: %s (attempt %d, retry in %dms)", config.mac_address, strerror(err),
+                   connect_attempts, (int)(next_connect_at - monotonic_ms()));
     }
-    
-    return true;
 }
 
-int BlueProximity::get_hci_conn_handle(int dev_id, const char* addr) {
-    struct hci_conn_list_req *cl;
-    struct hci_conn_info *ci;
-    int i;
-    char bd_addr[18];
-    
-    if (dev_id < 0) return -1;
+void BlueProximity::schedule_reconnect() {
+    // min * 2^failures, capped; an absent phone settles at one attempt
+    // per reconnect_max_ms while a returning one is caught on the next step
+    double delay = config.reconnect_min_ms;
+    for (int i = 0; i < connect_failures && delay < config.reconnect_max_ms; i++) delay *= 2;
+    if (delay > config.reconnect_max_ms) delay = config.reconnect_max_ms;
 
-    cl = (struct hci_conn_list_req *)malloc(10 * sizeof(*ci) + sizeof(*cl));
-    if (!cl) return -1;
+    next_connect_at = monotonic_ms() + delay;
+    connect_failures++;
+}
 
-    cl->dev_id = dev_id;
-    cl->conn_num = 10;
-    ci = cl->conn_info;
+void BlueProximity::force_acl_disconnect() {
+    int handle = hci.get_conn_handle(bdaddr);
+    if (handle < 0) return;
+
+    disconnect_cp cp;
+    cp.handle = htobs((uint16_t)handle);
+    cp.reason = 0x13; // Remote User Terminated Connection
+    cost.total.hci_commands++;
+    cost.total.syscalls++;
+    if (hci.send_cmd(OGF_LINK_CTL, OCF_DISCONNECT, DISCONNECT_CP_SIZE, &cp) < 0 && Log::enabled(Log::DEBUG)) {
+        Log::errno_error("HCI Disconnect");
+    }
+}
 
-    if (ioctl(hci_socket, HCIGETCONNLIST, (void *)cl)) {
-        if (config.debug) perror("HCIGETCONNLIST");
-        free(cl);
-        return -1;
+void BlueProximity::on_connected() {
+    if (connect_timer >= 0) {
+        loop.set_timer(connect_timer, 0, 0);
+        cost.total.syscalls++;
     }
+    last_connect_latency = monotonic_ms() - connect_started;
+    latency.connect.record_ms(last_connect_latency);
+    Log::debug("[%s] Connected in %dms (attempt %d, %d failed in a row)", config.mac_address,
+               (int)last_connect_latency, connect_attempts, connect_failures);
+    connect_failures = 0;
+
+    link_state = LINK_UP;
+    // Resolve the ACL handle once; it stays valid until the controller
+    // reports Disconnection Complete for it
+    conn_handle = get_hci_conn_handle();
+    // Take the first sample right away so it is ready by the next update
+    if (!request_rssi()) disconnect();
+}
 
-    for (i = 0; i < cl->conn_num; i++, ci++) {
-        ba2str(&ci->bdaddr, bd_addr);
-        if (strcmp(bd_addr, addr) == 0) {
-            int handle = ci->handle;
-            free(cl);
-            return handle;
-        }
+void BlueProximity::on_socket_event(uint32_t events) {
+    cost.total.wakeups++;
+    if (events & EPOLLIN) {
+        read_keepalive_response();
+    }
+    if (socket_fd >= 0 && (events & (EPOLLERR | EPOLLHUP))) {
+        Log::debug("[%s] RFCOMM link lost", config.mac_address);
+        disconnect();
     }
+}
 
-    if (config.debug) std::cerr << "Connection handle not found for " << addr << std::endl;
-    free(cl);
-    return -1;
+int BlueProximity::get_hci_conn_handle() {
+    int handle = hci.get_conn_handle(bdaddr);
+    cost.total.syscalls++; // HCIGETCONNLIST
+    if (handle < 0) Log::debug("Connection handle not found for %s", config.mac_address);
+    return handle;
 }
 
-int BlueProximity::read_rssi(int& rssi_value) {
-    if (hci_socket < 0) return -1;
+bool BlueProximity::request_rssi() {
+    if (!hci.is_open()) return false;
 
-    // Get handle
-    int handle = get_hci_conn_handle(dev_id, config.mac_address.c_str());
-    if (handle < 0) {
-        if (config.debug) std::cerr << "Failed to get HCI handle for " << config.mac_address << std::endl;
-        return -1;
+    // Only reached if the lookup in on_connected() raced the ACL setup
+    if (conn_handle < 0) conn_handle = get_hci_conn_handle();
+    if (conn_handle < 0) {
+        Log::debug("Failed to get HCI handle for %s", config.mac_address);
+        return false;
     }
 
-    int8_t rssi;
-    if (hci_read_rssi(hci_socket, handle, &rssi, 1000) < 0) {
-        if (config.debug) perror("hci_read_rssi");
-        return -1;
+    // Queue Read RSSI; the Command Complete arrives through on_hci_event()
+    uint16_t cp = htobs((uint16_t)conn_handle);
+    cost.total.hci_commands++;
+    cost.total.syscalls++;
+    if (hci.send_cmd(OGF_STATUS_PARAM, OCF_READ_RSSI, sizeof(cp), &cp) < 0) {
+        if (Log::enabled(Log::DEBUG)) Log::errno_error("Read RSSI");
+        return false;
     }
 
-    rssi_value = (int)rssi;
-    return 0;
+    rssi_pending = true;
+    rssi_requested_at = monotonic_ms();
+    return true;
+}
+
+void BlueProximity::on_hci_event(const unsigned char* buf, int len) {
+    switch (buf[1]) {
+        case EVT_CMD_COMPLETE:
+            handle_rssi_complete(buf, len);
+            break;
+        case EVT_CONN_COMPLETE:
+            handle_conn_complete(buf, len);
+            break;
+        case EVT_DISCONN_COMPLETE:
+            handle_disconn_complete(buf, len);
+            break;
+    }
+}
+
+void BlueProximity::handle_conn_complete(const unsigned char* buf, int len) {
+    const int off = 1 + HCI_EVENT_HDR_SIZE;
+    if (len < off + EVT_CONN_COMPLETE_SIZE) return;
+
+    const evt_conn_complete* cc = (const evt_conn_complete*)(buf + off);
+    if (cc->status || cc->link_type != ACL_LINK || bacmp(&cc->bdaddr, &bdaddr) != 0) return;
+
+    cost.total.wakeups++;
+    // Saves the HCIGETCONNLIST lookup when the ACL comes up with our connect,
+    // and is the only way a replayed trace tells us our handle
+    conn_handle = btohs(cc->handle);
+}
+
+void BlueProximity::handle_disconn_complete(const unsigned char* buf, int len) {
+    const int off = 1 + HCI_EVENT_HDR_SIZE;
+    if (conn_handle < 0 || len < off + EVT_DISCONN_COMPLETE_SIZE) return;
+
+    const evt_disconn_complete* dc = (const evt_disconn_complete*)(buf + off);
+    if (dc->status || btohs(dc->handle) != conn_handle) return;
+    cost.total.wakeups++;
+
+    Log::debug("[%s] ACL disconnected, reason 0x%x", config.mac_address, dc->reason);
+    // The handle may be reused by the next connection; drop it and the
+    // RFCOMM socket now rather than waiting for the socket to notice
+    disconnect();
+}
+
+void BlueProximity::handle_rssi_complete(const unsigned char* buf, int len) {
+    const int off = 1 + HCI_EVENT_HDR_SIZE;
+    // In replay the trace holds the completions of requests made when it was recorded
+    if (!rssi_pending && !hci.is_replay()) return;
+    if (len < off + EVT_CMD_COMPLETE_SIZE + READ_RSSI_RP_SIZE) return;
+
+    const evt_cmd_complete* cc = (const evt_cmd_complete*)(buf + off);
+    if (btohs(cc->opcode) != cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI)) return;
+
+    const read_rssi_rp* rp = (const read_rssi_rp*)(buf + off + EVT_CMD_COMPLETE_SIZE);
+    if (btohs(rp->handle) != conn_handle) return;
+    cost.total.wakeups++;
+
+    rssi_pending = false;
+    if (rp->status) {
+        if (hci.is_replay()) return;
+        Log::debug("[%s] Read RSSI failed, status 0x%x", config.mac_address, rp->status);
+        // Failed to read RSSI, maybe connection lost?
+        // Wait for next cycle to reconnect
+        disconnect();
+        return;
+    }
+    sample_rssi = (int)rp->rssi;
+    if (first_rssi_at < 0) first_rssi_at = monotonic_ms();
+    if (rssi_requested_at >= 0) {
+        latency.read_rssi.record_ms(monotonic_ms() - rssi_requested_at);
+        rssi_requested_at = -1;
+    }
 }
 
 void BlueProximity::send_keepalive() {
@@ -281,109 +409,238 @@ void BlueProximity::send_keepalive() {
     // "AT\r" is a standard modem command.
     const char* keepalive_cmd = "AT\r";
     
-    if (config.debug) {
-        std::cout << "[" << config.mac_address << "] Sending: " << "AT" << std::endl;
-    }
+    Log::debug("[%s] Sending: AT", config.mac_address);
 
+    // The response, if any, is picked up by on_socket_event()
     ssize_t written = write(socket_fd, keepalive_cmd, strlen(keepalive_cmd));
+    cost.total.keepalives++;
+    cost.total.syscalls++;
+    if (written > 0) {
+        cost.total.rfcomm_tx_bytes += written;
+        keepalive_sent_at = monotonic_ms();
+    }
     
     if (written < 0) {
-        if (config.debug) {
-            std::cerr << "[" << config.mac_address << "] Keepalive write failed" << std::endl;
-        }
-    } else {
-        // Read response
-        // Use poll to avoid blocking indefinitely
-        struct pollfd pfd;
-        pfd.fd = socket_fd;
-        pfd.events = POLLIN;
-        
-        // Wait up to 500ms for response
-        int ret = poll(&pfd, 1, 500);
-        if (ret > 0 && (pfd.revents & POLLIN)) {
-            char buf[256];
-            memset(buf, 0, sizeof(buf));
-            ssize_t r = read(socket_fd, buf, sizeof(buf) - 1);
-            if (r > 0) {
-                // Remove trailing newlines for cleaner output
-                std::string response(buf);
-                response.erase(std::remove(response.begin(), response.end(), '\r'), response.end());
-                response.erase(std::remove(response.begin(), response.end(), '\n'), response.end());
-                
-                if (config.debug) {
-                    std::cout << "[" << config.mac_address << "] Received: " << response << std::endl;
-                }
-            }
+        Log::debug("[%s] Keepalive write failed", config.mac_address);
+    }
+}
+
+void BlueProximity::read_keepalive_response() {
+    char buf[256];
+    memset(buf, 0, sizeof(buf));
+    ssize_t r = read(socket_fd, buf, sizeof(buf) - 1);
+    cost.total.syscalls++;
+    if (r > 0) {
+        cost.total.rfcomm_rx_bytes += r;
+        if (keepalive_sent_at >= 0) {
+            latency.keepalive_rtt.record_ms(monotonic_ms() - keepalive_sent_at);
+            keepalive_sent_at = -1;
         }
     }
+    if (r == 0) {
+        disconnect();
+        return;
+    }
+    if (r > 0 && Log::enabled(Log::DEBUG)) {
+        // Remove trailing newlines for cleaner output
+        std::string response(buf);
+        response.erase(std::remove(response.begin(), response.end(), '\r'), response.end());
+        response.erase(std::remove(response.begin(), response.end(), '\n'), response.end());
+        Log::debug("[%s] Received: %s", config.mac_address, response);
+    }
+}
+
+int BlueProximity::choose_sample_interval() const {
+    if (config.sample_max <= config.sample_min) return config.sample_min;
+    // Nothing heard (or a link to bring up): look again as soon as possible
+    if (rssi_missing(average_rssi) || rssi_missing(previous_average)) return config.sample_min;
+
+    // dB to the nearest threshold, 0 inside the hysteresis band, over how
+    // fast the RSSI is moving but never less than a walking pace. The next
+    // sample is due before it could have crossed either threshold.
+    const double WALKING_DB_PER_SEC = 3.0;
+    double lock = -config.lock_distance;
+    double unlock = -config.unlock_distance;
+    double margin = 0;
+    if (average_rssi < std::min(lock, unlock)) margin = std::min(lock, unlock) - average_rssi;
+    else if (average_rssi > std::max(lock, unlock)) margin = average_rssi - std::max(lock, unlock);
+    double speed = std::fabs(average_rssi - previous_average) / sample_interval;
+    int interval = (int)(margin / std::max(speed, WALKING_DB_PER_SEC));
+    return std::max(config.sample_min, std::min(config.sample_max, interval));
 }
 
 void BlueProximity::update() {
+    uint64_t cpu_start = thread_cpu_ns();
+    ticks++;
+    bool due = ticks >= next_sample_tick;
     int rssi = -255;
-    
-    if (config.is_ble) {
-        // BLE Mode
-        if (hci_socket >= 0) {
-            rssi = read_ble_rssi_scan(hci_socket, config.mac_address);
+
+    if (due) {
+        if (config.is_ble) {
+            // BLE Mode - take whatever the scanner delivered since the sample was armed
+            rssi = pending_ble_rssi;
+            pending_ble_rssi = -255;
         } else {
-             // Try to reopen
-            dev_id = hci_get_route(NULL);
-            hci_socket = hci_open_dev(dev_id);
-            if (hci_socket >= 0) {
-                 rssi = read_ble_rssi_scan(hci_socket, config.mac_address);
-            }
-        }
-    } else {
-        // Classic Mode
-        if (connect()) {
-            if (read_rssi(rssi) < 0) {
-                // Failed to read RSSI, maybe connection lost?
-                // Wait for next cycle to reconnect
+            // Classic Mode - collect the sample requested on the previous tick
+            rssi = sample_rssi;
+            sample_rssi = -255;
+            if (rssi_pending && !hci.is_replay()) {
+                // A whole update period without a Command Complete
+                Log::debug("[%s] Read RSSI timed out", config.mac_address);
                 disconnect();
-                rssi = -255; 
             }
-        } else {
-            rssi = -255;
         }
-    }
 
-    // Update buffer
-    rssi_buffer[rssi_buffer_pos] = rssi;
-    rssi_buffer_pos = (rssi_buffer_pos + 1) % config.buffer_size;
+        // Constant work per sample whatever the window length
+        previous_average = average_rssi;
+        average_rssi = filter->push(rssi);
+        best_rssi = (int)best_window.push(rssi);
+        if (config.estimate) estimator.push(rssi, (double)(ticks - last_sample_tick));
+        last_sample = rssi;
+        last_sample_tick = ticks;
+        cost.total.samples++;
+
+        sample_interval = choose_sample_interval();
+        next_sample_tick = ticks + sample_interval;
+    }
+    // Recent samples per second, smoothed over about half a minute
+    sample_rate += ((due ? 1.0 : 0.0) - sample_rate) / 30;
 
-    // Calculate average for display
-    double sum = 0;
-    int best_rssi = -255;
-    for (int r : rssi_buffer) {
-         sum += r;
-         if (r > best_rssi) best_rssi = r;
+    // In replay samples come from the trace; there is no link to manage.
+    // Otherwise reconnect on the backoff schedule, and arm the next sample
+    // one tick ahead so it is ready when due.
+    bool arm = ticks + 1 >= next_sample_tick;
+    if (config.is_ble) {
+        if (arm) pending_ble_rssi = -255;
+    } else if (!hci.is_replay()) {
+        // Small slack so a retry due "this tick" is not pushed to the next one
+        if (link_state == LINK_DOWN && monotonic_ms() + 50 >= next_connect_at) {
+            connect();
+        } else if (link_state == LINK_UP && arm && !rssi_pending) {
+            if (!request_rssi()) disconnect();
+        }
     }
-    double avg_rssi = sum / config.buffer_size;
-    
+
     // Keep-alive (every 25 seconds) - Classic RFCOMM only
-    if (!config.is_ble && socket_fd >= 0) {
-        time_t now = time(NULL);
+    if (!config.is_ble && link_state == LINK_UP) {
+        time_t now = wall_time();
         if (now - last_keepalive_time >= 25) {
             send_keepalive();
             last_keepalive_time = now;
         }
     }
 
-    std::cout << "[ " << std::left << std::setw(config.name_padding) << (config.name.empty() ? config.mac_address : config.name) 
-              << " ] " << (config.is_ble ? "(BLE)" : "(BT) ") << " " << config.mac_address 
-              << " RSSI: " << std::right << std::setw(4) << rssi 
-              << " Best: " << std::setw(4) << best_rssi
-              << " Avg: " << std::setw(6) << avg_rssi << std::endl;
+    print_status();
+
+    cost.total.update_cpu_ns += thread_cpu_ns() - cpu_start;
 }
 
-double BlueProximity::get_average_rssi() const {
-    double sum = 0;
-    for (int r : rssi_buffer) {
-         sum += r;
+void BlueProximity::print_status() {
+    // Only the values are queued; the log writer formats the line
+    Log::Line status(Log::INFO);
+    status.add("[ %-*s ] %s %s RSSI: %4d Best: %4d Avg: %6.1f", (int)config.name_padding, get_display_name(),
+               config.is_ble ? "(BLE)" : "(BT) ", config.mac_address, last_sample, best_rssi, average_rssi);
+    if (config.sample_max > config.sample_min) {
+        status.add(" Every: %ds (%.2f/s)", sample_interval, sample_rate);
+    }
+    if (config.estimate && estimator.valid()) {
+        status.add(" Est: %6.1f (%.1fm %+.1fm/s)", estimator.rssi(), estimator.distance(), estimator.velocity());
     }
-    return sum / config.buffer_size;
+    if (config.debug && !config.is_ble) {
+        static const char* link_names[] = { "DOWN", "CONNECTING", "UP" };
+        status.add(" Link: %s Attempts: %d Connect: ", link_names[link_state], connect_attempts);
+        if (last_connect_latency < 0) status.add("-");
+        else status.add("%dms", (int)last_connect_latency);
+        if (link_state == LINK_DOWN) {
+            double wait = next_connect_at - monotonic_ms();
+            status.add(" Retry: %dms", wait > 0 ? (int)wait : 0);
+        }
+    }
+}
+
+double BlueProximity::get_average_rssi() const {
+    return average_rssi;
+}
+
+int BlueProximity::get_sample_interval() const {
+    return sample_interval;
+}
+
+double BlueProximity::get_sample_rate() const {
+    return sample_rate;
+}
+
+const ProximityEstimator& BlueProximity::get_estimator() const {
+    return estimator;
+}
+
+const std::string& BlueProximity::get_display_name() const {
+    return config.name.empty() ? config.mac_address : config.name;
+}
+
+DeviceCost& BlueProximity::get_cost() {
+    return cost;
+}
+
+const DeviceLatency& BlueProximity::get_latency() const {
+    return latency;
+}
+
+int BlueProximity::get_last_sample() const {
+    return last_sample;
+}
+
+int BlueProximity::get_link_state() const {
+    return link_state;
+}
+
+void BlueProximity::on_scan_started() {
+    scan_started_at = monotonic_ms();
 }
 
 bool BlueProximity::is_ble_device() const {
     return config.is_ble;
 }
+
+const BlueProximity::Config& BlueProximity::get_config() const {
+    return config;
+}
+
+void BlueProximity::set_distances(int lock_distance, int unlock_distance) {
+    config.lock_distance = lock_distance;
+    config.unlock_distance = unlock_distance;
+    // Don't wait out an interval chosen against the old thresholds; the
+    // next update arms a sample and the one after takes it
+    next_sample_tick = std::min(next_sample_tick, ticks + 2);
+}
+
+void BlueProximity::set_name_padding(size_t padding) {
+    config.name_padding = padding;
+}
+
+double BlueProximity::get_first_rssi_at() const {
+    return first_rssi_at;
+}
+
+const bdaddr_t& BlueProximity::get_bdaddr() const {
+    return bdaddr;
+}
+
+void BlueProximity::report_ble_rssi(int rssi, uint64_t read) {
+    // Several adverts land per update; keep the strongest so a single
+    // faded packet does not read as the device walking away
+    if (rssi > pending_ble_rssi) pending_ble_rssi = rssi;
+    if (read != last_ble_read) {
+        last_ble_read = read;
+        cost.total.wakeups++;
+    }
+    if (first_rssi_at < 0) first_rssi_at = monotonic_ms();
+    if (scan_started_at >= 0) {
+        latency.first_advert.record_ms(monotonic_ms() - scan_started_at);
+        scan_started_at = -1;
+    }
+}
+
+void BlueProximity::report_ble_tx_power(int tx_power) {
+    estimator.set_tx_power(tx_power);
+}
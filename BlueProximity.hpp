@@ -1,6 +1,14 @@
 #ifndef BLUEPROXIMITY_HPP
 #define BLUEPROXIMITY_HPP
 
+#include "DeviceCost.hpp"
+#include "EventLoop.hpp"
+#include "HciDevice.hpp"
+#include "Histogram.hpp"
+#include "ProximityEstimator.hpp"
+#include "RssiFilter.hpp"
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 #include <bluetooth/bluetooth.h>
@@ -11,9 +19,18 @@
 struct DeviceInfo {
     std::string mac;
     std::string name;
+    uint32_t dev_class = 0;
 };
 
-class BlueProximity {
+// Latency of each operation a monitor performs, for the metrics endpoint
+struct DeviceLatency {
+    LatencyHistogram read_rssi;     // Read RSSI command to its Command Complete
+    LatencyHistogram connect;       // RFCOMM connect start to established
+    LatencyHistogram first_advert;  // LE scan enabled to the first advert heard
+    LatencyHistogram keepalive_rtt; // AT keepalive written to the first reply byte
+};
+
+class BlueProximity : public HciDevice::Listener {
 public:
     struct Config {
         std::string mac_address;
@@ -28,36 +45,123 @@ public:
         std::string proximity_command;
         int proximity_interval = 60;
         int buffer_size = 1;
+        int sample_min = 1;              // seconds between samples near a threshold...
+        int sample_max = 4;              // ...and when stable and far from both
+        std::string filter;              // RssiFilter spec; empty = mean over buffer_size
+        bool estimate = false;           // run the Kalman estimator (confidence lock mode)
+        ProximityEstimator::Config estimator;
+        int connect_timeout_ms = 5000;   // abandon an RFCOMM connect after this
+        int reconnect_min_ms = 1000;     // first retry delay after a failure
+        int reconnect_max_ms = 15000;    // backoff ceiling for absent devices
         bool is_ble = false;
         bool debug = false;
         size_t name_padding = 0;
     };
 
-    BlueProximity(Config config);
+    BlueProximity(Config config, EventLoop& loop, HciDevice& hci);
     ~BlueProximity();
 
-    void update(); // Called periodically
+    void update(); // Called once per tick; never blocks
     double get_average_rssi() const;
+    int get_sample_interval() const;  // seconds, as last chosen
+    double get_sample_rate() const;   // samples per second, recent average
+    const ProximityEstimator& get_estimator() const;
+    const std::string& get_display_name() const;
+    DeviceCost& get_cost();
+    const DeviceLatency& get_latency() const;
+    int get_last_sample() const;
+    int get_link_state() const;       // 0 down, 1 connecting, 2 up (classic)
     bool is_ble_device() const;
+    const bdaddr_t& get_bdaddr() const;
+    const Config& get_config() const;
+    double get_first_rssi_at() const; // monotonic ms of the first RSSI the radio gave, -1 before
+
+    // Thresholds the adaptive sampling works against, changed at runtime
+    void set_distances(int lock_distance, int unlock_distance);
+    void set_name_padding(size_t padding);
+
+    // Called by BleScanner for every advertising report from this device;
+    // `read` numbers the HCI read it came in, so one read costs one wakeup
+    // however many of its reports are ours
+    void report_ble_rssi(int rssi, uint64_t read);
+    void report_ble_tx_power(int tx_power);
+    // The shared LE scan was (re)enabled
+    void on_scan_started();
+
+    void on_hci_event(const unsigned char* buf, int len) override;
     
-    static std::vector<DeviceInfo> scan_devices();
+    // Blocking inquiry, with names from EIR data or paged for in parallel.
+    // Logs nothing, so it can run on a thread of its own; failures are
+    // described in *error. Setting *stop cancels the inquiry and any
+    // name requests within Inquiry::STOP_POLL_MS and returns what was found.
+    static std::vector<DeviceInfo> scan_devices(std::string* error = nullptr, const std::atomic<bool>* stop = nullptr);
 
 private:
+    enum LinkState { LINK_DOWN, LINK_CONNECTING, LINK_UP };
+
     Config config;
+    EventLoop& loop;
+    HciDevice& hci;
+    bdaddr_t bdaddr;
     int socket_fd;
-    int hci_socket;
-    int dev_id;
+    LinkState link_state;
+    int connect_id;            // adapter's in-flight connect, or -1
+
+    // Connect deadline and exponential backoff between attempts
+    int connect_timer;
+    double connect_started;
+    double next_connect_at;
+    int connect_failures;      // consecutive, resets on success
+    unsigned long connect_attempts;
+    double last_connect_latency;
+
+    // ACL handle resolved once per connection; reset by Disconnection Complete
+    int conn_handle;
+    bool rssi_pending;
+    int sample_rssi;
     
-    std::vector<int> rssi_buffer;
-    size_t rssi_buffer_pos;
+    std::unique_ptr<RssiFilter> filter;
+    RssiWindowMax best_window;   // strongest raw sample over buffer_size, for display
+    double average_rssi;
+    double previous_average;
+
+    // Adaptive sampling, counted in update() calls (one per second)
+    unsigned long ticks;
+    unsigned long next_sample_tick;
+    unsigned long last_sample_tick;
+    int sample_interval;
+    int last_sample;
+    int best_rssi;
+    double sample_rate;
+    ProximityEstimator estimator;
+    int pending_ble_rssi;
+    uint64_t last_ble_read;
 
     time_t last_keepalive_time;
+    DeviceCost cost;
+    DeviceLatency latency;
+    double rssi_requested_at;   // -1 when no timing is in progress
+    double keepalive_sent_at;
+    double scan_started_at;
+    double first_rssi_at;
 
+    int choose_sample_interval() const;
+    void print_status();
     bool connect();
+    void on_connect_result(int fd, int err);
+    void connect_failed(int err);
+    void schedule_reconnect();
+    void force_acl_disconnect();
+    void on_connected();
+    void on_socket_event(uint32_t events);
     void disconnect();
-    int read_rssi(int& rssi_value);
+    bool request_rssi();
+    void handle_rssi_complete(const unsigned char* buf, int len);
+    void handle_conn_complete(const unsigned char* buf, int len);
+    void handle_disconn_complete(const unsigned char* buf, int len);
     void send_keepalive();
-    int get_hci_conn_handle(int dev_id, const char* addr);
+    void read_keepalive_response();
+    int get_hci_conn_handle();
 };
 
 #endif // BLUEPROXIMITY_HPP
\ No newline at end of file
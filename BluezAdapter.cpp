@@ -0,0 +1,136 @@
+#include "BluezAdapter.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include "Log.hpp"
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+BluezAdapter::BluezAdapter(EventLoop& loop) : loop(loop), dev_id(-1), hci_socket(-1) {
+}
+
+BluezAdapter::~BluezAdapter() {
+    while (!connecting.empty()) cancel_rfcomm(connecting.begin()->first);
+    close_hci();
+}
+
+const char* BluezAdapter::name() const {
+    return "bluez";
+}
+
+int BluezAdapter::open_hci() {
+    if (hci_socket >= 0) return hci_socket;
+
+    dev_id = hci_get_route(NULL);
+    hci_socket = hci_open_dev(dev_id);
+    if (hci_socket < 0) {
+        return -1;
+    }
+
+    struct hci_filter nf;
+    hci_filter_clear(&nf);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+    hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
+    hci_filter_set_event(EVT_CMD_STATUS, &nf);
+    hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+    hci_filter_set_event(EVT_CONN_COMPLETE, &nf);
+    hci_filter_set_event(EVT_DISCONN_COMPLETE, &nf);
+    if (setsockopt(hci_socket, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0) {
+        Log::errno_error("setsockopt HCI_FILTER");
+        close_hci();
+        return -1;
+    }
+    return hci_socket;
+}
+
+void BluezAdapter::close_hci() {
+    if (hci_socket < 0) return;
+    hci_close_dev(hci_socket);
+    hci_socket = -1;
+}
+
+int BluezAdapter::get_dev_id() const {
+    return dev_id;
+}
+
+int BluezAdapter::send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) {
+    if (hci_socket < 0) return -1;
+    return hci_send_cmd(hci_socket, ogf, ocf, plen, const_cast<void*>(param));
+}
+
+int BluezAdapter::get_conn_handle(const bdaddr_t& addr) {
+    if (hci_socket < 0 || dev_id < 0) return -1;
+
+    // Callers cache the result, so this runs once per connection;
+    // a stack buffer is plenty for the 10 entries we ask for
+    alignas(struct hci_conn_list_req) unsigned char storage[sizeof(struct hci_conn_list_req) + 10 * sizeof(struct hci_conn_info)];
+    struct hci_conn_list_req* cl = (struct hci_conn_list_req*)storage;
+    struct hci_conn_info* ci = cl->conn_info;
+
+    cl->dev_id = dev_id;
+    cl->conn_num = 10;
+
+    if (ioctl(hci_socket, HCIGETCONNLIST, (void*)cl)) {
+        return -1;
+    }
+
+    for (int i = 0; i < cl->conn_num; i++, ci++) {
+        if (bacmp(&ci->bdaddr, &addr) == 0) return ci->handle;
+    }
+    return -1;
+}
+
+int BluezAdapter::connect_rfcomm(const bdaddr_t& addr, int channel, ConnectHandler handler) {
+    struct sockaddr_rc rc = {};
+
+    // Allocate a socket; the connect completes through the event loop
+    int fd = socket(AF_BLUETOOTH, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_RFCOMM);
+    if (fd < 0) return -1;
+
+    // Set the connection parameters (who to connect to)
+    rc.rc_family = AF_BLUETOOTH;
+    rc.rc_channel = (uint8_t) channel;
+    bacpy(&rc.rc_bdaddr, &addr);
+
+    if (::connect(fd, (struct sockaddr *)&rc, sizeof(rc)) < 0 && errno != EINPROGRESS) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    // An already-connected socket is writable at once, so an immediate
+    // success is reported through the loop like any other
+    if (!loop.add(fd, EPOLLOUT, [this, fd](uint32_t) { on_connect_event(fd); })) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    connecting[fd] = std::move(handler);
+    return fd;
+}
+
+void BluezAdapter::cancel_rfcomm(int id) {
+    auto it = connecting.find(id);
+    if (it == connecting.end()) return;
+    connecting.erase(it);
+    loop.remove(id);
+    close(id);
+}
+
+void BluezAdapter::on_connect_event(int fd) {
+    auto it = connecting.find(fd);
+    if (it == connecting.end()) return;
+    ConnectHandler handler = std::move(it->second);
+    connecting.erase(it);
+    loop.remove(fd);
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err != 0) {
+        close(fd);
+        handler(-1, err);
+        return;
+    }
+    handler(fd, 0);
+}
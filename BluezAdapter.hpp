@@ -0,0 +1,40 @@
+#ifndef BLUEZADAPTER_HPP
+#define BLUEZADAPTER_HPP
+
+#include "Adapter.hpp"
+#include "EventLoop.hpp"
+#include <unordered_map>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+#include <bluetooth/rfcomm.h>
+
+// The local controller through libbluetooth: a raw HCI socket on the
+// default route and kernel RFCOMM sockets.
+class BluezAdapter : public Adapter {
+public:
+    explicit BluezAdapter(EventLoop& loop);
+    ~BluezAdapter();
+
+    const char* name() const override;
+
+    int open_hci() override;
+    void close_hci() override;
+    int get_dev_id() const override;
+    int send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) override;
+    int get_conn_handle(const bdaddr_t& addr) override;
+
+    int connect_rfcomm(const bdaddr_t& addr, int channel, ConnectHandler handler) override;
+    void cancel_rfcomm(int id) override;
+
+private:
+    EventLoop& loop;
+    int dev_id;
+    int hci_socket;
+    // In-flight connects keyed by their socket, which doubles as the id
+    std::unordered_map<int, ConnectHandler> connecting;
+
+    void on_connect_event(int fd);
+};
+
+#endif // BLUEZADAPTER_HPP
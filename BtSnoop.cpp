@@ -0,0 +1,151 @@
+#include "BtSnoop.hpp"
+#include "Log.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const unsigned char BTSNOOP_MAGIC[8] = { 'b', 't', 's', 'n', 'o', 'o', 'p', 0 };
+static const uint32_t BTSNOOP_VERSION = 1;
+static const uint32_t BTSNOOP_DATALINK_H4 = 1002;
+static const size_t BTSNOOP_HEADER_SIZE = 16;
+static const size_t BTSNOOP_RECORD_HEADER_SIZE = 24;
+// Microseconds between 0000-01-01 and 1970-01-01, as btsnoop counts from year 0
+static const uint64_t BTSNOOP_EPOCH_DELTA = 0x00dcddb30f2f8000ULL;
+
+static void put_be32(unsigned char* p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void put_be64(unsigned char* p, uint64_t v) {
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(const unsigned char* p) {
+    return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+BtSnoopWriter::BtSnoopWriter() : file(nullptr) {
+}
+
+BtSnoopWriter::~BtSnoopWriter() {
+    close();
+}
+
+bool BtSnoopWriter::open(const std::string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        Log::errno_error(("btsnoop " + path).c_str());
+        return false;
+    }
+
+    unsigned char header[BTSNOOP_HEADER_SIZE];
+    memcpy(header, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC));
+    put_be32(header + 8, BTSNOOP_VERSION);
+    put_be32(header + 12, BTSNOOP_DATALINK_H4);
+    fwrite(header, 1, sizeof(header), file);
+    return true;
+}
+
+void BtSnoopWriter::close() {
+    if (file) fclose(file);
+    file = nullptr;
+}
+
+bool BtSnoopWriter::is_open() const {
+    return file != nullptr;
+}
+
+void BtSnoopWriter::write(const unsigned char* pkt, size_t len, bool received, uint64_t unix_us) {
+    if (!file) return;
+
+    // Flags: bit 0 direction (1 = received), bit 1 command/event (vs. data)
+    uint32_t flags = (received ? 0x01 : 0x00);
+    if (len > 0 && (pkt[0] == 0x01 || pkt[0] == 0x04)) flags |= 0x02;
+
+    unsigned char rec[BTSNOOP_RECORD_HEADER_SIZE];
+    put_be32(rec, (uint32_t)len);
+    put_be32(rec + 4, (uint32_t)len);
+    put_be32(rec + 8, flags);
+    put_be32(rec + 12, 0);
+    put_be64(rec + 16, unix_us + BTSNOOP_EPOCH_DELTA);
+
+    // stdio buffering batches these; the file is flushed on close
+    fwrite(rec, 1, sizeof(rec), file);
+    fwrite(pkt, 1, len, file);
+}
+
+BtSnoopReader::BtSnoopReader() : map(nullptr), map_len(0), pos(0) {
+}
+
+BtSnoopReader::~BtSnoopReader() {
+    close();
+}
+
+bool BtSnoopReader::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Log::errno_error(("btsnoop " + path).c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < BTSNOOP_HEADER_SIZE) {
+        Log::error("btsnoop %s: file too short", path);
+        ::close(fd);
+        return false;
+    }
+
+    void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        Log::errno_error("mmap");
+        return false;
+    }
+    map = (const unsigned char*)m;
+    map_len = st.st_size;
+    madvise(m, map_len, MADV_SEQUENTIAL);
+
+    if (memcmp(map, BTSNOOP_MAGIC, sizeof(BTSNOOP_MAGIC)) != 0 ||
+        get_be32(map + 12) != BTSNOOP_DATALINK_H4) {
+        Log::error("btsnoop %s: not an H4 btsnoop file", path);
+        close();
+        return false;
+    }
+    pos = BTSNOOP_HEADER_SIZE;
+    return true;
+}
+
+void BtSnoopReader::close() {
+    if (map) munmap((void*)map, map_len);
+    map = nullptr;
+    map_len = 0;
+    pos = 0;
+}
+
+bool BtSnoopReader::next(Record& record) {
+    if (!map || pos + BTSNOOP_RECORD_HEADER_SIZE > map_len) return false;
+
+    const unsigned char* rec = map + pos;
+    uint32_t included = get_be32(rec + 4);
+    if (pos + BTSNOOP_RECORD_HEADER_SIZE + included > map_len) return false;
+
+    uint32_t flags = get_be32(rec + 8);
+    uint64_t ts = get_be64(rec + 16);
+
+    record.unix_us = ts >= BTSNOOP_EPOCH_DELTA ? ts - BTSNOOP_EPOCH_DELTA : 0;
+    record.received = (flags & 0x01) != 0;
+    record.data = rec + BTSNOOP_RECORD_HEADER_SIZE;
+    record.len = included;
+
+    pos += BTSNOOP_RECORD_HEADER_SIZE + included;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef BTSNOOP_HPP
+#define BTSNOOP_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// btsnoop capture files (datalink 1002, HCI UART/H4): every packet starts
+// with its H4 type byte, which matches what a raw HCI socket returns.
+// Timestamps are microseconds since the Unix epoch at this API.
+
+class BtSnoopWriter {
+public:
+    BtSnoopWriter();
+    ~BtSnoopWriter();
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const;
+
+    // received: controller->host (events); otherwise host->controller
+    void write(const unsigned char* pkt, size_t len, bool received, uint64_t unix_us);
+
+private:
+    FILE* file;
+};
+
+class BtSnoopReader {
+public:
+    struct Record {
+        uint64_t unix_us;
+        bool received;
+        const unsigned char* data; // points into the mapped file
+        size_t len;
+    };
+
+    BtSnoopReader();
+    ~BtSnoopReader();
+
+    bool open(const std::string& path);
+    void close();
+    // false at end of file or on a truncated record
+    bool next(Record& record);
+
+private:
+    const unsigned char* map;
+    size_t map_len;
+    size_t pos;
+};
+
+#endif // BTSNOOP_HPP
@@ -0,0 +1,36 @@
+#include "Clock.hpp"
+
+static bool replaying = false;
+static uint64_t replay_us = 0;
+
+double monotonic_ms() {
+    if (replaying) return replay_us / 1000.0;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+time_t wall_time() {
+    if (replaying) return (time_t)(replay_us / 1000000);
+    return time(NULL);
+}
+
+uint64_t wall_time_us() {
+    if (replaying) return replay_us;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void set_replay_time_us(uint64_t unix_us) {
+    replaying = true;
+    replay_us = unix_us;
+}
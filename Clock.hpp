@@ -0,0 +1,22 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <cstdint>
+#include <ctime>
+
+// Milliseconds on CLOCK_MONOTONIC; use for deadlines and latencies,
+// never for anything shown as wall-clock time.
+double monotonic_ms();
+
+// time(NULL), or the trace time while replaying
+time_t wall_time();
+// The same in microseconds
+uint64_t wall_time_us();
+
+// CPU time consumed by the calling thread, ns. Real even in replay.
+uint64_t thread_cpu_ns();
+
+// Replay: both clocks follow the trace timestamp instead of the system
+void set_replay_time_us(uint64_t unix_us);
+
+#endif // CLOCK_HPP
@@ -0,0 +1,173 @@
+#include "CommandExecutor.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include <cstring>
+#include <csignal>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+CommandExecutor::CommandExecutor(EventLoop& loop) : loop(loop), last_spawn_latency(-1), dry_run(false) {
+    build_environment("", "");
+    loop.add_signal(SIGCHLD, [this](int) { reap_children(); });
+}
+
+void CommandExecutor::set_display(const std::string& display, const std::string& xauthority) {
+    build_environment(display, xauthority);
+}
+
+void CommandExecutor::build_environment(const std::string& display, const std::string& xauthority) {
+    env_storage.clear();
+    for (char** e = environ; e && *e; e++) {
+        // Replaced below when configured
+        if (!display.empty() && strncmp(*e, "DISPLAY=", 8) == 0) continue;
+        if (!display.empty() && !xauthority.empty() && strncmp(*e, "XAUTHORITY=", 11) == 0) continue;
+        env_storage.push_back(*e);
+    }
+    if (!display.empty()) {
+        env_storage.push_back("DISPLAY=" + display);
+        if (!xauthority.empty()) env_storage.push_back("XAUTHORITY=" + xauthority);
+    }
+
+    envp.clear();
+    for (auto& entry : env_storage) envp.push_back(&entry[0]);
+    envp.push_back(nullptr);
+}
+
+bool CommandExecutor::split_simple_command(const std::string& cmd, std::vector<std::string>& argv) {
+    argv.clear();
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+
+    for (size_t i = 0; i < cmd.size(); i++) {
+        char c = cmd[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0;
+            else word += c;
+            continue;
+        }
+        if (quote == '"') {
+            if (c == '"') quote = 0;
+            else if (c == '$' || c == '`' || c == '\\') return false; // expansion inside quotes
+            else word += c;
+            continue;
+        }
+
+        switch (c) {
+            case ' ':
+            case '\t':
+                if (in_word) {
+                    argv.push_back(word);
+                    word.clear();
+                    in_word = false;
+                }
+                break;
+            case '\'':
+            case '"':
+                quote = c;
+                in_word = true;
+                break;
+            case '\\':
+                if (i + 1 >= cmd.size()) return false;
+                word += cmd[++i];
+                in_word = true;
+                break;
+            case '|': case '&': case ';': case '<': case '>': case '(': case ')':
+            case '$': case '`': case '*': case '?': case '[': case '{': case '}':
+            case '~': case '#': case '\n':
+                return false;
+            case '=':
+                // Leading VAR=value assignments are a shell feature
+                if (argv.empty()) return false;
+                word += c;
+                in_word = true;
+                break;
+            default:
+                word += c;
+                in_word = true;
+                break;
+        }
+    }
+    if (quote) return false;
+    if (in_word) argv.push_back(word);
+    return !argv.empty();
+}
+
+pid_t CommandExecutor::execute(const std::string& cmd) {
+    if (cmd.empty()) return -1;
+    if (dry_run) {
+        Log::info("[ SYSTEM ] Would execute: %s", cmd);
+        return 0;
+    }
+    Log::info("[ SYSTEM ] Executing: %s", cmd);
+
+    std::vector<std::string> args;
+    if (!split_simple_command(cmd, args)) {
+        args = { "/bin/sh", "-c", cmd };
+    }
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    // The loop blocks SIGCHLD/SIGINT/SIGTERM for its signalfd; children
+    // must start with a clean mask and default dispositions
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t empty, defaults;
+    sigemptyset(&empty);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    // glibc's posix_spawn() returns once the child has exec'd (or failed to),
+    // so the time spent here is the spawn-to-exec latency
+    pid_t pid = -1;
+    double started = monotonic_ms();
+    int err = posix_spawnp(&pid, argv[0], nullptr, &attr, argv.data(), envp.data());
+    last_spawn_latency = monotonic_ms() - started;
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        Log::error("Error: Failed to launch '%s': %s", cmd, strerror(err));
+        return -1;
+    }
+
+    children[pid] = { cmd, started };
+    Log::info("[ SYSTEM ] Launched pid %d in %.2fms", pid, last_spawn_latency);
+    return pid;
+}
+
+void CommandExecutor::set_dry_run(bool dry_run) {
+    this->dry_run = dry_run;
+}
+
+double CommandExecutor::get_last_spawn_latency() const {
+    return last_spawn_latency;
+}
+
+void CommandExecutor::reap_children() {
+    // Only wait for our own children so popen()/system() callers keep theirs
+    for (auto it = children.begin(); it != children.end();) {
+        int status = 0;
+        pid_t r = waitpid(it->first, &status, WNOHANG);
+        if (r == 0) {
+            ++it;
+            continue;
+        }
+        if (r > 0) {
+            double runtime = monotonic_ms() - it->second.started;
+            if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+                Log::warn("Warning: '%s' exited with %d after %dms", it->second.cmd, WEXITSTATUS(status), (int)runtime);
+            } else if (WIFSIGNALED(status)) {
+                Log::warn("Warning: '%s' killed by signal %d", it->second.cmd, WTERMSIG(status));
+            }
+        }
+        it = children.erase(it);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef COMMANDEXECUTOR_HPP
+#define COMMANDEXECUTOR_HPP
+
+#include "EventLoop.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+
+// Launches lock/unlock/proximity commands with posix_spawn() and a
+// pre-built environment, and reaps them from the event loop through
+// SIGCHLD on a signalfd. Simple commands are exec'd directly; anything
+// needing the shell (pipes, redirection, expansion) goes via /bin/sh -c.
+class CommandExecutor {
+public:
+    explicit CommandExecutor(EventLoop& loop);
+
+    // DISPLAY/XAUTHORITY are placed into the child environment directly
+    void set_display(const std::string& display, const std::string& xauthority);
+
+    // Returns the child's pid, or -1 if it could not be started
+    pid_t execute(const std::string& cmd);
+
+    // Log commands instead of running them (replay)
+    void set_dry_run(bool dry_run);
+
+    // Time spent in posix_spawn(), i.e. until the child has exec'd
+    double get_last_spawn_latency() const;
+
+    // Splits cmd into argv if it needs no shell features; false otherwise
+    static bool split_simple_command(const std::string& cmd, std::vector<std::string>& argv);
+
+private:
+    struct Child {
+        std::string cmd;
+        double started;
+    };
+
+    EventLoop& loop;
+    std::vector<std::string> env_storage;
+    std::vector<char*> envp;
+    std::unordered_map<pid_t, Child> children;
+    double last_spawn_latency;
+    bool dry_run;
+
+    void build_environment(const std::string& display, const std::string& xauthority);
+    void reap_children();
+};
+
+#endif // COMMANDEXECUTOR_HPP
@@ -38,6 +38,7 @@ ConfigFile::GlobalConfig ConfigFile::load(const std::string& path) {
             else if (key == "name") current_device.name = val;
             else if (key == "channel") current_device.channel = std::stoi(val);
             else if (key == "is_ble") current_device.is_ble = (val == "1" || val == "true");
+            else if (key == "filter") current_device.filter = val;
         } else {
             if ( key == "lock_distance" ) config.lock_distance = std::stoi( val );
             else if ( key == "unlock_distance" ) config.unlock_distance = std::stoi( val );
@@ -48,10 +49,23 @@ ConfigFile::GlobalConfig ConfigFile::load(const std::string& path) {
             else if ( key == "prox_cmd" ) config.prox_cmd = val;
             else if ( key == "prox_interval" ) config.prox_interval = std::stoi( val );
             else if ( key == "buffer_size" ) config.buffer_size = std::stoi( val );
+            else if ( key == "sample_min" ) config.sample_min = std::stoi( val );
+            else if ( key == "sample_max" ) config.sample_max = std::stoi( val );
+            else if ( key == "rssi_filter" ) config.rssi_filter = val;
+            else if ( key == "lock_mode" ) config.lock_mode = val;
+            else if ( key == "lock_confidence" ) config.lock_confidence = std::stod( val );
+            else if ( key == "ref_rssi" ) config.ref_rssi = std::stod( val );
+            else if ( key == "path_loss_exponent" ) config.path_loss_exponent = std::stod( val );
+            else if ( key == "connect_timeout_ms" ) config.connect_timeout_ms = std::stoi( val );
+            else if ( key == "reconnect_max_ms" ) config.reconnect_max_ms = std::stoi( val );
             else if ( key == "debug" ) config.debug = ( val == "1" || val == "true" );
+            else if ( key == "log_level" ) config.log_level = val;
+            else if ( key == "log_binary" ) config.log_binary = val;
             else if ( key == "desktop_environment" ) config.desktop_environment = val;
             else if ( key == "display" ) config.display = val;
             else if ( key == "xauthority" ) config.xauthority = val;
+            else if ( key == "metrics" ) config.metrics = val;
+            else if ( key == "control" ) config.control = val;
         }
     }
     if (in_device && !current_device.mac.empty()) {
@@ -74,7 +88,26 @@ void ConfigFile::save( const std::string& path, const GlobalConfig& config ) {
     file << "prox_cmd=" << config.prox_cmd << "\n";
     file << "prox_interval=" << config.prox_interval << "\n";
     file << "buffer_size=" << config.buffer_size << "\n";
+    file << "sample_min=" << config.sample_min << "\n";
+    file << "sample_max=" << config.sample_max << "\n";
+    if ( !config.rssi_filter.empty() ) {
+        file << "rssi_filter=" << config.rssi_filter << "\n";
+    }
+    if ( config.lock_mode != "count" ) {
+        file << "lock_mode=" << config.lock_mode << "\n";
+        file << "lock_confidence=" << config.lock_confidence << "\n";
+        file << "ref_rssi=" << config.ref_rssi << "\n";
+        file << "path_loss_exponent=" << config.path_loss_exponent << "\n";
+    }
+    file << "connect_timeout_ms=" << config.connect_timeout_ms << "\n";
+    file << "reconnect_max_ms=" << config.reconnect_max_ms << "\n";
     file << "debug=" << ( config.debug ? "true" : "false" ) << "\n";
+    if ( config.log_level != "info" ) {
+        file << "log_level=" << config.log_level << "\n";
+    }
+    if ( !config.log_binary.empty() ) {
+        file << "log_binary=" << config.log_binary << "\n";
+    }
     if ( !config.desktop_environment.empty() ) {
         file << "desktop_environment=" << config.desktop_environment << "\n";
     }
@@ -84,6 +117,12 @@ void ConfigFile::save( const std::string& path, const GlobalConfig& config ) {
     if ( !config.xauthority.empty() ) {
         file << "xauthority=" << config.xauthority << "\n";
     }
+    if ( !config.metrics.empty() ) {
+        file << "metrics=" << config.metrics << "\n";
+    }
+    if ( !config.control.empty() ) {
+        file << "control=" << config.control << "\n";
+    }
 
     for (const auto& dev : config.devices) {
         file << "\n[DEVICE]\n";
@@ -91,5 +130,6 @@ void ConfigFile::save( const std::string& path, const GlobalConfig& config ) {
         file << "name=" << dev.name << "\n";
         file << "channel=" << dev.channel << "\n";
         file << "is_ble=" << (dev.is_ble ? "true" : "false") << "\n";
+        if (!dev.filter.empty()) file << "filter=" << dev.filter << "\n";
     }
 }
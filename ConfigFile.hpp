@@ -23,6 +23,7 @@ public:
         std::string name;
         bool is_ble;
         int channel;
+        std::string filter; // overrides rssi_filter when set
         // Add other per-device overrides if needed
     };
 
@@ -36,10 +37,23 @@ public:
         std::string prox_cmd;
         int prox_interval = 60;
         int buffer_size = 1;
+        int sample_min = 1;  // adaptive sampling bounds, seconds
+        int sample_max = 4;
+        std::string rssi_filter; // RssiFilter spec, see RssiFilter.hpp
+        std::string lock_mode = "count"; // "count" or "confidence"
+        double lock_confidence = 0.95;
+        double ref_rssi = -59;           // path-loss model, see ProximityEstimator.hpp
+        double path_loss_exponent = 2.0;
+        int connect_timeout_ms = 5000;
+        int reconnect_max_ms = 15000;
         bool debug = false;
+        std::string log_level = "info"; // error, warn, info or debug
+        std::string log_binary;          // binary log file, see Log.hpp
         std::string desktop_environment; // "gnome", "kde", or custom
         std::string display; // X11 DISPLAY environment variable
         std::string xauthority; // X11 XAUTHORITY file path
+        std::string metrics; // OpenMetrics listen address, see MetricsServer.hpp
+        std::string control; // control socket path, see ControlServer.hpp
         std::vector<DeviceConfig> devices;
     };
 
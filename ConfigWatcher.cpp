@@ -0,0 +1,51 @@
+#include "ConfigWatcher.hpp"
+#include <unistd.h>
+#include <sys/inotify.h>
+
+ConfigWatcher::ConfigWatcher(EventLoop& loop) : loop(loop), inotify_fd(-1) {
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+}
+
+bool ConfigWatcher::start(const std::string& path, std::function<void()> on_change) {
+    stop();
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    file_name = slash == std::string::npos ? path : path.substr(slash + 1);
+    this->on_change = on_change;
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) return false;
+    if (inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        !loop.add(inotify_fd, EPOLLIN, [this](uint32_t) { on_readable(); })) {
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void ConfigWatcher::stop() {
+    if (inotify_fd < 0) return;
+    loop.remove(inotify_fd);
+    close(inotify_fd);
+    inotify_fd = -1;
+}
+
+void ConfigWatcher::on_readable() {
+    alignas(struct inotify_event) char buf[4096];
+    bool ours = false;
+
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len;) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            if (ev->len && file_name == ev->name) ours = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    if (ours) on_change();
+}
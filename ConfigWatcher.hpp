@@ -0,0 +1,27 @@
+#ifndef CONFIGWATCHER_HPP
+#define CONFIGWATCHER_HPP
+
+#include "EventLoop.hpp"
+#include <functional>
+#include <string>
+
+// Calls back when a file is rewritten in place or replaced by rename(),
+// as editors do. The directory is watched, so the file may not exist yet.
+class ConfigWatcher {
+public:
+    explicit ConfigWatcher(EventLoop& loop);
+    ~ConfigWatcher();
+
+    bool start(const std::string& path, std::function<void()> on_change);
+    void stop();
+
+private:
+    EventLoop& loop;
+    int inotify_fd;
+    std::string file_name;
+    std::function<void()> on_change;
+
+    void on_readable();
+};
+
+#endif // CONFIGWATCHER_HPP
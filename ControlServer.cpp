@@ -0,0 +1,205 @@
+#include "ControlServer.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static const size_t MAX_CLIENTS = 8;
+static const size_t MAX_LINE = 1024;
+static const size_t MAX_PENDING_OUTPUT = 64 * 1024; // a client that stops reading is dropped
+
+ControlServer::ControlServer(EventLoop& loop, Handler handler)
+    : loop(loop), handler(handler), listen_fd(-1), socket_dev(0), socket_ino(0) {
+}
+
+ControlServer::~ControlServer() {
+    close();
+}
+
+bool ControlServer::listen(const std::string& path) {
+    close();
+
+    struct sockaddr_un sun = {};
+    sun.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(sun.sun_path)) {
+        Log::error("Error: Bad control socket path '%s'", path);
+        return false;
+    }
+    memcpy(sun.sun_path, path.c_str(), path.size());
+
+    // Replace a socket a previous run left behind, but never a file
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            Log::error("Error: Control socket path %s exists and is not a socket", path);
+            return false;
+        }
+        unlink(path.c_str());
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        Log::errno_error("control socket");
+        return false;
+    }
+    // Anyone who can connect can unlock the session: owner only, from the start
+    mode_t old_umask = umask(0177);
+    int r = bind(listen_fd, (struct sockaddr*)&sun, sizeof(sun));
+    umask(old_umask);
+    if (r < 0) {
+        Log::errno_error("control bind");
+        close();
+        return false;
+    }
+    this->path = path;
+    if (lstat(path.c_str(), &st) == 0) {
+        socket_dev = st.st_dev;
+        socket_ino = st.st_ino;
+    }
+
+    if (::listen(listen_fd, 4) < 0 || !loop.add(listen_fd, EPOLLIN, [this](uint32_t) { on_accept(); })) {
+        Log::errno_error("control listen");
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ControlServer::close() {
+    while (!clients.empty()) drop(clients.begin()->first);
+    if (listen_fd >= 0) {
+        loop.remove(listen_fd);
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+    if (!path.empty()) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && st.st_dev == socket_dev && st.st_ino == socket_ino) {
+            unlink(path.c_str());
+        }
+        path.clear();
+    }
+}
+
+void ControlServer::on_accept() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) Log::errno_error("control accept");
+            return;
+        }
+        if (clients.size() >= MAX_CLIENTS) drop(clients.begin()->first);
+
+        if (!loop.add(fd, EPOLLIN, [this, fd](uint32_t events) { on_client_event(fd, events); })) {
+            ::close(fd);
+            continue;
+        }
+        clients[fd] = Client();
+    }
+}
+
+void ControlServer::on_client_event(int fd, uint32_t events) {
+    auto it = clients.find(fd);
+    if (it == clients.end()) return;
+    Client& client = it->second;
+
+    if (events & EPOLLOUT) {
+        if (!flush(fd, client)) return;
+    }
+    if (events & EPOLLIN) {
+        char buf[1024];
+        bool eof = false;
+        while (true) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r > 0) {
+                client.input.append(buf, r);
+                continue;
+            }
+            if (r < 0 && errno == EINTR) continue;
+            eof = r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+        }
+
+        size_t nl;
+        while ((nl = client.input.find('\n')) != std::string::npos) {
+            std::string line = client.input.substr(0, nl);
+            client.input.erase(0, nl + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+
+            std::vector<std::string> words = split(line);
+            if (words.empty()) continue;
+            std::string reply;
+            std::string error = handler(words, reply);
+            client.output += reply;
+            client.output += error.empty() ? "OK\n" : "ERR " + error + "\n";
+        }
+        if (client.input.size() > MAX_LINE) {
+            drop(fd);
+            return;
+        }
+        if (!flush(fd, client)) return;
+        if (eof) {
+            drop(fd);
+            return;
+        }
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) drop(fd);
+}
+
+// false if the client was dropped
+bool ControlServer::flush(int fd, Client& client) {
+    while (client.sent < client.output.size()) {
+        ssize_t w = send(fd, client.output.data() + client.sent, client.output.size() - client.sent, MSG_NOSIGNAL);
+        if (w > 0) {
+            client.sent += w;
+            continue;
+        }
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (client.output.size() - client.sent > MAX_PENDING_OUTPUT) {
+                drop(fd);
+                return false;
+            }
+            loop.modify(fd, EPOLLIN | EPOLLOUT);
+            return true;
+        }
+        drop(fd);
+        return false;
+    }
+    client.output.clear();
+    client.sent = 0;
+    loop.modify(fd, EPOLLIN);
+    return true;
+}
+
+void ControlServer::drop(int fd) {
+    loop.remove(fd);
+    ::close(fd);
+    clients.erase(fd);
+}
+
+std::vector<std::string> ControlServer::split(const std::string& line) {
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < line.size()) {
+        if (line[i] == ' ' || line[i] == '\t') {
+            i++;
+            continue;
+        }
+        if (line[i] == '"') {
+            size_t end = line.find('"', i + 1);
+            if (end == std::string::npos) end = line.size();
+            words.push_back(line.substr(i + 1, end - i - 1));
+            i = end + 1;
+            continue;
+        }
+        size_t end = line.find_first_of(" \t", i);
+        if (end == std::string::npos) end = line.size();
+        words.push_back(line.substr(i, end - i));
+        i = end;
+    }
+    return words;
+}
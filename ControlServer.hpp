@@ -0,0 +1,52 @@
+#ifndef CONTROLSERVER_HPP
+#define CONTROLSERVER_HPP
+
+#include "EventLoop.hpp"
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Line-oriented control protocol on a Unix socket (mode 0600), served
+// from the event loop. Each request is one line of space-separated words;
+// the handler appends any output lines to the reply, which the server
+// terminates with "OK" or "ERR <reason>". Clients stay connected and may
+// send any number of requests, e.g. through `socat - UNIX-CONNECT:<path>`.
+class ControlServer {
+public:
+    // Returns an empty string on success, otherwise the reason it failed
+    using Handler = std::function<std::string(const std::vector<std::string>& words, std::string& reply)>;
+
+    ControlServer(EventLoop& loop, Handler handler);
+    ~ControlServer();
+
+    bool listen(const std::string& path);
+    void close();
+
+    // Splits a request into words; a double-quoted word keeps its spaces:
+    // add AA:BB:CC:DD:EE:FF ble "Work phone"
+    static std::vector<std::string> split(const std::string& line);
+
+private:
+    struct Client {
+        std::string input;
+        std::string output;
+        size_t sent = 0;
+    };
+
+    EventLoop& loop;
+    Handler handler;
+    int listen_fd;
+    std::string path;
+    dev_t socket_dev;          // the socket this process bound; close()
+    ino_t socket_ino;          // leaves anything else at the path alone
+    std::map<int, Client> clients;
+
+    void on_accept();
+    void on_client_event(int fd, uint32_t events);
+    bool flush(int fd, Client& client);
+    void drop(int fd);
+};
+
+#endif // CONTROLSERVER_HPP
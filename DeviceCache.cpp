@@ -0,0 +1,169 @@
+#include "DeviceCache.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char MAGIC[8] = { 'B', 'P', 'D', 'E', 'V', 0, 0, 1 };
+static const uint32_t CAPACITY = 256;
+static const size_t FILE_SIZE = sizeof(DeviceCache::Header) + CAPACITY * sizeof(DeviceCache::Record);
+
+enum { USED = 1, BLE = 2, CLASSIC = 4 };
+static const int8_t RECORD_NO_RSSI = 127;
+
+static_assert(sizeof(DeviceCache::Record) == 88, "cache records are part of the file format");
+
+DeviceCache::DeviceCache() : fd(-1), records(nullptr), capacity(0) {
+}
+
+DeviceCache::~DeviceCache() {
+    close();
+}
+
+bool DeviceCache::open(const std::string& path) {
+    close();
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+
+    // A cache from another version, or a damaged one, is replaced once.
+    // The replacing process unlinks it under the lock; anyone who opened
+    // the old file before that finds the path has moved on once they hold
+    // the lock, and reopens rather than unlinking the new one.
+    bool replaced = false;
+    for (int attempt = 0; attempt < 8; attempt++) { // bounded, should the path keep changing
+        int f = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (f < 0) return false;
+        flock(f, LOCK_EX);
+
+        struct stat st, named;
+        bool ok = fstat(f, &st) == 0;
+        if (ok && (stat(path.c_str(), &named) != 0 || named.st_dev != st.st_dev || named.st_ino != st.st_ino)) {
+            ::close(f);
+            continue;
+        }
+        if (ok && st.st_size == 0) {
+            // First user lays it out; the rest wait on the lock and see it done
+            Header header = {};
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.capacity = CAPACITY;
+            header.record_size = sizeof(Record);
+            ok = ftruncate(f, FILE_SIZE) == 0 && pwrite(f, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        } else if (ok) {
+            Header header;
+            ok = (size_t)st.st_size == FILE_SIZE && pread(f, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.capacity == CAPACITY &&
+                 header.record_size == sizeof(Record);
+            if (!ok && !replaced) {
+                replaced = true;
+                unlink(path.c_str());
+                ::close(f);
+                continue;
+            }
+        }
+
+        void* p = ok ? mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0) : MAP_FAILED;
+        flock(f, LOCK_UN);
+        if (p == MAP_FAILED) {
+            ::close(f);
+            return false;
+        }
+        fd = f;
+        records = (Record*)((char*)p + sizeof(Header));
+        capacity = CAPACITY;
+        return true;
+    }
+    return false;
+}
+
+void DeviceCache::close() {
+    if (records) munmap((char*)records - sizeof(Header), FILE_SIZE);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    records = nullptr;
+    capacity = 0;
+}
+
+bool DeviceCache::is_open() const {
+    return records != nullptr;
+}
+
+void DeviceCache::update(const Entry& entry) {
+    if (!records) return;
+    flock(fd, LOCK_EX);
+
+    // The device's own record, else a free one, else the stalest
+    Record* slot = nullptr;
+    Record* free_slot = nullptr;
+    Record* oldest = &records[0];
+    for (uint32_t i = 0; i < capacity; i++) {
+        Record& r = records[i];
+        if (!(r.flags & USED)) {
+            if (!free_slot) free_slot = &r;
+            continue;
+        }
+        if (bacmp(&r.addr, &entry.addr) == 0) {
+            slot = &r;
+            break;
+        }
+        if (r.last_seen < oldest->last_seen || !(oldest->flags & USED)) oldest = &r;
+    }
+    if (!slot) {
+        slot = free_slot ? free_slot : oldest;
+        memset(slot, 0, sizeof(*slot));
+        bacpy(&slot->addr, &entry.addr);
+        slot->rssi = RECORD_NO_RSSI;
+        slot->flags = USED;
+    }
+
+    if (entry.ble) slot->flags |= BLE;
+    if (entry.classic) slot->flags |= CLASSIC;
+    if (!entry.name.empty()) {
+        size_t len = std::min(entry.name.size(), sizeof(slot->name) - 1);
+        memcpy(slot->name, entry.name.data(), len);
+        slot->name[len] = '\0';
+    }
+    if (entry.rssi != NO_RSSI) slot->rssi = (int8_t)std::max(-127, std::min(126, entry.rssi));
+    if (entry.dev_class) slot->dev_class = entry.dev_class & 0xffffff;
+    if (entry.channel > 0 && entry.channel <= 30) slot->channel = (uint8_t)entry.channel;
+    slot->last_seen = entry.last_seen ? entry.last_seen : time(nullptr);
+
+    flock(fd, LOCK_UN);
+}
+
+std::vector<DeviceCache::Entry> DeviceCache::entries() const {
+    std::vector<Entry> list;
+    if (!records) return list;
+    flock(fd, LOCK_SH);
+    for (uint32_t i = 0; i < capacity; i++) {
+        const Record& r = records[i];
+        if (!(r.flags & USED)) continue;
+        Entry e;
+        bacpy(&e.addr, &r.addr);
+        e.name.assign(r.name, strnlen(r.name, sizeof(r.name)));
+        e.ble = r.flags & BLE;
+        e.classic = r.flags & CLASSIC;
+        e.rssi = r.rssi == RECORD_NO_RSSI ? NO_RSSI : r.rssi;
+        e.dev_class = r.dev_class;
+        e.channel = r.channel;
+        e.last_seen = (time_t)r.last_seen;
+        list.push_back(e);
+    }
+    flock(fd, LOCK_UN);
+
+    std::stable_sort(list.begin(), list.end(), [](const Entry& a, const Entry& b) {
+        return a.last_seen > b.last_seen;
+    });
+    return list;
+}
+
+std::string DeviceCache::default_path() {
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if (cache && *cache) return std::string(cache) + "/blueproximity/devices";
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/blueproximity/devices";
+}
@@ -0,0 +1,72 @@
+#ifndef DEVICECACHE_HPP
+#define DEVICECACHE_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+
+// Devices seen before, kept in a small fixed-size file that the daemon and
+// the scan tools map shared and update in place, so first-run selection
+// can list candidates without waiting for an inquiry. Writers hold an
+// exclusive flock() for an update, readers a shared one for a snapshot.
+// When the table is full the device heard longest ago is replaced.
+//
+// File layout, native byte order:
+//   Header, Record[capacity]
+class DeviceCache {
+public:
+    static const int NO_RSSI = -255;
+
+    struct Entry {
+        bdaddr_t addr = {};
+        std::string name;          // empty = keep the cached name
+        bool ble = false;          // heard advertising
+        bool classic = false;      // heard by inquiry or linked over BR/EDR
+        int rssi = NO_RSSI;        // last reading; NO_RSSI = keep the cached one
+        uint32_t dev_class = 0;    // Class of Device; 0 = unknown
+        int channel = 0;           // RFCOMM channel that answered; 0 = unknown
+        time_t last_seen = 0;      // 0 = now
+    };
+
+    struct Header {
+        char magic[8];             // "BPDEV\0\0\1"
+        uint32_t capacity;
+        uint32_t record_size;
+    };
+
+    struct Record {
+        bdaddr_t addr;
+        uint8_t flags;             // USED, BLE, CLASSIC
+        int8_t rssi;               // RECORD_NO_RSSI if never read
+        uint32_t dev_class;
+        uint8_t channel;
+        uint8_t reserved[3];
+        int64_t last_seen;
+        char name[64];             // NUL-terminated, truncated
+    };
+
+    DeviceCache();
+    ~DeviceCache();
+
+    // Maps the cache, creating it (and its directory) on first use
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const;
+
+    // Merges what is known about a device into its record
+    void update(const Entry& entry);
+    // Every cached device, most recently seen first
+    std::vector<Entry> entries() const;
+
+    // ~/.cache/blueproximity/devices (or under $XDG_CACHE_HOME)
+    static std::string default_path();
+
+private:
+    int fd;
+    Record* records;
+    uint32_t capacity;
+};
+
+#endif // DEVICECACHE_HPP
@@ -0,0 +1,70 @@
+#include "DeviceCost.hpp"
+#include <iomanip>
+
+CostCounters CostCounters::operator-(const CostCounters& other) const {
+    CostCounters d;
+    d.hci_commands = hci_commands - other.hci_commands;
+    d.scan_ms = scan_ms - other.scan_ms;
+    d.rfcomm_tx_bytes = rfcomm_tx_bytes - other.rfcomm_tx_bytes;
+    d.rfcomm_rx_bytes = rfcomm_rx_bytes - other.rfcomm_rx_bytes;
+    d.keepalives = keepalives - other.keepalives;
+    d.connect_attempts = connect_attempts - other.connect_attempts;
+    d.syscalls = syscalls - other.syscalls;
+    d.wakeups = wakeups - other.wakeups;
+    d.samples = samples - other.samples;
+    d.update_cpu_ns = update_cpu_ns - other.update_cpu_ns;
+    return d;
+}
+
+DeviceCost::DeviceCost() : minutes(0) {
+}
+
+void DeviceCost::roll_minute() {
+    previous_minute = total - minute_start;
+    minute_start = total;
+    minutes++;
+}
+
+const CostCounters& DeviceCost::last_minute() const {
+    return previous_minute;
+}
+
+void DeviceCost::print_header(std::ostream& out) {
+    std::ios format(nullptr);
+    format.copyfmt(out);
+    out << std::left << std::setw(20) << "Device" << std::setw(9) << "Per min"
+        << std::right << std::setw(8) << "HCI" << std::setw(8) << "Scan s"
+        << std::setw(9) << "RF tx B" << std::setw(9) << "RF rx B" << std::setw(6) << "KA"
+        << std::setw(6) << "Conn" << std::setw(9) << "Syscall" << std::setw(8) << "Wakeup"
+        << std::setw(8) << "Sample" << std::setw(9) << "CPU ms" << "\n";
+    out.copyfmt(format);
+}
+
+static void print_row(std::ostream& out, const std::string& name, const char* label,
+                      const CostCounters& c, double scale) {
+    out << std::left << std::setw(20) << name.substr(0, 19) << std::setw(9) << label << std::right
+        << std::fixed << std::setprecision(1)
+        << std::setw(8) << c.hci_commands * scale
+        << std::setw(8) << c.scan_ms * scale / 1000
+        << std::setw(9) << c.rfcomm_tx_bytes * scale
+        << std::setw(9) << c.rfcomm_rx_bytes * scale
+        << std::setw(6) << c.keepalives * scale
+        << std::setw(6) << c.connect_attempts * scale
+        << std::setw(9) << c.syscalls * scale
+        << std::setw(8) << c.wakeups * scale
+        << std::setw(8) << c.samples * scale
+        << std::setw(9) << std::setprecision(3) << c.update_cpu_ns * scale / 1e6 << "\n";
+}
+
+void DeviceCost::print(std::ostream& out, const std::string& name, double elapsed_min) const {
+    // Leave the caller's number formatting as it was
+    std::ios format(nullptr);
+    format.copyfmt(out);
+
+    if (minutes > 0) print_row(out, name, "last", previous_minute, 1);
+
+    // The average minute so far, partial minutes included
+    if (elapsed_min > 0) print_row(out, minutes > 0 ? "" : name, "average", total, 1 / elapsed_min);
+
+    out.copyfmt(format);
+}
@@ -0,0 +1,46 @@
+#ifndef DEVICECOST_HPP
+#define DEVICECOST_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// What monitoring one device costs: radio time, link traffic, syscalls,
+// wakeups and CPU. Monitors bump the running totals in place; the tick
+// closes a one-minute bucket with roll_minute(), and print() reports the
+// last full minute next to the average minute over `elapsed_min` minutes
+// of monitoring.
+struct CostCounters {
+    uint64_t hci_commands = 0;     // commands queued for this device (Read RSSI, Disconnect)
+    uint64_t scan_ms = 0;          // LE scanning enabled while this device was followed (shared)
+    uint64_t rfcomm_tx_bytes = 0;
+    uint64_t rfcomm_rx_bytes = 0;
+    uint64_t keepalives = 0;
+    uint64_t connect_attempts = 0;
+    uint64_t syscalls = 0;         // issued on this device's behalf, counted at the call sites
+    uint64_t wakeups = 0;          // loop callbacks and HCI events that were for this device
+    uint64_t samples = 0;          // RSSI samples taken by update()
+    uint64_t update_cpu_ns = 0;    // thread CPU time inside update()
+
+    CostCounters operator-(const CostCounters& other) const;
+};
+
+class DeviceCost {
+public:
+    DeviceCost();
+
+    CostCounters total;
+
+    void roll_minute();
+    const CostCounters& last_minute() const;
+
+    static void print_header(std::ostream& out);
+    void print(std::ostream& out, const std::string& name, double elapsed_min) const;
+
+private:
+    CostCounters minute_start;
+    CostCounters previous_minute;
+    int minutes;
+};
+
+#endif // DEVICECOST_HPP
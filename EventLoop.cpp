@@ -0,0 +1,160 @@
+#include "EventLoop.hpp"
+#include "Log.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+static void ms_to_timespec(int ms, struct timespec& ts) {
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+}
+
+EventLoop::EventLoop() : epoll_fd(-1), signal_fd(-1), running(false), next_generation(1) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        Log::errno_error("epoll_create1");
+    }
+}
+
+EventLoop::~EventLoop() {
+    if (signal_fd >= 0) close(signal_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler) {
+    if (epoll_fd < 0 || fd < 0) return false;
+
+    // The generation tag keeps a stale event for a closed-and-reused fd
+    // from reaching the new owner within the same epoll_wait() batch
+    Entry entry;
+    entry.generation = next_generation++;
+    entry.handler = std::make_shared<Handler>(std::move(handler));
+
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)entry.generation << 32) | (uint32_t)fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        Log::errno_error("epoll_ctl ADD");
+        return false;
+    }
+    entries[fd] = std::move(entry);
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    auto it = entries.find(fd);
+    if (it == entries.end()) return false;
+
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)it->second.generation << 32) | (uint32_t)fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) {
+    auto it = entries.find(fd);
+    if (it == entries.end()) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    entries.erase(it);
+}
+
+int EventLoop::add_timer(int initial_ms, int interval_ms, TimerHandler handler) {
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0) {
+        Log::errno_error("timerfd_create");
+        return -1;
+    }
+
+    bool ok = add(tfd, EPOLLIN, [tfd, handler](uint32_t) {
+        uint64_t expirations = 0;
+        if (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        handler(expirations);
+    });
+    if (!ok || !set_timer(tfd, initial_ms, interval_ms)) {
+        remove(tfd);
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+bool EventLoop::set_timer(int timer_id, int initial_ms, int interval_ms) {
+    struct itimerspec its = {};
+    ms_to_timespec(initial_ms, its.it_value);
+    ms_to_timespec(interval_ms, its.it_interval);
+    // A zero it_value disarms; callers asking for "now" get 1ns instead
+    if (initial_ms <= 0 && interval_ms > 0) its.it_value.tv_nsec = 1;
+    return timerfd_settime(timer_id, 0, &its, nullptr) == 0;
+}
+
+void EventLoop::remove_timer(int timer_id) {
+    if (timer_id < 0) return;
+    remove(timer_id);
+    close(timer_id);
+}
+
+bool EventLoop::add_signal(int signo, SignalHandler handler) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (const auto& pair : signal_handlers) sigaddset(&mask, pair.first);
+    sigaddset(&mask, signo);
+
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) < 0) {
+        Log::errno_error("sigprocmask");
+        return false;
+    }
+
+    bool first = signal_fd < 0;
+    signal_fd = signalfd(signal_fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        Log::errno_error("signalfd");
+        return false;
+    }
+    if (first && !add(signal_fd, EPOLLIN, [this](uint32_t) { on_signal_readable(); })) {
+        return false;
+    }
+    signal_handlers[signo] = std::move(handler);
+    return true;
+}
+
+void EventLoop::on_signal_readable() {
+    struct signalfd_siginfo si;
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        auto it = signal_handlers.find((int)si.ssi_signo);
+        if (it != signal_handlers.end()) it->second((int)si.ssi_signo);
+    }
+}
+
+void EventLoop::run_once(int timeout_ms) {
+    struct epoll_event events[32];
+    int n = epoll_wait(epoll_fd, events, 32, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) Log::errno_error("epoll_wait");
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int fd = (int)(uint32_t)events[i].data.u64;
+        uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+
+        auto it = entries.find(fd);
+        if (it == entries.end() || it->second.generation != generation) continue;
+
+        // Hold a reference: the handler may remove itself while running
+        std::shared_ptr<Handler> handler = it->second.handler;
+        (*handler)(events[i].events);
+    }
+}
+
+void EventLoop::run() {
+    running = true;
+    while (running) {
+        run_once(-1);
+    }
+}
+
+void EventLoop::stop() {
+    running = false;
+}
@@ -0,0 +1,53 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+// Single-threaded epoll loop. File descriptors, timerfd timers and
+// signalfd signals all dispatch through the same epoll_wait().
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+    using TimerHandler = std::function<void(uint64_t expirations)>;
+    using SignalHandler = std::function<void(int signo)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    bool add(int fd, uint32_t events, Handler handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Returns a timer id (the timerfd) or -1. interval_ms == 0 means one-shot.
+    int add_timer(int initial_ms, int interval_ms, TimerHandler handler);
+    bool set_timer(int timer_id, int initial_ms, int interval_ms);
+    void remove_timer(int timer_id);
+
+    // Blocks signo for the process and delivers it through a signalfd
+    bool add_signal(int signo, SignalHandler handler);
+
+    void run();
+    void run_once(int timeout_ms);
+    void stop();
+
+private:
+    struct Entry {
+        uint32_t generation;
+        std::shared_ptr<Handler> handler;
+    };
+
+    int epoll_fd;
+    int signal_fd;
+    bool running;
+    uint32_t next_generation;
+    std::unordered_map<int, Entry> entries;
+    std::unordered_map<int, SignalHandler> signal_handlers;
+
+    void on_signal_readable();
+};
+
+#endif // EVENTLOOP_HPP
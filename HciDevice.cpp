@@ -0,0 +1,164 @@
+#include "HciDevice.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+HciDevice::HciDevice(EventLoop& loop, Adapter& adapter)
+    : loop(loop), adapter(adapter), hci_socket(-1), replay(false), recorder(nullptr) {
+}
+
+HciDevice::~HciDevice() {
+    close();
+}
+
+bool HciDevice::open() {
+    if (hci_socket >= 0) return true;
+    if (replay) return true;
+
+    hci_socket = adapter.open_hci();
+    if (hci_socket < 0) {
+        return false;
+    }
+
+    int flags = fcntl(hci_socket, F_GETFL, 0);
+    if (flags >= 0) fcntl(hci_socket, F_SETFL, flags | O_NONBLOCK);
+
+    if (!loop.add(hci_socket, EPOLLIN, [this](uint32_t events) { on_readable(events); })) {
+        close();
+        return false;
+    }
+
+    // Copy: a listener may unregister itself from on_hci_open()
+    std::vector<Listener*> current = listeners;
+    for (auto* listener : current) listener->on_hci_open();
+    return true;
+}
+
+void HciDevice::close() {
+    if (hci_socket < 0) return;
+    loop.remove(hci_socket);
+    adapter.close_hci();
+    hci_socket = -1;
+}
+
+bool HciDevice::is_open() const {
+    return replay || hci_socket >= 0;
+}
+
+int HciDevice::get_dev_id() const {
+    return adapter.get_dev_id();
+}
+
+Adapter& HciDevice::get_adapter() {
+    return adapter;
+}
+
+void HciDevice::add_listener(Listener* listener) {
+    listeners.push_back(listener);
+}
+
+void HciDevice::remove_listener(Listener* listener) {
+    listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+}
+
+int HciDevice::send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) {
+    if (replay) return 0;
+    if (hci_socket < 0) return -1;
+
+    if (recorder) {
+        unsigned char pkt[1 + HCI_COMMAND_HDR_SIZE + 255];
+        uint16_t opcode = htobs(cmd_opcode_pack(ogf, ocf));
+        pkt[0] = HCI_COMMAND_PKT;
+        memcpy(pkt + 1, &opcode, sizeof(opcode));
+        pkt[3] = plen;
+        if (plen) memcpy(pkt + 1 + HCI_COMMAND_HDR_SIZE, param, plen);
+        recorder->write(pkt, 1 + HCI_COMMAND_HDR_SIZE + plen, false, wall_time_us());
+    }
+    return adapter.send_cmd(ogf, ocf, plen, param);
+}
+
+int HciDevice::get_conn_handle(const bdaddr_t& addr) {
+    if (replay) {
+        auto it = known_handles.find(addr);
+        return it != known_handles.end() ? it->second : -1;
+    }
+    if (hci_socket < 0) return -1;
+
+    int handle = adapter.get_conn_handle(addr);
+    if (handle >= 0 && recorder) record_conn_complete(addr, handle);
+    return handle;
+}
+
+void HciDevice::record_conn_complete(const bdaddr_t& addr, int handle) {
+    // A link set up before recording started never produced a Connection
+    // Complete in the trace. Synthesize one so replay can map the handle.
+    unsigned char pkt[1 + HCI_EVENT_HDR_SIZE + EVT_CONN_COMPLETE_SIZE];
+    pkt[0] = HCI_EVENT_PKT;
+    pkt[1] = EVT_CONN_COMPLETE;
+    pkt[2] = EVT_CONN_COMPLETE_SIZE;
+    evt_conn_complete* cc = (evt_conn_complete*)(pkt + 1 + HCI_EVENT_HDR_SIZE);
+    cc->status = 0;
+    cc->handle = htobs((uint16_t)handle);
+    bacpy(&cc->bdaddr, &addr);
+    cc->link_type = ACL_LINK;
+    cc->encr_mode = 0;
+    recorder->write(pkt, sizeof(pkt), true, wall_time_us());
+}
+
+void HciDevice::set_recorder(BtSnoopWriter* writer) {
+    recorder = writer;
+}
+
+void HciDevice::set_replay(bool replay) {
+    this->replay = replay;
+}
+
+bool HciDevice::is_replay() const {
+    return replay;
+}
+
+void HciDevice::inject(const unsigned char* buf, int len) {
+    if (len < 1 + HCI_EVENT_HDR_SIZE || buf[0] != HCI_EVENT_PKT) return;
+    dispatch(buf, len);
+}
+
+void HciDevice::dispatch(const unsigned char* buf, int len) {
+    if (buf[1] == EVT_CONN_COMPLETE && len >= 1 + HCI_EVENT_HDR_SIZE + EVT_CONN_COMPLETE_SIZE) {
+        const evt_conn_complete* cc = (const evt_conn_complete*)(buf + 1 + HCI_EVENT_HDR_SIZE);
+        if (cc->status == 0) known_handles[cc->bdaddr] = btohs(cc->handle);
+    }
+
+    for (size_t i = 0; i < listeners.size(); i++) {
+        listeners[i]->on_hci_event(buf, len);
+    }
+}
+
+void HciDevice::on_readable(uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        Log::error("HCI socket error, closing adapter");
+        close();
+        return;
+    }
+
+    unsigned char buf[HCI_MAX_EVENT_SIZE];
+    while (hci_socket >= 0) {
+        int len = read(hci_socket, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log::errno_error("HCI read");
+                close();
+            }
+            return;
+        }
+        if (len < 1 + HCI_EVENT_HDR_SIZE) continue;
+
+        if (recorder) recorder->write(buf, len, true, wall_time_us());
+        dispatch(buf, len);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef HCIDEVICE_HPP
+#define HCIDEVICE_HPP
+
+#include "Adapter.hpp"
+#include "EventLoop.hpp"
+#include "Bdaddr.hpp"
+#include "BtSnoop.hpp"
+#include <unordered_map>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+// One HCI channel to the adapter, shared by the whole daemon. Commands
+// are sent without waiting; their completions and other events are read
+// once by the event loop and handed to every listener.
+class HciDevice {
+public:
+    class Listener {
+    public:
+        virtual ~Listener() = default;
+        // buf starts at the packet type byte (HCI_EVENT_PKT)
+        virtual void on_hci_event(const unsigned char* buf, int len) = 0;
+        // The socket was (re)opened; re-issue any controller state
+        virtual void on_hci_open() {}
+    };
+
+    HciDevice(EventLoop& loop, Adapter& adapter);
+    ~HciDevice();
+
+    bool open();
+    void close();
+    bool is_open() const;
+    int get_dev_id() const;
+    Adapter& get_adapter();
+
+    void add_listener(Listener* listener);
+    void remove_listener(Listener* listener);
+
+    int send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param);
+    int get_conn_handle(const bdaddr_t& addr);
+
+    // Write every event read and command sent to a btsnoop file
+    void set_recorder(BtSnoopWriter* writer);
+
+    // Replay: no socket; commands are dropped and events arrive via inject()
+    void set_replay(bool replay);
+    bool is_replay() const;
+    void inject(const unsigned char* buf, int len);
+
+private:
+    EventLoop& loop;
+    Adapter& adapter;
+    int hci_socket;
+    bool replay;
+    BtSnoopWriter* recorder;
+    std::vector<Listener*> listeners;
+    // Handles seen in Connection Complete events (replay lookups)
+    std::unordered_map<bdaddr_t, int, BdaddrHash, BdaddrEqual> known_handles;
+
+    void on_readable(uint32_t events);
+    void dispatch(const unsigned char* buf, int len);
+    void record_conn_complete(const bdaddr_t& addr, int handle);
+};
+
+#endif // HCIDEVICE_HPP
@@ -0,0 +1,69 @@
+#include "Histogram.hpp"
+#include <cstdio>
+#include <cstring>
+
+LatencyHistogram::LatencyHistogram() : total(0), sum_us(0) {
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void LatencyHistogram::record_us(uint64_t us) {
+    total++;
+    sum_us += us;
+
+    // OpenMetrics bounds are inclusive (le) and every bound is a whole
+    // number of microseconds, so bucket i holds (lower, upper] and v = us - 1
+    // places it on the half-open [lower, upper) steps computed below
+    uint64_t v = us ? us - 1 : 0;
+    if (v < (1ULL << MIN_SHIFT)) {
+        buckets[0]++;
+        return;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int octave = msb - MIN_SHIFT;
+    if (octave >= OCTAVES) return; // +Inf only
+
+    // Position within the octave, in SUB_BUCKETS steps
+    uint64_t base = 1ULL << msb;
+    int sub = (int)((v - base) * SUB_BUCKETS >> msb);
+    buckets[octave * SUB_BUCKETS + sub]++;
+}
+
+void LatencyHistogram::record_ms(double ms) {
+    record_us(ms > 0 ? (uint64_t)(ms * 1000) : 0);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return total;
+}
+
+double LatencyHistogram::sum_seconds() const {
+    return sum_us / 1e6;
+}
+
+double LatencyHistogram::upper_bound_seconds(int i) {
+    int octave = i / SUB_BUCKETS;
+    int sub = i % SUB_BUCKETS;
+    uint64_t base = 1ULL << (MIN_SHIFT + octave);
+    return (base + (sub + 1) * (base / SUB_BUCKETS)) / 1e6;
+}
+
+void LatencyHistogram::write_openmetrics(std::string& out, const std::string& name, const std::string& labels) const {
+    char value[64];
+    std::string bucket = name + "_bucket{" + labels + (labels.empty() ? "" : ",") + "le=\"";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        cumulative += buckets[i];
+        snprintf(value, sizeof(value), "%.12g\"} %llu\n", upper_bound_seconds(i), (unsigned long long)cumulative);
+        out += bucket;
+        out += value;
+    }
+    snprintf(value, sizeof(value), "+Inf\"} %llu\n", (unsigned long long)total);
+    out += bucket;
+    out += value;
+
+    std::string suffix = labels.empty() ? std::string(" ") : "{" + labels + "} ";
+    snprintf(value, sizeof(value), "%llu\n", (unsigned long long)total);
+    out += name + "_count" + suffix + value;
+    snprintf(value, sizeof(value), "%.6f\n", sum_seconds());
+    out += name + "_sum" + suffix + value;
+}
@@ -0,0 +1,44 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstdint>
+#include <string>
+
+// Latency histogram with log-linear buckets in the HdrHistogram style:
+// every power of two from 64 us to ~67 s is split into SUB_BUCKETS equal
+// steps, so past the first bucket (0-72 us) a value's bucket is never more
+// than 1/SUB_BUCKETS (12.5%) of the value wide. The bucket set is fixed,
+// recording is O(1) and never allocates.
+class LatencyHistogram {
+public:
+    static const int MIN_SHIFT = 6;     // 2^6 us = 64 us
+    static const int OCTAVES = 20;      // up to 2^26 us = 67 s
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKETS = OCTAVES * SUB_BUCKETS;
+    // Bounds stay whole microseconds, which record_us() relies on
+    static_assert(SUB_BUCKETS <= (1 << MIN_SHIFT) && (SUB_BUCKETS & (SUB_BUCKETS - 1)) == 0,
+                  "sub-buckets must split the smallest octave into whole microseconds");
+
+    LatencyHistogram();
+
+    void record_us(uint64_t us);
+    void record_ms(double ms);
+
+    uint64_t count() const;
+    double sum_seconds() const;
+
+    // Upper bound of bucket i in seconds; values past the last bucket only
+    // show up in count() (the +Inf bucket)
+    static double upper_bound_seconds(int i);
+
+    // Appends the _bucket/_count/_sum samples of one OpenMetrics histogram.
+    // `labels` is empty or a comma-separated list without braces.
+    void write_openmetrics(std::string& out, const std::string& name, const std::string& labels) const;
+
+private:
+    uint64_t buckets[BUCKETS];
+    uint64_t total;
+    uint64_t sum_us;
+};
+
+#endif // HISTOGRAM_HPP
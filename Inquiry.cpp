@@ -0,0 +1,156 @@
+#include "Inquiry.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+
+// General inquiry access code
+static const uint8_t GIAC[3] = { 0x33, 0x8b, 0x9e };
+
+// Command Status when the controller will not page another device yet
+static const uint8_t COMMAND_DISALLOWED = 0x0c;
+
+int Inquiry::set_extended_mode(int sock) {
+    for (int mode = 2; mode >= 0; mode--) {
+        write_inquiry_mode_cp cp = { (uint8_t)mode };
+        uint8_t status = 0xff;
+        struct hci_request rq = {};
+        rq.ogf = OGF_HOST_CTL;
+        rq.ocf = OCF_WRITE_INQUIRY_MODE;
+        rq.cparam = &cp;
+        rq.clen = WRITE_INQUIRY_MODE_CP_SIZE;
+        rq.rparam = &status;
+        rq.rlen = 1;
+        // No answer at all will not improve with a lesser mode
+        if (hci_send_req(sock, &rq, 1000) < 0) return -1;
+        if (status == 0) return mode;
+    }
+    return -1;
+}
+
+bool Inquiry::start(int sock, int duration_sec) {
+    inquiry_cp cp = {};
+    memcpy(cp.lap, GIAC, sizeof(GIAC));
+    cp.length = (uint8_t)std::max(1, std::min(0x30, (duration_sec * 100 + 127) / 128));
+    cp.num_rsp = 0; // unlimited
+    return hci_send_cmd(sock, OGF_LINK_CTL, OCF_INQUIRY, INQUIRY_CP_SIZE, &cp) >= 0;
+}
+
+void Inquiry::cancel(int sock) {
+    hci_send_cmd(sock, OGF_LINK_CTL, OCF_INQUIRY_CANCEL, 0, NULL);
+}
+
+void Inquiry::add_events(struct hci_filter& filter) {
+    hci_filter_set_event(EVT_INQUIRY_RESULT, &filter);
+    hci_filter_set_event(EVT_INQUIRY_RESULT_WITH_RSSI, &filter);
+    hci_filter_set_event(EVT_EXTENDED_INQUIRY_RESULT, &filter);
+    hci_filter_set_event(EVT_INQUIRY_COMPLETE, &filter);
+}
+
+int Inquiry::resolve_names(int sock, std::vector<NameRequest>& requests, int timeout_ms, int max_pending,
+                           const std::function<void(const NameRequest&)>& on_name, const std::atomic<bool>* stop) {
+    // Our events only, restoring the caller's filter after, as hci_send_req() does
+    struct hci_filter saved;
+    socklen_t saved_len = sizeof(saved);
+    bool restore = getsockopt(sock, SOL_HCI, HCI_FILTER, &saved, &saved_len) == 0;
+    struct hci_filter nf;
+    hci_filter_clear(&nf);
+    hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+    hci_filter_set_event(EVT_CMD_STATUS, &nf);
+    hci_filter_set_event(EVT_REMOTE_NAME_REQ_COMPLETE, &nf);
+    setsockopt(sock, SOL_HCI, HCI_FILTER, &nf, sizeof(nf));
+
+    // Command Status carries no address, but commands are taken in order,
+    // so statuses match the oldest unconfirmed request
+    const uint16_t opcode = htobs(cmd_opcode_pack(OGF_LINK_CTL, OCF_REMOTE_NAME_REQ));
+    std::deque<size_t> queue;
+    std::deque<size_t> unconfirmed;
+    std::vector<size_t> paging;
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (!requests[i].done) queue.push_back(i);
+    }
+    max_pending = std::max(1, max_pending);
+    int resolved = 0;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned char buf[HCI_MAX_EVENT_SIZE];
+    while (true) {
+        while (!queue.empty() && (int)(unconfirmed.size() + paging.size()) < max_pending) {
+            size_t i = queue.front();
+            queue.pop_front();
+            NameRequest& r = requests[i];
+            remote_name_req_cp cp = {};
+            bacpy(&cp.bdaddr, &r.addr);
+            cp.pscan_rep_mode = r.pscan_rep_mode;
+            cp.clock_offset = htobs(r.clock_offset ? (r.clock_offset | 0x8000) : 0); // bit 15: offset valid
+            if (hci_send_cmd(sock, OGF_LINK_CTL, OCF_REMOTE_NAME_REQ, REMOTE_NAME_REQ_CP_SIZE, &cp) < 0) {
+                r.done = true;
+                continue;
+            }
+            unconfirmed.push_back(i);
+        }
+        if (unconfirmed.empty() && paging.empty()) break;
+        if (stop && *stop) break;
+
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) break;
+        struct pollfd p = { sock, POLLIN, 0 };
+        int n = poll(&p, 1, stop ? std::min(left, STOP_POLL_MS) : left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) continue;
+        if (n < 0) break;
+        ssize_t len = read(sock, buf, sizeof(buf));
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (len <= 0) break;
+
+        const size_t off = 1 + HCI_EVENT_HDR_SIZE;
+        if ((size_t)len < off || buf[0] != HCI_EVENT_PKT) continue;
+        if (buf[1] == EVT_CMD_STATUS && (size_t)len >= off + EVT_CMD_STATUS_SIZE) {
+            const evt_cmd_status* status = (const evt_cmd_status*)(buf + off);
+            if (status->opcode != opcode || unconfirmed.empty()) continue;
+            size_t i = unconfirmed.front();
+            unconfirmed.pop_front();
+            if (status->status == 0) {
+                paging.push_back(i);
+            } else if (status->status == COMMAND_DISALLOWED && !paging.empty()) {
+                // Fewer pages at once than asked; retry as one finishes
+                max_pending = std::max(1, (int)(paging.size() + unconfirmed.size()));
+                queue.push_front(i);
+            } else {
+                requests[i].done = true;
+            }
+        } else if (buf[1] == EVT_REMOTE_NAME_REQ_COMPLETE && (size_t)len >= off + 1 + sizeof(bdaddr_t)) {
+            const evt_remote_name_req_complete* done = (const evt_remote_name_req_complete*)(buf + off);
+            auto it = std::find_if(paging.begin(), paging.end(), [&](size_t i) {
+                return bacmp(&requests[i].addr, &done->bdaddr) == 0;
+            });
+            if (it == paging.end()) continue; // someone else's request
+            NameRequest& r = requests[*it];
+            paging.erase(it);
+            r.done = true;
+            if (done->status != 0) continue;
+            size_t max = std::min(sizeof(done->name), (size_t)len - off - 1 - sizeof(bdaddr_t));
+            r.name.assign((const char*)done->name, strnlen((const char*)done->name, max));
+            if (r.name.empty()) continue;
+            resolved++;
+            if (on_name) on_name(r);
+        }
+    }
+
+    // Out of time or stopped; stop paging for the rest. Requests never
+    // sent stay undone.
+    paging.insert(paging.end(), unconfirmed.begin(), unconfirmed.end());
+    for (size_t i : paging) {
+        remote_name_req_cancel_cp cp;
+        bacpy(&cp.bdaddr, &requests[i].addr);
+        hci_send_cmd(sock, OGF_LINK_CTL, OCF_REMOTE_NAME_REQ_CANCEL, REMOTE_NAME_REQ_CANCEL_CP_SIZE, &cp);
+        requests[i].done = true;
+    }
+
+    if (restore) setsockopt(sock, SOL_HCI, HCI_FILTER, &saved, sizeof(saved));
+    return resolved;
+}
@@ -0,0 +1,54 @@
+#ifndef INQUIRY_HPP
+#define INQUIRY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/hci_lib.h>
+
+// Classic discovery on a raw HCI socket without the blocking library
+// calls. The inquiry is started with a plain command and its results are
+// read as events (see InquiryResultParser), in Extended Inquiry Result
+// mode where the controller has it, so most devices arrive named.
+// Names still missing are resolved with Remote Name Requests sent as
+// plain commands too, several in flight, each matched to its completion
+// event by address; a device that has gone away costs one page timeout
+// alongside the others rather than before them.
+class Inquiry {
+public:
+    struct NameRequest {
+        bdaddr_t addr = {};
+        uint8_t pscan_rep_mode = 0x02;   // R2 unless the inquiry said otherwise
+        uint16_t clock_offset = 0;       // from the inquiry result, speeds up paging
+        std::string name;                // set when resolved
+        bool done = false;               // resolved, refused or cancelled
+    };
+
+    // Extended, else with RSSI, else standard results; the mode now set
+    // (2, 1 or 0), or -1 when even that could not be confirmed
+    static int set_extended_mode(int sock);
+
+    // General inquiry of about duration_sec (whole 1.28 s units, at most
+    // 0x30); ends with EVT_INQUIRY_COMPLETE unless cancelled
+    static bool start(int sock, int duration_sec);
+    static void cancel(int sock);
+
+    // The inquiry's events, for the caller's socket filter
+    static void add_events(struct hci_filter& filter);
+
+    // Resolves every request not yet done, at most max_pending at once,
+    // until all complete, timeout_ms passes or *stop is set (checked every
+    // STOP_POLL_MS); the rest are cancelled. on_name runs for each name as
+    // it arrives. Returns names resolved.
+    static int resolve_names(int sock, std::vector<NameRequest>& requests, int timeout_ms, int max_pending = 4,
+                             const std::function<void(const NameRequest&)>& on_name = nullptr,
+                             const std::atomic<bool>* stop = nullptr);
+
+    static constexpr int STOP_POLL_MS = 100;
+};
+
+#endif // INQUIRY_HPP
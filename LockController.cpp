@@ -0,0 +1,90 @@
+#include "LockController.hpp"
+#include "Log.hpp"
+
+LockController::LockController(const Config& config)
+    : config(config), state(GONE), duration_count(0), last_rssi(-255.0) {
+}
+
+LockController::Action LockController::update(double best_avg_rssi, double p_departed) {
+    last_rssi = best_avg_rssi;
+
+    if (state == ACTIVE && config.mode == CONFIDENCE) {
+        if (p_departed >= config.lock_confidence) {
+            state = GONE;
+            duration_count = 0;
+            return LOCK;
+        }
+    } else if (state == ACTIVE) {
+        // Check if we should lock
+        if (best_avg_rssi <= config.lock_threshold) {
+            duration_count++;
+            if (duration_count >= config.lock_duration) {
+                state = GONE;
+                duration_count = 0;
+                return LOCK;
+            }
+        } else {
+            duration_count = 0; // Reset if any signal is good
+        }
+    } else {
+        // Check if we should unlock
+        if (best_avg_rssi >= config.unlock_threshold && best_avg_rssi != -255.0) {
+            duration_count++;
+            if (duration_count >= config.unlock_duration) {
+                state = ACTIVE;
+                duration_count = 0;
+                return UNLOCK;
+            }
+        } else {
+            duration_count = 0;
+        }
+    }
+    return NONE;
+}
+
+void LockController::sync(bool desktop_locked) {
+    State expected_state = desktop_locked ? GONE : ACTIVE;
+    if (state == expected_state) return;
+
+    Log::info("[ SYSTEM ] Desktop lock state mismatch detected. Desktop is %s, internal state was %s. Syncing...",
+              desktop_locked ? "LOCKED" : "UNLOCKED", state == ACTIVE ? "ACTIVE" : "GONE");
+
+    // Smart duration_count handling based on RSSI and transition direction
+    if (state == ACTIVE && expected_state == GONE) {
+        // Desktop locked externally while we thought it was unlocked
+        // If RSSI is good (above unlock threshold), start unlock counter at 1
+        if (last_rssi >= config.unlock_threshold && last_rssi != -255.0) {
+            duration_count = 1;
+            Log::info("[ SYSTEM ] RSSI is good (%g), starting unlock counter at 1", last_rssi);
+        } else {
+            duration_count = 0;
+        }
+    } else {
+        // Any other transition: reset to 0
+        duration_count = 0;
+    }
+
+    state = expected_state;
+}
+
+void LockController::force(State state) {
+    this->state = state;
+    duration_count = 0;
+}
+
+void LockController::set_config(const Config& config) {
+    this->config = config;
+    duration_count = 0;
+}
+
+LockController::State LockController::get_state() const {
+    return state;
+}
+
+int LockController::get_duration_count() const {
+    return duration_count;
+}
+
+int LockController::required_duration() const {
+    return state == ACTIVE ? config.lock_duration : config.unlock_duration;
+}
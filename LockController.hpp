@@ -0,0 +1,50 @@
+#ifndef LOCKCONTROLLER_HPP
+#define LOCKCONTROLLER_HPP
+
+// The lock/unlock decision: the best averaged RSSI must stay past a
+// threshold for a number of consecutive ticks before the state flips.
+// In CONFIDENCE mode the lock side instead fires as soon as the
+// estimators agree the devices have left with the given probability.
+class LockController {
+public:
+    enum State { GONE, ACTIVE };
+    enum Action { NONE, LOCK, UNLOCK };
+    enum Mode { COUNT, CONFIDENCE };
+
+    struct Config {
+        int lock_threshold = -7;    // dBm at or below which the device counts as away
+        int unlock_threshold = -4;  // dBm at or above which it counts as present
+        int lock_duration = 6;      // ticks
+        int unlock_duration = 1;
+        Mode mode = COUNT;
+        double lock_confidence = 0.95; // P(departed) that locks in CONFIDENCE mode
+    };
+
+    explicit LockController(const Config& config);
+
+    // Once per tick with the best average over all monitors (-255 = nothing
+    // heard) and, in CONFIDENCE mode, the probability that every device is
+    // past the lock threshold
+    Action update(double best_avg_rssi, double p_departed = 0);
+
+    // The desktop was locked or unlocked behind our back
+    void sync(bool desktop_locked);
+
+    // Switch state on request, with the consecutive-tick count restarted
+    void force(State state);
+
+    // New thresholds/durations take effect on the next update
+    void set_config(const Config& config);
+
+    State get_state() const;
+    int get_duration_count() const;
+    int required_duration() const;
+
+private:
+    Config config;
+    State state;
+    int duration_count;
+    double last_rssi;
+};
+
+#endif // LOCKCONTROLLER_HPP
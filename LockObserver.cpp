@@ -0,0 +1,213 @@
+#include "LockObserver.hpp"
+#include "Log.hpp"
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+LockObserver::LockObserver(EventLoop& loop) : loop(loop), active(nullptr), known(false), locked(false) {
+}
+
+LockObserver::~LockObserver() {
+    stop();
+}
+
+void LockObserver::add_backend(std::unique_ptr<Backend> backend) {
+    backends.push_back(std::move(backend));
+}
+
+bool LockObserver::start(const std::string& session_id, Callback cb) {
+    on_change = std::move(cb);
+
+    // Every report is forwarded, not just changes, so a polling backend
+    // can still pull a drifted internal state back into line
+    auto report = [this](bool now_locked) {
+        known = true;
+        locked = now_locked;
+        if (on_change) on_change(locked);
+    };
+
+    for (auto& backend : backends) {
+        if (backend->start(loop, session_id, report)) {
+            active = backend.get();
+            Log::info("[ SYSTEM ] Lock state observer: %s", active->name());
+            return true;
+        }
+    }
+    return false;
+}
+
+void LockObserver::stop() {
+    if (active) active->stop();
+    active = nullptr;
+}
+
+bool LockObserver::is_locked() const {
+    return locked;
+}
+
+const char* LockObserver::backend_name() const {
+    return active ? active->name() : "none";
+}
+
+// --- logind over D-Bus ---
+
+static const char* LOGIND_SERVICE = "org.freedesktop.login1";
+static const char* LOGIND_SESSION_IFACE = "org.freedesktop.login1.Session";
+
+LogindDbusBackend::LogindDbusBackend(const std::string& bus_address)
+    : bus_address(bus_address), loop(nullptr), bus(nullptr), slot(nullptr), bus_fd(-1) {
+}
+
+LogindDbusBackend::~LogindDbusBackend() {
+    stop();
+}
+
+const char* LogindDbusBackend::name() const {
+    return "logind D-Bus";
+}
+
+bool LogindDbusBackend::start(EventLoop& loop, const std::string& session_id, LockObserver::Callback cb) {
+    this->loop = &loop;
+    this->cb = cb;
+
+    int r;
+    if (bus_address.empty()) {
+        r = sd_bus_open_system(&bus);
+    } else {
+        r = sd_bus_new(&bus);
+        if (r >= 0) r = sd_bus_set_address(bus, bus_address.c_str());
+        if (r >= 0) r = sd_bus_set_bus_client(bus, 1);
+        if (r >= 0) r = sd_bus_start(bus);
+    }
+    if (r < 0) {
+        stop();
+        return false;
+    }
+
+    char* path = nullptr;
+    if (sd_bus_path_encode("/org/freedesktop/login1/session", session_id.c_str(), &path) < 0) {
+        stop();
+        return false;
+    }
+
+    // Subscribe before reading the initial value so no change is lost in between
+    r = sd_bus_match_signal(bus, &slot, LOGIND_SERVICE, path, "org.freedesktop.DBus.Properties",
+                            "PropertiesChanged", on_properties_changed, this);
+
+    int hint = 0;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    if (r >= 0) {
+        r = sd_bus_get_property_trivial(bus, LOGIND_SERVICE, path, LOGIND_SESSION_IFACE,
+                                        "LockedHint", &error, 'b', &hint);
+    }
+    sd_bus_error_free(&error);
+    free(path);
+    if (r < 0) {
+        stop();
+        return false;
+    }
+
+    // Only signal delivery goes through the loop; the one method call
+    // above is the only thing that ever waits on the bus
+    bus_fd = sd_bus_get_fd(bus);
+    if (bus_fd < 0 || !loop.add(bus_fd, (uint32_t)sd_bus_get_events(bus), [this](uint32_t) { process(); })) {
+        stop();
+        return false;
+    }
+
+    cb(hint != 0);
+    // A change announced right after the reply may have been read along
+    // with it; it waits in sd-bus's queue, where the fd will not wake us
+    process();
+    return true;
+}
+
+void LogindDbusBackend::stop() {
+    if (loop && bus_fd >= 0) loop->remove(bus_fd);
+    bus_fd = -1;
+    if (slot) slot = sd_bus_slot_unref(slot);
+    if (bus) bus = sd_bus_flush_close_unref(bus);
+}
+
+void LogindDbusBackend::process() {
+    int r;
+    while ((r = sd_bus_process(bus, nullptr)) > 0) {
+    }
+    if (r < 0) {
+        Log::warn("Warning: D-Bus connection lost: %s", strerror(-r));
+        stop();
+        return;
+    }
+    loop->modify(bus_fd, (uint32_t)sd_bus_get_events(bus));
+}
+
+int LogindDbusBackend::on_properties_changed(sd_bus_message* m, void* userdata, sd_bus_error*) {
+    LogindDbusBackend* self = (LogindDbusBackend*)userdata;
+
+    const char* iface = nullptr;
+    if (sd_bus_message_read(m, "s", &iface) < 0 || strcmp(iface, LOGIND_SESSION_IFACE) != 0) return 0;
+
+    if (sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}") < 0) return 0;
+    while (sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv") > 0) {
+        const char* prop = nullptr;
+        if (sd_bus_message_read(m, "s", &prop) < 0) return 0;
+
+        if (strcmp(prop, "LockedHint") == 0) {
+            int hint = 0;
+            if (sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, "b") < 0) return 0;
+            if (sd_bus_message_read(m, "b", &hint) < 0) return 0;
+            sd_bus_message_exit_container(m);
+            self->cb(hint != 0);
+        } else {
+            sd_bus_message_skip(m, "v");
+        }
+        sd_bus_message_exit_container(m);
+    }
+    return 0;
+}
+
+// --- loginctl polling fallback ---
+
+LoginctlPollBackend::LoginctlPollBackend(int interval_s) : interval_s(interval_s), loop(nullptr), timer(-1) {
+}
+
+LoginctlPollBackend::~LoginctlPollBackend() {
+    stop();
+}
+
+const char* LoginctlPollBackend::name() const {
+    return "loginctl polling";
+}
+
+bool LoginctlPollBackend::start(EventLoop& loop, const std::string& session_id, LockObserver::Callback cb) {
+    this->loop = &loop;
+    this->session_id = session_id;
+    this->cb = cb;
+
+    timer = loop.add_timer(interval_s * 1000, interval_s * 1000, [this](uint64_t) { poll(); });
+    if (timer < 0) return false;
+    poll();
+    return true;
+}
+
+void LoginctlPollBackend::stop() {
+    if (timer < 0) return;
+    loop->remove_timer(timer);
+    timer = -1;
+}
+
+void LoginctlPollBackend::poll() {
+    std::string cmd = "loginctl show-session " + session_id + " -p LockedHint";
+    std::array<char, 128> buffer;
+    std::string result;
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if (!pipe) return;
+    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
+        result += buffer.data();
+    }
+    pclose(pipe);
+
+    cb(result.find("LockedHint=yes") != std::string::npos);
+}
@@ -0,0 +1,91 @@
+#ifndef LOCKOBSERVER_HPP
+#define LOCKOBSERVER_HPP
+
+#include "EventLoop.hpp"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <systemd/sd-bus.h>
+
+// Tracks the session's LockedHint and reports changes as they happen.
+// Backends are tried in the order added; the first that starts wins.
+class LockObserver {
+public:
+    using Callback = std::function<void(bool locked)>;
+
+    class Backend {
+    public:
+        virtual ~Backend() = default;
+        virtual const char* name() const = 0;
+        // Reports the current state through cb before returning true;
+        // false means the backend is unavailable on this system
+        virtual bool start(EventLoop& loop, const std::string& session_id, Callback cb) = 0;
+        virtual void stop() = 0;
+    };
+
+    explicit LockObserver(EventLoop& loop);
+    ~LockObserver();
+
+    void add_backend(std::unique_ptr<Backend> backend);
+    bool start(const std::string& session_id, Callback on_change);
+    void stop();
+
+    bool is_locked() const;
+    const char* backend_name() const;
+
+private:
+    EventLoop& loop;
+    std::vector<std::unique_ptr<Backend>> backends;
+    Backend* active;
+    bool known;
+    bool locked;
+    Callback on_change;
+};
+
+// org.freedesktop.login1 PropertiesChanged on the session object.
+// An empty bus_address uses the system bus (which itself honours
+// DBUS_SYSTEM_BUS_ADDRESS), so a private dbus-daemon can stand in for logind;
+// lock_harness.cpp does exactly that.
+class LogindDbusBackend : public LockObserver::Backend {
+public:
+    explicit LogindDbusBackend(const std::string& bus_address = "");
+    ~LogindDbusBackend();
+
+    const char* name() const override;
+    bool start(EventLoop& loop, const std::string& session_id, LockObserver::Callback cb) override;
+    void stop() override;
+
+private:
+    std::string bus_address;
+    EventLoop* loop;
+    sd_bus* bus;
+    sd_bus_slot* slot;
+    int bus_fd;
+    LockObserver::Callback cb;
+
+    void process();
+    static int on_properties_changed(sd_bus_message* m, void* userdata, sd_bus_error* ret_error);
+};
+
+// Last resort: loginctl show-session every interval_s seconds.
+class LoginctlPollBackend : public LockObserver::Backend {
+public:
+    explicit LoginctlPollBackend(int interval_s = 30);
+    ~LoginctlPollBackend();
+
+    const char* name() const override;
+    bool start(EventLoop& loop, const std::string& session_id, LockObserver::Callback cb) override;
+    void stop() override;
+
+private:
+    int interval_s;
+    std::string session_id;
+    EventLoop* loop;
+    int timer;
+    LockObserver::Callback cb;
+
+    void poll();
+};
+
+#endif // LOCKOBSERVER_HPP
@@ -0,0 +1,605 @@
+#include "Log.hpp"
+#include "Clock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Records are 8-byte aligned in the ring and in binary files:
+// RecordHeader, then for MESSAGE one or more chunks of
+//   u64 format address | u8 argument count | per argument a tag and value
+// with tags 'i' (i64), 'u' (u64), 'd' (double) and 's' (u16 length, bytes).
+// A binary file starts with MAGIC and defines each format address with a
+// FORMAT record (u64 address | u32 length | bytes) before its first use.
+struct RecordHeader {
+    uint32_t size; // including this header and alignment padding
+    uint8_t type;
+    uint8_t level;
+    uint16_t reserved;
+    uint64_t time_us; // wall_time_us()
+};
+
+enum RecordType { PAD = 0, MESSAGE = 1, FORMAT = 2 };
+
+static const char MAGIC[8] = { 'B', 'P', 'L', 'O', 'G', 0, 0, 1 };
+static const size_t RING_SIZE = 256 * 1024; // power of two
+static const size_t RING_MASK = RING_SIZE - 1;
+
+Log::Level Log::threshold = Log::INFO;
+
+static bool blocking = false;
+static bool running = false;
+static bool binary = false;
+static int binary_fd = -1;
+
+alignas(8) static unsigned char ring[RING_SIZE];
+static std::atomic<size_t> ring_head(0); // written by the producer only
+static std::atomic<size_t> ring_tail(0); // written by the writer only
+static std::atomic<uint64_t> dropped(0);
+
+static std::thread* writer = nullptr;
+static std::mutex writer_mutex;
+static std::condition_variable writer_cv;
+static bool wake_pending = false;
+static bool stopping = false;
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+// --- Formatting (writer thread, synchronous mode and decode) ---
+
+struct Arg {
+    char tag;
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char* s;
+    size_t len;
+};
+
+static bool read_arg(const unsigned char*& p, const unsigned char* end, Arg& arg) {
+    if (p >= end) return false;
+    arg.tag = (char)*p++;
+    switch (arg.tag) {
+        case 'i':
+            if (end - p < 8) return false;
+            memcpy(&arg.i, p, 8);
+            arg.u = (uint64_t)arg.i;
+            arg.d = (double)arg.i;
+            p += 8;
+            return true;
+        case 'u':
+            if (end - p < 8) return false;
+            memcpy(&arg.u, p, 8);
+            arg.i = (int64_t)arg.u;
+            arg.d = (double)arg.u;
+            p += 8;
+            return true;
+        case 'd':
+            if (end - p < 8) return false;
+            memcpy(&arg.d, p, 8);
+            arg.i = (int64_t)arg.d;
+            arg.u = (uint64_t)arg.i;
+            p += 8;
+            return true;
+        case 's': {
+            uint16_t n;
+            if (end - p < 2) return false;
+            memcpy(&n, p, 2);
+            p += 2;
+            if (end - p < n) return false;
+            arg.s = (const char*)p;
+            arg.len = n;
+            arg.i = 0;
+            arg.u = 0;
+            arg.d = 0;
+            p += n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void appendf(std::string& out, const char* spec, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, spec);
+    int n = vsnprintf(buf, sizeof(buf), spec, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string big(n + 1, '\0');
+    va_start(ap, spec);
+    vsnprintf(&big[0], big.size(), spec, ap);
+    va_end(ap);
+    out.append(big, 0, n);
+}
+
+// Runs fmt against the recorded arguments. Length modifiers in the format
+// are ignored: integers were widened to 64 bits when they were recorded.
+static void format_chunk(std::string& out, const char* fmt, int nargs, const unsigned char*& p, const unsigned char* end) {
+    auto next = [&](Arg& arg) {
+        if (nargs <= 0 || !read_arg(p, end, arg)) return false;
+        nargs--;
+        return true;
+    };
+
+    while (*fmt) {
+        if (*fmt != '%') {
+            const char* lit = fmt;
+            while (*fmt && *fmt != '%') fmt++;
+            out.append(lit, fmt - lit);
+            continue;
+        }
+        if (fmt[1] == '%') {
+            out += '%';
+            fmt += 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion. The precision is
+        // kept apart from spec: %s combines it with the argument's length.
+        std::string spec = "%";
+        fmt++;
+        while (*fmt && strchr("-+ #0", *fmt)) spec += *fmt++;
+        bool bad = false;
+        int precision = -1;
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*fmt != '.') break;
+                fmt++;
+            }
+            std::string digits;
+            if (*fmt == '*') {
+                Arg star;
+                if (next(star)) digits = std::to_string(star.i);
+                else bad = true;
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') digits += *fmt++;
+            }
+            // A negative precision counts as none, as in printf
+            if (part == 0) spec += digits;
+            else precision = std::max(-1, atoi(digits.c_str()));
+        }
+        while (*fmt && strchr("hlLqjzt", *fmt)) fmt++;
+        char conv = *fmt;
+        if (!conv) break;
+        fmt++;
+
+        Arg arg;
+        if (bad || !next(arg)) {
+            out += "<?>";
+            continue;
+        }
+        if (precision >= 0 && conv != 's') spec += "." + std::to_string(precision);
+        switch (conv) {
+            case 'd': case 'i':
+                appendf(out, (spec + "lld").c_str(), (long long)arg.i);
+                break;
+            case 'u': case 'x': case 'X': case 'o':
+                appendf(out, (spec + "ll" + conv).c_str(), (unsigned long long)arg.u);
+                break;
+            case 'c':
+                appendf(out, (spec + "c").c_str(), (int)arg.i);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                appendf(out, (spec + conv).c_str(), arg.d);
+                break;
+            case 's':
+                if (arg.tag == 's') {
+                    // Stored strings are not NUL-terminated; the length always bounds them
+                    int len = precision >= 0 ? std::min(precision, (int)arg.len) : (int)arg.len;
+                    appendf(out, (spec + ".*s").c_str(), len, arg.s);
+                } else {
+                    appendf(out, "%lld", (long long)arg.i);
+                }
+                break;
+            default:
+                out += "<?>";
+                break;
+        }
+    }
+    // Skip arguments the format did not use
+    Arg unused;
+    while (next(unused)) {
+    }
+}
+
+// formats: nullptr formats the live process's own literals
+static void format_message(std::string& out, const unsigned char* p, const unsigned char* end,
+                           const std::unordered_map<uint64_t, std::string>* formats) {
+    while (end - p >= 9) {
+        uint64_t ptr;
+        memcpy(&ptr, p, 8);
+        int nargs = p[8];
+        p += 9;
+        if (ptr == 0) break; // alignment padding
+        const char* fmt = "<unknown format>";
+        if (!formats) {
+            fmt = (const char*)(uintptr_t)ptr;
+        } else {
+            auto it = formats->find(ptr);
+            if (it != formats->end()) fmt = it->second.c_str();
+        }
+        format_chunk(out, fmt, nargs, p, end);
+    }
+    if (out.empty() || out.back() != '\n') out += '\n';
+}
+
+static void write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t w = write(fd, data.data() + done, data.size() - done);
+        if (w > 0) {
+            done += w;
+            continue;
+        }
+        if (w < 0 && errno == EINTR) continue;
+        return;
+    }
+}
+
+static int text_fd(int level) {
+    return level <= Log::WARN ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+// --- Writer thread ---
+
+// Output for one batch, kept in order across stdout and stderr
+struct Batch {
+    int fd = -1;
+    std::string text;
+    std::string binary;
+    std::unordered_map<uint64_t, bool> defined;
+
+    void add_text(int to, const std::string& line) {
+        if (to != fd) flush_text();
+        fd = to;
+        text += line;
+    }
+    void flush_text() {
+        if (fd >= 0 && !text.empty()) write_all(fd, text);
+        text.clear();
+    }
+    void flush() {
+        flush_text();
+        if (binary_fd >= 0 && !binary.empty()) write_all(binary_fd, binary);
+        binary.clear();
+    }
+};
+
+static void define_formats(Batch& batch, const unsigned char* p, const unsigned char* end) {
+    while (end - p >= 9) {
+        uint64_t ptr;
+        memcpy(&ptr, p, 8);
+        int nargs = p[8];
+        p += 9;
+        if (ptr == 0) break;
+        if (!batch.defined[ptr]) {
+            batch.defined[ptr] = true;
+            const char* fmt = (const char*)(uintptr_t)ptr;
+            uint32_t len = (uint32_t)strlen(fmt);
+            RecordHeader h = {};
+            h.size = (uint32_t)align8(sizeof(h) + 12 + len);
+            h.type = FORMAT;
+            std::string rec((const char*)&h, sizeof(h));
+            rec.append((const char*)&ptr, 8);
+            rec.append((const char*)&len, 4);
+            rec.append(fmt, len);
+            rec.resize(h.size, '\0');
+            batch.binary += rec;
+        }
+        Arg arg;
+        for (int i = 0; i < nargs && read_arg(p, end, arg); i++) {
+        }
+    }
+}
+
+static void emit(Batch& batch, const RecordHeader& h, const unsigned char* payload, size_t len) {
+    if (binary) {
+        define_formats(batch, payload, payload + len);
+        batch.binary.append((const char*)&h, sizeof(h));
+        batch.binary.append((const char*)payload, h.size - sizeof(h));
+        if (h.level > Log::WARN) return;
+    }
+    std::string line;
+    format_message(line, payload, payload + len, nullptr);
+    batch.add_text(text_fd(h.level), line);
+}
+
+static void drain(Batch& batch) {
+    size_t tail = ring_tail.load(std::memory_order_relaxed);
+    size_t head = ring_head.load(std::memory_order_acquire);
+    while (tail != head) {
+        const unsigned char* at = ring + (tail & RING_MASK);
+        uint32_t size;
+        memcpy(&size, at, sizeof(size));
+        if (at[4] != PAD) {
+            RecordHeader h;
+            memcpy(&h, at, sizeof(h));
+            emit(batch, h, at + sizeof(h), h.size - sizeof(h));
+        }
+        tail += size;
+        ring_tail.store(tail, std::memory_order_release);
+    }
+
+    static uint64_t reported = 0;
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != reported) {
+        unsigned char buf[64];
+        Log::Encoder encoder = { buf, buf + sizeof(buf) };
+        encoder.chunk("Warning: %llu log records dropped, the log writer fell behind", lost - reported);
+        RecordHeader h = {};
+        h.size = (uint32_t)align8(sizeof(h) + (encoder.p - buf));
+        h.type = MESSAGE;
+        h.level = Log::WARN;
+        h.time_us = wall_time_us();
+        memset(encoder.p, 0, buf + sizeof(buf) - encoder.p);
+        emit(batch, h, buf, encoder.p - buf);
+        reported = lost;
+    }
+    batch.flush();
+}
+
+static void writer_main() {
+    Batch batch;
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (true) {
+        writer_cv.wait(lock, [] { return wake_pending || stopping; });
+        wake_pending = false;
+        bool last = stopping;
+        lock.unlock();
+        drain(batch);
+        lock.lock();
+        if (last) break;
+    }
+}
+
+// --- Producer side ---
+
+void Log::Encoder::put_tagged(char tag, const void* value, size_t len) {
+    if (p + 1 + len > end) {
+        // Keep the chunk parseable: an empty string stands in
+        if (p + 3 <= end) {
+            *p++ = 's';
+            *p++ = 0;
+            *p++ = 0;
+        }
+        return;
+    }
+    *p++ = (unsigned char)tag;
+    memcpy(p, value, len);
+    p += len;
+}
+
+void Log::Encoder::put_string(const char* s, size_t len) {
+    size_t room = end - p;
+    if (room < 3) return;
+    if (len > room - 3) len = room - 3;
+    if (len > 0xffff) len = 0xffff;
+    uint16_t n = (uint16_t)len;
+    *p++ = 's';
+    memcpy(p, &n, sizeof(n));
+    p += sizeof(n);
+    memcpy(p, s, n);
+    p += n;
+}
+
+void Log::submit(Level level, const unsigned char* payload, size_t len) {
+    RecordHeader h = {};
+    h.size = (uint32_t)align8(sizeof(h) + len);
+    h.type = MESSAGE;
+    h.level = (uint8_t)level;
+    h.time_us = wall_time_us();
+
+    if (!running) {
+        std::string line;
+        format_message(line, payload, payload + len, nullptr);
+        write_all(text_fd(level), line);
+        return;
+    }
+
+    size_t head = ring_head.load(std::memory_order_relaxed);
+    size_t pos = head & RING_MASK;
+    size_t contiguous = RING_SIZE - pos;
+    size_t need = h.size <= contiguous ? h.size : contiguous + h.size;
+    while (RING_SIZE - (head - ring_tail.load(std::memory_order_acquire)) < need) {
+        if (!blocking) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wake();
+        usleep(200);
+    }
+
+    if (h.size > contiguous) {
+        // Never split a record across the end of the ring
+        uint32_t pad = (uint32_t)contiguous;
+        memcpy(ring + pos, &pad, sizeof(pad));
+        ring[pos + 4] = PAD;
+        head += contiguous;
+        pos = 0;
+    }
+    memcpy(ring + pos, &h, sizeof(h));
+    memcpy(ring + pos + sizeof(h), payload, len);
+    memset(ring + pos + sizeof(h) + len, 0, h.size - sizeof(h) - len);
+    ring_head.store(head + h.size, std::memory_order_release);
+
+    if (level <= WARN || RING_SIZE - (head + h.size - ring_tail.load(std::memory_order_relaxed)) < RING_SIZE / 2) {
+        wake();
+    }
+}
+
+Log::Line::Line(Level level) : level(level), on(Log::enabled(level)) {
+    encoder.p = buf;
+    encoder.end = buf + sizeof(buf);
+}
+
+Log::Line::~Line() {
+    if (on && encoder.p > buf) submit(level, buf, encoder.p - buf);
+}
+
+void Log::errno_error(const char* what) {
+    error("%s: %s", what, strerror(errno));
+}
+
+void Log::set_level(Level level) {
+    threshold = level;
+}
+
+bool Log::parse_level(const std::string& name, Level& level) {
+    static const char* names[] = { "error", "warn", "info", "debug" };
+    for (int i = 0; i < 4; i++) {
+        if (name == names[i]) {
+            level = (Level)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Log::set_blocking(bool enable) {
+    blocking = enable;
+}
+
+bool Log::start(const std::string& binary_path) {
+    if (running) return true;
+
+    if (!binary_path.empty()) {
+        binary_fd = open(binary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (binary_fd < 0) {
+            errno_error(("log " + binary_path).c_str());
+            return false;
+        }
+        write_all(binary_fd, std::string(MAGIC, sizeof(MAGIC)));
+        binary = true;
+    }
+
+    // The loop takes its signals through a signalfd with them blocked;
+    // the writer must never be the thread they get delivered to
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    stopping = false;
+    wake_pending = false;
+    writer = new std::thread(writer_main);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    running = true;
+
+    static bool registered = false;
+    if (!registered) {
+        atexit(stop);
+        registered = true;
+    }
+    return true;
+}
+
+void Log::stop() {
+    if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_cv.notify_one();
+    writer->join();
+    delete writer;
+    writer = nullptr;
+    running = false;
+
+    if (binary_fd >= 0) {
+        close(binary_fd);
+        binary_fd = -1;
+    }
+    binary = false;
+}
+
+void Log::wake() {
+    if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        if (wake_pending) return;
+        wake_pending = true;
+    }
+    writer_cv.notify_one();
+}
+
+bool Log::decode(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        errno_error(("log " + path).c_str());
+        return false;
+    }
+    std::string data;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+
+    if (data.size() < sizeof(MAGIC) || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        error("Error: %s is not a binary BlueProximity log", path);
+        return false;
+    }
+
+    std::unordered_map<uint64_t, std::string> formats;
+    const unsigned char* p = (const unsigned char*)data.data() + sizeof(MAGIC);
+    const unsigned char* end = (const unsigned char*)data.data() + data.size();
+    std::string out;
+    while (end - p >= (ptrdiff_t)sizeof(RecordHeader)) {
+        RecordHeader h;
+        memcpy(&h, p, sizeof(h));
+        if (h.size < sizeof(h) || h.size > (size_t)(end - p)) {
+            error("Error: %s is truncated or corrupt", path);
+            break;
+        }
+        const unsigned char* payload = p + sizeof(h);
+        const unsigned char* payload_end = p + h.size;
+        p = payload_end;
+
+        if (h.type == FORMAT && payload_end - payload >= 12) {
+            uint64_t ptr;
+            uint32_t len;
+            memcpy(&ptr, payload, 8);
+            memcpy(&len, payload + 8, 4);
+            if (len <= (size_t)(payload_end - payload - 12)) formats[ptr] = std::string((const char*)payload + 12, len);
+            continue;
+        }
+        if (h.type != MESSAGE) continue;
+
+        std::string text;
+        format_message(text, payload, payload_end, &formats);
+        time_t secs = (time_t)(h.time_us / 1000000);
+        struct tm tm;
+        localtime_r(&secs, &tm);
+        char stamp[48];
+        size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%03u ", (unsigned)(h.time_us / 1000 % 1000));
+        size_t from = 0;
+        while (from < text.size()) {
+            size_t nl = text.find('\n', from);
+            out += stamp;
+            out.append(text, from, nl - from + 1);
+            from = nl + 1;
+        }
+        if (out.size() > 65536) {
+            write_all(STDOUT_FILENO, out);
+            out.clear();
+        }
+    }
+    write_all(STDOUT_FILENO, out);
+    return true;
+}
@@ -0,0 +1,133 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// Levelled logging through a lock-free single-producer ring buffer.
+//
+// Call sites pass a printf-style format that must be a string literal,
+// plus its arguments. Only the format's address and the raw argument
+// values are copied into the ring. A background thread formats queued
+// records and writes them in batches, so the event loop never formats
+// a line or blocks on stdout or the journal. It is woken once per tick
+// by wake(), immediately for warnings and errors, and whenever the ring
+// is half full.
+//
+// In binary mode the records go to a file unformatted, along with each
+// format string the first time it is used; decode() prints such a file.
+// Warnings and errors are still written to stderr as text.
+//
+// Only the event loop thread may log. Before start() and after stop(),
+// records are formatted and written synchronously, so tools that link
+// the daemon's units need no setup.
+class Log {
+public:
+    enum Level { ERROR, WARN, INFO, DEBUG };
+
+    // Largest record; longer string arguments are cut short
+    static const size_t MAX_RECORD = 4096;
+
+    static void set_level(Level level);
+    static bool parse_level(const std::string& name, Level& level);
+    static bool enabled(Level level) { return level <= threshold; }
+
+    // Wait for space instead of dropping records when the ring is full.
+    // Replay and simulation want every line; the live daemon never waits.
+    static void set_blocking(bool blocking);
+
+    // Start the writer thread; binary_path empty means text on stdout/stderr
+    static bool start(const std::string& binary_path);
+    // Write out everything queued and join the writer
+    static void stop();
+    // Hand what is queued to the writer
+    static void wake();
+
+    // Prints a binary log as text, each line prefixed with its wall-clock time
+    static bool decode(const std::string& path);
+
+    template <typename... Args> static void error(const char* fmt, const Args&... args) { message(ERROR, fmt, args...); }
+    template <typename... Args> static void warn(const char* fmt, const Args&... args) { message(WARN, fmt, args...); }
+    template <typename... Args> static void info(const char* fmt, const Args&... args) { message(INFO, fmt, args...); }
+    template <typename... Args> static void debug(const char* fmt, const Args&... args) { message(DEBUG, fmt, args...); }
+
+    // perror() replacement: "<what>: <strerror(errno)>"
+    static void errno_error(const char* what);
+
+    // Appends a format pointer, an argument count and the tagged arguments
+    struct Encoder {
+        unsigned char* p;
+        unsigned char* end;
+
+        template <typename... Args> void chunk(const char* fmt, const Args&... args) {
+            uint64_t ptr = (uint64_t)(uintptr_t)fmt;
+            if (p + sizeof(ptr) + 1 > end) return;
+            memcpy(p, &ptr, sizeof(ptr));
+            p += sizeof(ptr);
+            *p++ = (unsigned char)sizeof...(args);
+            int expand[] = { 0, (put(args), 0)... };
+            (void)expand;
+        }
+
+        void put_tagged(char tag, const void* value, size_t len);
+        void put_string(const char* s, size_t len);
+
+        void put(const char* s) { s ? put_string(s, strlen(s)) : put_string("(null)", 6); }
+        void put(const std::string& s) { put_string(s.data(), s.size()); }
+        template <typename T> void put(const T& v) {
+            if constexpr (std::is_floating_point<T>::value) {
+                double d = v;
+                put_tagged('d', &d, sizeof(d));
+            } else if constexpr (std::is_array<T>::value || std::is_same<T, char*>::value) {
+                // A mutable char* (strerror(), a buffer) binds here before
+                // the const char* overload; it is still a string
+                put((const char*)v);
+            } else if constexpr (std::is_pointer<T>::value) {
+                uint64_t u = (uint64_t)(uintptr_t)v;
+                put_tagged('u', &u, sizeof(u));
+            } else if constexpr (std::is_enum<T>::value || std::is_signed<T>::value) {
+                int64_t i = (int64_t)v;
+                put_tagged('i', &i, sizeof(i));
+            } else {
+                uint64_t u = (uint64_t)v;
+                put_tagged('u', &u, sizeof(u));
+            }
+        }
+    };
+
+    // One line built from several format/argument chunks, for lines with
+    // optional parts. Submitted when it goes out of scope.
+    class Line {
+    public:
+        explicit Line(Level level);
+        ~Line();
+
+        template <typename... Args> Line& add(const char* fmt, const Args&... args) {
+            if (on) encoder.chunk(fmt, args...);
+            return *this;
+        }
+
+    private:
+        Level level;
+        bool on;
+        unsigned char buf[MAX_RECORD];
+        Encoder encoder;
+    };
+
+private:
+    static Level threshold;
+
+    template <typename... Args> static void message(Level level, const char* fmt, const Args&... args) {
+        if (level > threshold) return;
+        unsigned char buf[MAX_RECORD];
+        Encoder encoder = { buf, buf + sizeof(buf) };
+        encoder.chunk(fmt, args...);
+        submit(level, buf, encoder.p - buf);
+    }
+
+    static void submit(Level level, const unsigned char* payload, size_t len);
+};
+
+#endif // LOG_HPP
@@ -0,0 +1,245 @@
+#include "MetricsServer.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const size_t MAX_CLIENTS = 16;
+static const size_t MAX_REQUEST = 4096;
+
+MetricsServer::MetricsServer(EventLoop& loop, Renderer render)
+    : loop(loop), render(render), listen_fd(-1), unix_dev(0), unix_ino(0) {
+}
+
+MetricsServer::~MetricsServer() {
+    close();
+}
+
+bool MetricsServer::listen(const std::string& address) {
+    close();
+
+    if (address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un sun = {};
+        sun.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(sun.sun_path)) {
+            Log::error("Error: Bad metrics socket path '%s'", path);
+            return false;
+        }
+        memcpy(sun.sun_path, path.c_str(), path.size());
+
+        // A previous run may have left its socket behind; anything else
+        // there is most likely a mistyped path, and not ours to delete
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                Log::error("Error: Metrics socket path %s exists and is not a socket", path);
+                return false;
+            }
+            unlink(path.c_str());
+        }
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            Log::errno_error("metrics socket");
+            return false;
+        }
+        if (bind(listen_fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+            Log::errno_error("metrics bind");
+            close();
+            return false;
+        }
+        chmod(path.c_str(), 0600);
+        unix_path = path;
+        if (lstat(path.c_str(), &st) == 0) {
+            unix_dev = st.st_dev;
+            unix_ino = st.st_ino;
+        }
+    } else {
+        // Loopback only: the metrics name the devices being followed
+        std::string host = "127.0.0.1";
+        std::string port = address;
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos) {
+            host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+        if (host == "localhost") host = "127.0.0.1";
+
+        struct sockaddr_in sin = {};
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((uint16_t)atoi(port.c_str()));
+        if (inet_pton(AF_INET, host.c_str(), &sin.sin_addr) != 1 || (ntohl(sin.sin_addr.s_addr) >> 24) != 127 ||
+            sin.sin_port == 0) {
+            Log::error("Error: Metrics address must be unix:<path> or a loopback [host:]port, got '%s'", address);
+            return false;
+        }
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            Log::errno_error("metrics socket");
+            return false;
+        }
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(listen_fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+            Log::errno_error("metrics bind");
+            close();
+            return false;
+        }
+    }
+
+    if (::listen(listen_fd, 8) < 0 || !loop.add(listen_fd, EPOLLIN, [this](uint32_t) { on_accept(); })) {
+        Log::errno_error("metrics listen");
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MetricsServer::close() {
+    while (!clients.empty()) drop(clients.begin()->first);
+    if (listen_fd >= 0) {
+        loop.remove(listen_fd);
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+    if (!unix_path.empty()) {
+        struct stat st;
+        if (lstat(unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && st.st_dev == unix_dev && st.st_ino == unix_ino) {
+            unlink(unix_path.c_str());
+        }
+        unix_path.clear();
+    }
+}
+
+void MetricsServer::on_accept() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) Log::errno_error("metrics accept");
+            return;
+        }
+        // Scrapers are few; a client that never finishes its request loses its slot
+        if (clients.size() >= MAX_CLIENTS) drop(clients.begin()->first);
+
+        if (!loop.add(fd, EPOLLIN, [this, fd](uint32_t events) { on_client_event(fd, events); })) {
+            ::close(fd);
+            continue;
+        }
+        clients[fd] = Client();
+    }
+}
+
+void MetricsServer::on_client_event(int fd, uint32_t events) {
+    auto it = clients.find(fd);
+    if (it == clients.end()) return;
+    Client& client = it->second;
+
+    if (events & EPOLLOUT) {
+        flush(fd, client);
+        return;
+    }
+    if (events & EPOLLIN) {
+        char buf[1024];
+        while (true) {
+            ssize_t r = read(fd, buf, sizeof(buf));
+            if (r > 0) {
+                client.request.append(buf, r);
+                if (client.request.size() > MAX_REQUEST) {
+                    drop(fd);
+                    return;
+                }
+                continue;
+            }
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (r < 0 && errno == EINTR) continue;
+            drop(fd); // EOF before the request was complete, or an error
+            return;
+        }
+        // Only the end of the headers matters; every path gets the metrics
+        if (client.request.find("\r\n\r\n") != std::string::npos || client.request.find("\n\n") != std::string::npos) {
+            respond(fd, client);
+            return;
+        }
+    }
+    if (events & (EPOLLERR | EPOLLHUP)) drop(fd);
+}
+
+void MetricsServer::respond(int fd, Client& client) {
+    std::string body;
+    render(body);
+
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+             "Content-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", body.size());
+    client.response = header;
+    if (client.request.compare(0, 5, "HEAD ") != 0) client.response += body;
+    flush(fd, client);
+}
+
+void MetricsServer::flush(int fd, Client& client) {
+    while (client.sent < client.response.size()) {
+        ssize_t w = send(fd, client.response.data() + client.sent, client.response.size() - client.sent, MSG_NOSIGNAL);
+        if (w > 0) {
+            client.sent += w;
+            continue;
+        }
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Finish when the socket drains
+            loop.modify(fd, EPOLLOUT);
+            return;
+        }
+        break;
+    }
+    drop(fd);
+}
+
+void MetricsServer::drop(int fd) {
+    loop.remove(fd);
+    ::close(fd);
+    clients.erase(fd);
+}
+
+void MetricsServer::family(std::string& out, const char* name, const char* type, const char* help, const char* unit) {
+    out += "# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+    if (unit) {
+        out += "# UNIT ";
+        out += name;
+        out += " ";
+        out += unit;
+        out += "\n";
+    }
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n";
+}
+
+std::string MetricsServer::escape(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\') out += "\\\\";
+        else if (c == '"') out += "\\\"";
+        else if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out;
+}
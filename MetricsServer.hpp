@@ -0,0 +1,51 @@
+#ifndef METRICSSERVER_HPP
+#define METRICSSERVER_HPP
+
+#include "EventLoop.hpp"
+#include <functional>
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+// Serves the OpenMetrics text exposition over HTTP/1.0 from the event
+// loop, on a Unix socket ("unix:/run/user/1000/blueproximity.metrics") or
+// a loopback TCP port ("9105" or "127.0.0.1:9105"). Every request gets
+// the current metrics, whatever its path; the body is rendered on demand.
+class MetricsServer {
+public:
+    using Renderer = std::function<void(std::string& body)>;
+
+    MetricsServer(EventLoop& loop, Renderer render);
+    ~MetricsServer();
+
+    bool listen(const std::string& address);
+    void close();
+
+    // "# HELP/# TYPE/# UNIT" lines opening a metric family
+    static void family(std::string& out, const char* name, const char* type, const char* help, const char* unit = nullptr);
+    // Label value with \, " and newlines escaped
+    static std::string escape(const std::string& value);
+
+private:
+    struct Client {
+        std::string request;
+        std::string response;
+        size_t sent = 0;
+    };
+
+    EventLoop& loop;
+    Renderer render;
+    int listen_fd;
+    std::string unix_path;
+    dev_t unix_dev;            // identity of the socket we bound, so close()
+    ino_t unix_ino;            // never removes one another process replaced
+    std::map<int, Client> clients;
+
+    void on_accept();
+    void on_client_event(int fd, uint32_t events);
+    void respond(int fd, Client& client);
+    void flush(int fd, Client& client);
+    void drop(int fd);
+};
+
+#endif // METRICSSERVER_HPP
@@ -0,0 +1,244 @@
+#include "OuiIndex.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char MAGIC[8] = { 'B', 'P', 'O', 'U', 'I', 0, 0, 1 };
+
+OuiIndex::OuiIndex() : map(nullptr), map_size(0), entries(nullptr), count(0), names(nullptr) {
+}
+
+OuiIndex::~OuiIndex() {
+    close();
+}
+
+bool OuiIndex::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+
+    // Reject a foreign or truncated file before trusting any offset in it
+    const Header* header = (const Header*)p;
+    size_t entries_end = sizeof(Header) + (size_t)header->entries * sizeof(Entry);
+    const char* table = (const char*)p + entries_end;
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || entries_end + header->names_size != (size_t)st.st_size ||
+        header->names_size == 0 || table[header->names_size - 1] != '\0') {
+        munmap(p, st.st_size);
+        return false;
+    }
+    map = p;
+    map_size = st.st_size;
+    entries = (const Entry*)((const char*)p + sizeof(Header));
+    count = header->entries;
+    names = table;
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].name >= header->names_size) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void OuiIndex::close() {
+    if (map) munmap(map, map_size);
+    map = nullptr;
+    map_size = 0;
+    entries = nullptr;
+    count = 0;
+    names = nullptr;
+}
+
+bool OuiIndex::is_open() const {
+    return map != nullptr;
+}
+
+size_t OuiIndex::size() const {
+    return count;
+}
+
+const char* OuiIndex::lookup48(uint64_t addr) const {
+    static const uint32_t WIDTHS[] = { 36, 28, 24 };
+    for (uint32_t bits : WIDTHS) {
+        uint64_t prefix = addr & ~((1ULL << (48 - bits)) - 1);
+        const Entry* end = entries + count;
+        const Entry* it = std::lower_bound(entries, end, prefix, [bits](const Entry& e, uint64_t p) {
+            return e.bits != bits ? e.bits < bits : e.prefix < p;
+        });
+        if (it != end && it->bits == bits && it->prefix == prefix) return names + it->name;
+    }
+    return nullptr;
+}
+
+const char* OuiIndex::lookup(const bdaddr_t& addr) const {
+    // bdaddr_t is little-endian: b[5] is the first octet written
+    uint64_t a = 0;
+    for (int i = 5; i >= 0; i--) a = a << 8 | addr.b[i];
+    return lookup48(a);
+}
+
+const char* OuiIndex::lookup(const std::string& mac) const {
+    uint64_t a = 0;
+    int digits = 0;
+    for (char c : mac) {
+        if (c == ':' || c == '-' || c == '.') continue;
+        if (!isxdigit((unsigned char)c) || ++digits > 12) return nullptr;
+        a = a << 4 | (uint64_t)(isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10);
+    }
+    return digits == 12 ? lookup48(a) : nullptr;
+}
+
+std::string OuiIndex::default_path() {
+    const char* cache = getenv("XDG_CACHE_HOME");
+    if (cache && *cache) return std::string(cache) + "/blueproximity/oui.idx";
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/blueproximity/oui.idx";
+}
+
+std::vector<std::string> OuiIndex::default_sources() {
+    static const char* const FILES[] = { "oui.txt", "mam.txt", "oui36.txt", "iab.txt" };
+    std::vector<std::string> sources;
+    for (const char* file : FILES) {
+        std::string path = std::string("/usr/share/ieee-data/") + file;
+        if (access(path.c_str(), R_OK) == 0) sources.push_back(path);
+    }
+    return sources;
+}
+
+static std::string trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+// Hex digits of s, ignoring '-'; false unless there are exactly `digits`
+static bool parse_hex(const std::string& s, int digits, uint64_t& value) {
+    value = 0;
+    int n = 0;
+    for (char c : s) {
+        if (c == '-') continue;
+        if (!isxdigit((unsigned char)c) || ++n > digits) return false;
+        value = value << 4 | (uint64_t)(isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10);
+    }
+    return n == digits;
+}
+
+long OuiIndex::compile(const std::vector<std::string>& sources, const std::string& output, std::string* error) {
+    std::vector<Entry> table;
+    std::string name_table;
+    std::unordered_map<std::string, uint32_t> name_offsets;
+
+    auto add = [&](uint64_t prefix, uint32_t bits, const std::string& vendor) {
+        auto it = name_offsets.find(vendor);
+        if (it == name_offsets.end()) {
+            it = name_offsets.emplace(vendor, (uint32_t)name_table.size()).first;
+            name_table += vendor;
+            name_table += '\0';
+        }
+        Entry e = {};
+        e.prefix = prefix;
+        e.name = it->second;
+        e.bits = bits;
+        table.push_back(e);
+    };
+
+    for (const auto& source : sources) {
+        std::ifstream file(source);
+        if (!file.is_open()) {
+            if (error) *error = "cannot read " + source;
+            return -1;
+        }
+        // Each record opens with "XX-XX-XX   (hex)   Vendor". MA-L follows
+        // it with "XXXXXX   (base 16)"; MA-M and MA-S with the range of the
+        // low half, "X00000-XFFFFF" or "XXX000-XXXFFF", whose shared leading
+        // digits extend the prefix.
+        std::string line;
+        uint64_t oui = 0;
+        std::string vendor;
+        bool pending = false;
+        while (std::getline(file, line)) {
+            size_t hex = line.find("(hex)");
+            size_t base = line.find("(base 16)");
+            if (hex != std::string::npos) {
+                if (pending) add(oui << 24, 24, vendor);
+                pending = parse_hex(trim(line.substr(0, hex)), 6, oui);
+                vendor = trim(line.substr(hex + 5));
+                if (vendor.empty()) vendor = "(unnamed)";
+            } else if (base != std::string::npos && pending) {
+                pending = false;
+                std::string range = trim(line.substr(0, base));
+                size_t dash = range.find('-');
+                uint64_t low, high;
+                if (dash == std::string::npos || !parse_hex(range.substr(0, dash), 6, low) ||
+                    !parse_hex(range.substr(dash + 1), 6, high)) {
+                    add(oui << 24, 24, vendor);
+                    continue;
+                }
+                int shared = 0;
+                while (shared < 6 && ((low >> (20 - 4 * shared)) & 0xf) == ((high >> (20 - 4 * shared)) & 0xf)) shared++;
+                uint32_t bits = 24 + 4 * shared;
+                uint64_t prefix = (oui << 24 | low) & ~((1ULL << (48 - bits)) - 1);
+                add(prefix, bits, vendor);
+            }
+        }
+        if (pending) add(oui << 24, 24, vendor);
+    }
+    if (table.empty()) {
+        if (error) *error = "no registry entries found";
+        return -1;
+    }
+
+    // Sorted for lookup48(); where registries overlap the first source wins
+    std::stable_sort(table.begin(), table.end(), [](const Entry& a, const Entry& b) {
+        return a.bits != b.bits ? a.bits < b.bits : a.prefix < b.prefix;
+    });
+    table.erase(std::unique(table.begin(), table.end(), [](const Entry& a, const Entry& b) {
+        return a.bits == b.bits && a.prefix == b.prefix;
+    }), table.end());
+
+    // Create the cache directory on first use
+    for (size_t slash = output.find('/', 1); slash != std::string::npos; slash = output.find('/', slash + 1)) {
+        mkdir(output.substr(0, slash).c_str(), 0755);
+    }
+
+    Header header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entries = (uint32_t)table.size();
+    header.names_size = (uint32_t)name_table.size();
+
+    std::string tmp = output + ".tmp." + std::to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        if (error) *error = "cannot create " + tmp + ": " + strerror(errno);
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(table.data(), sizeof(Entry), table.size(), f) == table.size() &&
+              fwrite(name_table.data(), 1, name_table.size(), f) == name_table.size();
+    ok = fclose(f) == 0 && ok;
+    // Readers map either the old index or the new one, never a partial file
+    if (!ok || rename(tmp.c_str(), output.c_str()) < 0) {
+        if (error) *error = "cannot write " + output + ": " + strerror(errno);
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return (long)table.size();
+}
@@ -0,0 +1,63 @@
+#ifndef OUIINDEX_HPP
+#define OUIINDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+
+// Vendor lookup by address prefix from a compiled, memory-mapped index of
+// the IEEE registries: MA-L (24-bit OUIs, oui.txt), MA-M (28-bit, mam.txt)
+// and MA-S/IAB (36-bit, oui36.txt and iab.txt). A lookup is at most three
+// binary searches over the mapped entries, most specific first; nothing
+// is parsed or copied at runtime.
+//
+// File layout, native byte order (built where it is used):
+//   Header, Entry[entries] sorted by (bits, prefix), names (NUL-terminated)
+class OuiIndex {
+public:
+    struct Header {
+        char magic[8];         // "BPOUI\0\0\1"
+        uint32_t entries;
+        uint32_t names_size;
+    };
+
+    struct Entry {
+        uint64_t prefix;       // top `bits` of the address, left-aligned in 48 bits
+        uint32_t name;         // offset into the name table
+        uint32_t bits;         // 24, 28 or 36
+    };
+
+    OuiIndex();
+    ~OuiIndex();
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const;
+    size_t size() const;
+
+    // Registered vendor, or nullptr when the prefix is not assigned
+    const char* lookup(const bdaddr_t& addr) const;
+    const char* lookup(const std::string& mac) const; // "AA:BB:CC:DD:EE:FF", any case, '-' allowed
+
+    // ~/.cache/blueproximity/oui.idx (or under $XDG_CACHE_HOME)
+    static std::string default_path();
+    // The registry files present under /usr/share/ieee-data
+    static std::vector<std::string> default_sources();
+
+    // Parses the registry text files and writes an index to output,
+    // atomically through a temporary file. Returns the entry count, or -1
+    // with *error set.
+    static long compile(const std::vector<std::string>& sources, const std::string& output, std::string* error);
+
+private:
+    void* map;
+    size_t map_size;
+    const Entry* entries;
+    uint32_t count;
+    const char* names;
+
+    const char* lookup48(uint64_t addr) const;
+};
+
+#endif // OUIINDEX_HPP
@@ -0,0 +1,112 @@
+#include "ProximityEstimator.hpp"
+#include <cmath>
+
+// Free-space loss over the first metre at 2.4 GHz, rounded up
+static const double PATH_LOSS_1M = 41.0;
+
+ProximityEstimator::ProximityEstimator(const Config& config)
+    : config(config), ref_rssi(config.ref_rssi), primed(false), misses(0),
+      r(0), v(0), p00(0), p01(0), p11(0) {
+}
+
+void ProximityEstimator::set_tx_power(int tx_power) {
+    ref_rssi = tx_power - PATH_LOSS_1M;
+}
+
+void ProximityEstimator::seed(double rssi) {
+    r = rssi;
+    v = 0;
+    p00 = config.measurement_noise * config.measurement_noise;
+    p01 = 0;
+    // Nothing is known about the motion yet; allow a brisk walk either way
+    p11 = 10.0;
+    primed = true;
+    misses = 0;
+}
+
+void ProximityEstimator::correct(double z, double noise_var) {
+    double y = z - r;
+    double s = p00 + noise_var;
+    double k0 = p00 / s;
+    double k1 = p01 / s;
+
+    r += k0 * y;
+    v += k1 * y;
+    p11 -= k1 * p01;
+    p01 *= 1 - k0;
+    p00 *= 1 - k0;
+}
+
+void ProximityEstimator::push(double rssi, double dt) {
+    bool missing = rssi <= -255;
+    if (!primed || (!missing && misses >= config.reacquire_ticks)) {
+        // First sample, or back after a gap the old track says nothing about
+        if (!missing) seed(rssi);
+        return;
+    }
+
+    // Predict
+    double q = config.process_noise * config.process_noise;
+    r += v * dt;
+    p00 += dt * (2 * p01 + dt * p11) + q * dt * dt * dt * dt / 4;
+    p01 += dt * p11 + q * dt * dt * dt / 2;
+    p11 += q * dt * dt;
+
+    if (missing) {
+        // Silence is weak evidence of distance, not no evidence
+        misses++;
+        correct(config.missing_rssi, config.missing_noise * config.missing_noise);
+        return;
+    }
+    misses = 0;
+
+    // Down-weight samples more than 3 sigma off the prediction, so a
+    // single deep fade bends the track instead of yanking it
+    double noise_var = config.measurement_noise * config.measurement_noise;
+    double y = rssi - r;
+    double nis = y * y / (p00 + noise_var);
+    if (nis > 9) noise_var *= nis / 9;
+    correct(rssi, noise_var);
+}
+
+bool ProximityEstimator::valid() const {
+    return primed;
+}
+
+double ProximityEstimator::rssi() const {
+    return primed ? r : -255.0;
+}
+
+double ProximityEstimator::rssi_velocity() const {
+    return v;
+}
+
+double ProximityEstimator::rssi_stddev() const {
+    return std::sqrt(p00);
+}
+
+double ProximityEstimator::distance() const {
+    return std::pow(10.0, (ref_rssi - r) / (10 * config.path_loss_exponent));
+}
+
+double ProximityEstimator::velocity() const {
+    // d(distance)/dt from d(rssi)/dt through the path-loss model
+    return -distance() * std::log(10.0) / (10 * config.path_loss_exponent) * v;
+}
+
+double ProximityEstimator::horizon_z(double threshold) const {
+    double h = config.horizon;
+    double mean = r + v * h;
+    double var = p00 + 2 * h * p01 + h * h * p11;
+    return (threshold - mean) / std::sqrt(2 * var);
+}
+
+double ProximityEstimator::p_below(double threshold) const {
+    if (!primed) return 1.0;
+    return 0.5 * std::erfc(-horizon_z(threshold));
+}
+
+double ProximityEstimator::p_above(double threshold) const {
+    if (!primed) return 0.0;
+    return 0.5 * std::erfc(horizon_z(threshold));
+}
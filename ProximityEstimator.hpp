@@ -0,0 +1,63 @@
+#ifndef PROXIMITYESTIMATOR_HPP
+#define PROXIMITYESTIMATOR_HPP
+
+// Tracks a device's RSSI and its rate of change with a two-state Kalman
+// filter (constant velocity, white-noise acceleration), and maps them to
+// distance through the log-distance path-loss model
+//
+//   rssi = ref_rssi - 10 * n * log10(d)
+//
+// where ref_rssi is the RSSI at 1 m: derived from the advertised TX power
+// when the device sends one, otherwise taken from the config. Because the
+// state carries an uncertainty, the lock decision can ask how likely it
+// is that the device is past a threshold instead of counting ticks.
+class ProximityEstimator {
+public:
+    struct Config {
+        double ref_rssi = -59;            // dBm at 1 m without an advertised TX power
+        double path_loss_exponent = 2.0;  // 2 in free space, 2.5-4 indoors
+        double measurement_noise = 4.0;   // dB, one sigma of a single sample
+        double process_noise = 1.5;       // dB/s^2, one sigma of the RSSI acceleration
+        double missing_rssi = -100;       // a tick without a sample reads as this...
+        double missing_noise = 20;        // ...with this much doubt (dB)
+        int reacquire_ticks = 3;          // restart the track after this many misses
+        double horizon = 1.0;             // s ahead that p_below() looks
+    };
+
+    explicit ProximityEstimator(const Config& config);
+
+    // Advertised TX power level (AD type 0x0A), dBm
+    void set_tx_power(int tx_power);
+
+    // One sample per tick, dt seconds after the previous one; -255 = none
+    void push(double rssi, double dt = 1.0);
+
+    bool valid() const;           // false until the first real sample
+    double rssi() const;          // filtered RSSI, dBm
+    double rssi_velocity() const; // dB/s
+    double rssi_stddev() const;
+
+    double distance() const;      // m
+    double velocity() const;      // m/s, positive while moving away
+
+    // Probability that the RSSI is at or below (above) threshold `horizon`
+    // seconds from now. 1 (0) while nothing has been heard.
+    double p_below(double threshold) const;
+    double p_above(double threshold) const;
+
+private:
+    Config config;
+    double ref_rssi;
+    bool primed;
+    int misses;
+
+    // State [rssi, d(rssi)/dt] and its covariance
+    double r, v;
+    double p00, p01, p11;
+
+    void seed(double rssi);
+    void correct(double z, double noise_var);
+    double horizon_z(double threshold) const;
+};
+
+#endif // PROXIMITYESTIMATOR_HPP
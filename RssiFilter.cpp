@@ -0,0 +1,81 @@
+#include "RssiFilter.hpp"
+#include <cmath>
+#include <sstream>
+
+// Run-time chain for specs that are not one of the compiled presets
+class RssiFilterList : public RssiFilter {
+public:
+    void add(std::unique_ptr<RssiFilter> stage) {
+        stages.push_back(std::move(stage));
+    }
+
+    double push(double sample) override {
+        for (auto& stage : stages) sample = stage->push(sample);
+        return sample;
+    }
+
+private:
+    std::vector<std::unique_ptr<RssiFilter>> stages;
+};
+
+template <typename Stage>
+static std::unique_ptr<RssiFilter> erase_stage(Stage stage) {
+    return std::unique_ptr<RssiFilter>(new RssiFilterOf<Stage>(std::move(stage)));
+}
+
+std::unique_ptr<RssiFilter> make_rssi_filter(const std::string& spec, size_t window, std::string* error) {
+    if (spec.empty() || spec == "mean") {
+        return make_rssi_chain(RssiMean(window));
+    }
+    if (spec == "smooth") {
+        return make_rssi_chain(RssiHoldLast(3), RssiEma(0.3));
+    }
+    if (spec == "robust") {
+        return make_rssi_chain(RssiHoldLast(3), RssiMedian(5), RssiMean(window));
+    }
+
+    std::unique_ptr<RssiFilterList> list(new RssiFilterList());
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        bool has_param = colon != std::string::npos;
+        double param = 0;
+        if (has_param) {
+            try {
+                param = std::stod(item.substr(colon + 1));
+            } catch (const std::exception&) {
+                if (error) *error = "bad parameter in filter stage '" + item + "'";
+                return nullptr;
+            }
+        }
+        // Window and hold lengths count samples
+        bool counted = name == "mean" || name == "max" || name == "min" || name == "median" || name == "hold";
+        if (counted && has_param && (param < 1 || param != std::floor(param))) {
+            if (error) *error = name + " length must be a positive whole number in '" + item + "'";
+            return nullptr;
+        }
+        size_t n = has_param ? (size_t)param : window;
+
+        if (name == "mean") list->add(erase_stage(RssiMean(n)));
+        else if (name == "max") list->add(erase_stage(RssiWindowMax(n)));
+        else if (name == "min") list->add(erase_stage(RssiWindowMin(n)));
+        else if (name == "median") list->add(erase_stage(RssiMedian(has_param ? n : 5)));
+        else if (name == "ema") {
+            double alpha = has_param ? param : 0.3;
+            if (alpha <= 0 || alpha > 1) {
+                if (error) *error = "ema alpha must be in (0, 1] in '" + item + "'";
+                return nullptr;
+            }
+            list->add(erase_stage(RssiEma(alpha)));
+        }
+        else if (name == "hold") list->add(erase_stage(RssiHoldLast(has_param ? (int)param : 3)));
+        else if (name == "floor") list->add(erase_stage(RssiFloor(has_param ? param : -100)));
+        else {
+            if (error) *error = "unknown filter stage '" + item + "'";
+            return nullptr;
+        }
+    }
+    return std::unique_ptr<RssiFilter>(list.release());
+}
@@ -0,0 +1,241 @@
+#ifndef RSSIFILTER_HPP
+#define RSSIFILTER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// RSSI smoothing, one sample per tick. Each stage costs O(1) per sample
+// however long its window (the median is O(n) in its own small n), and
+// never allocates after construction. Stages chain at compile time with
+// RssiChain<...>, or at run time from a config string with
+// make_rssi_filter().
+//
+// -255 marks a tick without a sample. Only the missing-sample stages
+// (hold, floor) interpret it; every other stage takes it as a very weak
+// reading, which is what the original plain mean did.
+
+const double RSSI_MISSING = -255.0;
+
+inline bool rssi_missing(double sample) {
+    return sample <= RSSI_MISSING;
+}
+
+// Mean of the last `window` samples (fewer until the window has filled).
+// The running sum is kept in fixed point, 1/65536 dB steps, so it stays
+// exact: what leaves the window is exactly what entered it, and integral
+// readings lose nothing.
+class RssiMean {
+public:
+    explicit RssiMean(size_t window) : ring(std::max<size_t>(window, 1), 0), pos(0), count(0), sum(0) {}
+
+    double push(double sample) {
+        int64_t fixed = (int64_t)std::llround(sample * SCALE);
+        if (count == ring.size()) sum -= ring[pos];
+        else count++;
+        ring[pos] = fixed;
+        sum += fixed;
+        pos = (pos + 1) % ring.size();
+        return (double)sum / SCALE / count;
+    }
+
+private:
+    static constexpr double SCALE = 65536.0;
+    std::vector<int64_t> ring;
+    size_t pos;
+    size_t count;
+    int64_t sum;
+};
+
+// Exponential moving average; the first sample seeds it
+class RssiEma {
+public:
+    explicit RssiEma(double alpha) : alpha(alpha), value(0), primed(false) {}
+
+    double push(double sample) {
+        if (!primed) {
+            value = sample;
+            primed = true;
+        } else {
+            value += alpha * (sample - value);
+        }
+        return value;
+    }
+
+private:
+    double alpha;
+    double value;
+    bool primed;
+};
+
+// Max (or min) over the last `window` samples with a monotonic deque:
+// every sample enters and leaves it once. The deque lives in a fixed ring.
+template <typename Compare>
+class RssiWindowExtreme {
+public:
+    explicit RssiWindowExtreme(size_t window)
+        : window(std::max<size_t>(window, 1)), ring(this->window), head(0), size(0), next_index(0) {}
+
+    double push(double sample) {
+        // The front falls out of the window
+        if (size > 0 && at(0).index + window <= next_index) {
+            head = (head + 1) % window;
+            size--;
+        }
+        // Anything the new sample beats can never be the answer again
+        while (size > 0 && !Compare()(at(size - 1).value, sample)) size--;
+
+        ring[(head + size) % window] = Entry{ next_index++, sample };
+        size++;
+        return at(0).value;
+    }
+
+private:
+    struct Entry {
+        size_t index;
+        double value;
+    };
+
+    size_t window;
+    std::vector<Entry> ring;
+    size_t head;
+    size_t size;
+    size_t next_index;
+
+    const Entry& at(size_t i) const { return ring[(head + i) % window]; }
+};
+
+typedef RssiWindowExtreme<std::greater<double>> RssiWindowMax;
+typedef RssiWindowExtreme<std::less<double>> RssiWindowMin;
+
+// Median of the last n samples; knocks out single-sample fades and spikes
+class RssiMedian {
+public:
+    explicit RssiMedian(size_t n) : ring(std::max<size_t>(n, 1), 0.0), pos(0), count(0) {
+        sorted.reserve(ring.size());
+    }
+
+    double push(double sample) {
+        if (count == ring.size()) {
+            sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), ring[pos]));
+        } else {
+            count++;
+        }
+        ring[pos] = sample;
+        pos = (pos + 1) % ring.size();
+        sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), sample), sample);
+
+        if (count % 2) return sorted[count / 2];
+        return (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    }
+
+private:
+    std::vector<double> ring;
+    std::vector<double> sorted;
+    size_t pos;
+    size_t count;
+};
+
+// Repeats the last real sample for up to max_ticks missing ones, so a
+// dropped advert or a late Read RSSI does not read as the device leaving
+class RssiHoldLast {
+public:
+    explicit RssiHoldLast(int max_ticks) : max_ticks(max_ticks), misses(0), last(RSSI_MISSING) {}
+
+    double push(double sample) {
+        if (!rssi_missing(sample)) {
+            misses = 0;
+            last = sample;
+            return sample;
+        }
+        if (rssi_missing(last) || misses >= max_ticks) return RSSI_MISSING;
+        misses++;
+        return last;
+    }
+
+private:
+    int max_ticks;
+    int misses;
+    double last;
+};
+
+// Replaces a missing sample with a floor, e.g. -100, so it pulls averages
+// down like a far-away reading instead of by 150 dB
+class RssiFloor {
+public:
+    explicit RssiFloor(double floor) : floor(floor) {}
+
+    double push(double sample) {
+        return rssi_missing(sample) ? floor : sample;
+    }
+
+private:
+    double floor;
+};
+
+// Stages applied left to right, resolved and inlined at compile time
+template <typename... Stages>
+class RssiChain {
+public:
+    explicit RssiChain(Stages... stages) : stages(std::move(stages)...) {}
+
+    double push(double sample) {
+        return push_from<0>(sample);
+    }
+
+private:
+    std::tuple<Stages...> stages;
+
+    template <size_t I>
+    double push_from(double sample) {
+        if constexpr (I == sizeof...(Stages)) {
+            return sample;
+        } else {
+            return push_from<I + 1>(std::get<I>(stages).push(sample));
+        }
+    }
+};
+
+// Type-erased filter so each monitor can hold whatever chain it was given
+class RssiFilter {
+public:
+    virtual ~RssiFilter() = default;
+    virtual double push(double sample) = 0;
+};
+
+template <typename Chain>
+class RssiFilterOf : public RssiFilter {
+public:
+    explicit RssiFilterOf(Chain chain) : chain(std::move(chain)) {}
+
+    double push(double sample) override {
+        return chain.push(sample);
+    }
+
+private:
+    Chain chain;
+};
+
+template <typename... Stages>
+std::unique_ptr<RssiFilter> make_rssi_chain(Stages... stages) {
+    return std::unique_ptr<RssiFilter>(new RssiFilterOf<RssiChain<Stages...>>(RssiChain<Stages...>(std::move(stages)...)));
+}
+
+// Builds a filter from a spec. Presets are compiled chains:
+//   mean    (default) mean over `window` samples
+//   smooth  hold:3,ema:0.3
+//   robust  hold:3,median:5,mean
+// Anything else is a comma-separated list of stages, name[:param]:
+//   hold:N  floor:dBm  mean[:N]  ema:alpha  max[:N]  min[:N]  median:N
+// where N defaults to `window` for mean/max/min. Returns nullptr and sets
+// error on a bad spec.
+std::unique_ptr<RssiFilter> make_rssi_filter(const std::string& spec, size_t window, std::string* error = nullptr);
+
+#endif // RSSIFILTER_HPP
@@ -0,0 +1,160 @@
+#include "SessionProbe.hpp"
+#include "Clock.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <system_error>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <unistd.h>
+
+SessionProbe SessionProbe::run(bool want_desktop) {
+    double started = monotonic_ms();
+    SessionProbe probe;
+    probe.uid = getuid();
+    const char* user = getenv("USER");
+    if (!user) {
+        struct passwd* pw = getpwuid(probe.uid);
+        if (pw) user = pw->pw_name;
+    }
+    if (user) probe.user = user;
+
+    std::future<std::string> shell;
+    if (want_desktop) {
+        try {
+            shell = std::async(std::launch::async, []() { return find_desktop_shell(); });
+        } catch (const std::system_error&) {
+            probe.desktop = find_desktop_shell();
+        }
+    }
+
+    find_session(probe.user, probe.uid, probe.session_id, probe.display);
+    if (probe.display.empty()) probe.display = find_x_display();
+    probe.xauthority = find_xauthority(probe.uid);
+
+    if (shell.valid()) probe.desktop = shell.get();
+    probe.elapsed_ms = monotonic_ms() - started;
+    return probe;
+}
+
+std::string SessionProbe::find_desktop_shell(const std::string& proc_dir) {
+    DIR* dir = opendir(proc_dir.c_str());
+    if (!dir) return "";
+
+    // Same preference as the environment checks: GNOME, then KDE, then COSMIC
+    bool kde = false;
+    bool cosmic = false;
+    bool gnome = false;
+    struct dirent* entry;
+    while (!gnome && (entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] < '1' || entry->d_name[0] > '9') continue;
+
+        // comm is the name pgrep -x matches, cut to 15 characters
+        std::string path = proc_dir + "/" + entry->d_name + "/comm";
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue; // exited meanwhile
+        char comm[32];
+        ssize_t len = read(fd, comm, sizeof(comm) - 1);
+        close(fd);
+        if (len <= 0) continue;
+        if (comm[len - 1] == '\n') len--;
+        comm[len] = '\0';
+
+        if (strcmp(comm, "gnome-shell") == 0) gnome = true;
+        else if (strcmp(comm, "plasmashell") == 0) kde = true;
+        else if (strcmp(comm, "cosmic-comp") == 0) cosmic = true;
+    }
+    closedir(dir);
+
+    if (gnome) return "gnome";
+    if (kde) return "kde";
+    if (cosmic) return "cosmic";
+    return "";
+}
+
+bool SessionProbe::find_session(const std::string& user, uid_t uid, std::string& session_id, std::string& display,
+                                const std::string& sessions_dir) {
+    DIR* dir = opendir(sessions_dir.c_str());
+    if (!dir) return false;
+
+    int best_score = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        // Session files are named by ID; skip ".", ".." and the *.ref FIFOs
+        std::string id = entry->d_name;
+        if (id.empty() || id.find('.') != std::string::npos) continue;
+
+        std::ifstream file(sessions_dir + "/" + id);
+        std::string line;
+        bool ours = false;
+        bool active = false;
+        bool graphical = false;
+        bool closing = false;
+        std::string session_display;
+        while (std::getline(file, line)) {
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            std::string key = line.substr(0, eq);
+            std::string val = line.substr(eq + 1);
+            if (key == "USER") ours = ours || val == user;
+            else if (key == "UID") ours = ours || (uid_t)strtoul(val.c_str(), nullptr, 10) == uid;
+            else if (key == "ACTIVE") active = val == "1";
+            else if (key == "STATE") closing = val == "closing";
+            else if (key == "TYPE") graphical = val == "x11" || val == "wayland" || val == "mir";
+            else if (key == "DISPLAY") session_display = val;
+        }
+        if (!ours || closing) continue;
+
+        // Active graphical beats active beats graphical; then the oldest ID
+        int score = (active ? 2 : 0) + (graphical ? 1 : 0);
+        bool older = id.size() < session_id.size() || (id.size() == session_id.size() && id < session_id);
+        if (score > best_score || (score == best_score && older)) {
+            best_score = score;
+            session_id = id;
+            display = session_display;
+        }
+    }
+    closedir(dir);
+    return best_score >= 0;
+}
+
+std::string SessionProbe::find_x_display(const std::string& socket_dir) {
+    DIR* dir = opendir(socket_dir.c_str());
+    if (!dir) return "";
+
+    long lowest = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] != 'X' || !entry->d_name[1]) continue;
+        char* end;
+        long n = strtol(entry->d_name + 1, &end, 10);
+        if (*end || n < 0) continue;
+        if (lowest < 0 || n < lowest) lowest = n;
+    }
+    closedir(dir);
+    return lowest < 0 ? "" : ":" + std::to_string(lowest);
+}
+
+std::string SessionProbe::find_xauthority(uid_t uid, const std::string& run_user_dir) {
+    std::string base = run_user_dir + "/" + std::to_string(uid);
+
+    // GDM with Xorg
+    std::string gdm = base + "/gdm/Xauthority";
+    if (access(gdm.c_str(), R_OK) == 0) return gdm;
+
+    // Mutter's Xwayland and SDDM keep a generated name
+    DIR* dir = opendir(base.c_str());
+    if (!dir) return "";
+    std::string found;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, ".mutter-Xwaylandauth.", 21) == 0 || strncmp(entry->d_name, "xauth_", 6) == 0) {
+            found = base + "/" + entry->d_name;
+            break;
+        }
+    }
+    closedir(dir);
+    return found;
+}
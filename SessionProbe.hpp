@@ -0,0 +1,31 @@
+#ifndef SESSIONPROBE_HPP
+#define SESSIONPROBE_HPP
+
+#include <string>
+#include <sys/types.h>
+
+// What startup needs to know about the user's login session, read from
+// /proc, /run/systemd/sessions, /run/user and /tmp/.X11-unix rather than
+// from loginctl, pgrep and w pipelines. The /proc scan is the only probe
+// that grows with the machine; run() does it on a second thread while
+// the others read their few files.
+struct SessionProbe {
+    std::string user;
+    uid_t uid = 0;
+    std::string session_id;   // the user's logind session, preferring an active graphical one
+    std::string display;      // that session's X11 display, else the lowest local X server
+    std::string xauthority;   // a display manager's cookie under /run/user/<uid>, if any
+    std::string desktop;      // gnome, kde or cosmic from the running shell, if asked for
+    double elapsed_ms = 0;
+
+    static SessionProbe run(bool want_desktop);
+
+    // The individual probes; directories are parameters for testing on a copy
+    static std::string find_desktop_shell(const std::string& proc_dir = "/proc");
+    static bool find_session(const std::string& user, uid_t uid, std::string& session_id, std::string& display,
+                             const std::string& sessions_dir = "/run/systemd/sessions");
+    static std::string find_x_display(const std::string& socket_dir = "/tmp/.X11-unix");
+    static std::string find_xauthority(uid_t uid, const std::string& run_user_dir = "/run/user");
+};
+
+#endif // SESSIONPROBE_HPP
@@ -0,0 +1,434 @@
+#include "SimAdapter.hpp"
+#include "Clock.hpp"
+#include "Log.hpp"
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+SimAdapter::SimAdapter(EventLoop& loop)
+    : loop(loop), rng(1), start_ms(monotonic_ms()), duration_s(0), hci_fd(-1), controller_fd(-1), scanning(false),
+      supervision_timer(-1), next_connect_id(1), next_handle(0x0001) {
+}
+
+SimAdapter::~SimAdapter() {
+    while (!pending.empty()) cancel_rfcomm(pending.begin()->first);
+    for (size_t i = 0; i < devices.size(); i++) drop_link((int)i, 0x16);
+    close_hci();
+    loop.remove_timer(supervision_timer);
+}
+
+bool SimAdapter::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        Log::error("Error: Cannot open simulation script %s", path);
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    Device* current = nullptr;
+
+    while (std::getline(file, line)) {
+        line_no++;
+        if (line.empty() || line[0] == '#') continue;
+        if (line == "[DEVICE]") {
+            devices.push_back(Device());
+            current = &devices.back();
+            continue;
+        }
+
+        std::stringstream ss(line);
+        std::string key, val;
+        std::getline(ss, key, '=');
+        std::getline(ss, val);
+
+        try {
+            if (!current) {
+                if (key == "seed") rng.seed(std::stoul(val));
+                else if (key == "duration") duration_s = std::stod(val);
+            } else if (key == "mac") {
+                current->mac = val;
+                str2ba(val.c_str(), &current->addr);
+            }
+            else if (key == "name") current->name = val;
+            else if (key == "type") current->is_ble = (val == "ble");
+            else if (key == "adv_interval") current->adv_interval_ms = std::stoi(val);
+            else if (key == "tx_power") current->tx_power = std::stoi(val);
+            else if (key == "connect_latency") current->connect_latency_ms = std::stoi(val);
+            else if (key == "connect_fail_rate") current->connect_fail_rate = std::stod(val);
+            else if (key == "page_timeout") current->page_timeout_ms = std::stoi(val);
+            else if (key == "rssi_jitter") current->rssi_jitter = std::stoi(val);
+            else if (key == "rssi") {
+                std::stringstream points(val);
+                std::string point;
+                current->rssi.clear();
+                while (std::getline(points, point, ',')) {
+                    size_t colon = point.find(':');
+                    if (colon == std::string::npos) throw std::invalid_argument(point);
+                    std::string level = point.substr(colon + 1);
+                    current->rssi.push_back({ std::stod(point.substr(0, colon)),
+                                              level == "off" ? ABSENT : std::stoi(level) });
+                }
+            }
+        } catch (const std::exception&) {
+            Log::error("Error: Bad value in %s line %d: %s", path, line_no, line);
+            return false;
+        }
+    }
+
+    if (duration_s < 0) {
+        Log::error("Error: duration in %s must not be negative", path);
+        return false;
+    }
+    for (const auto& dev : devices) {
+        if (dev.mac.empty() || dev.adv_interval_ms < 1) {
+            Log::error("Error: Every [DEVICE] in %s needs a mac and a positive adv_interval", path);
+            return false;
+        }
+    }
+
+    // Links of devices that walked off are dropped like a supervision timeout
+    if (supervision_timer < 0) {
+        supervision_timer = loop.add_timer(500, 500, [this](uint64_t) { supervise(); });
+    }
+    start_ms = monotonic_ms();
+    return true;
+}
+
+const std::vector<SimAdapter::Device>& SimAdapter::get_devices() const {
+    return devices;
+}
+
+double SimAdapter::get_duration() const {
+    return duration_s;
+}
+
+void SimAdapter::print_stats() const {
+    Log::info("[ SIM ] %llu adverts, %llu RSSI reads, %llu connects, %llu failed, %llu links lost, %llu events dropped",
+              stats.adverts, stats.rssi_reads, stats.connects, stats.connect_failures, stats.links_lost, stats.events_dropped);
+}
+
+const char* SimAdapter::name() const {
+    return "sim";
+}
+
+int SimAdapter::open_hci() {
+    if (hci_fd >= 0) return hci_fd;
+
+    // SEQPACKET keeps one event per read(), like the HCI socket
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        Log::errno_error("socketpair");
+        return -1;
+    }
+    hci_fd = sv[0];
+    controller_fd = sv[1];
+    int flags = fcntl(controller_fd, F_GETFL, 0);
+    if (flags >= 0) fcntl(controller_fd, F_SETFL, flags | O_NONBLOCK);
+    return hci_fd;
+}
+
+void SimAdapter::close_hci() {
+    if (hci_fd < 0) return;
+    set_scanning(false);
+    close(hci_fd);
+    close(controller_fd);
+    hci_fd = -1;
+    controller_fd = -1;
+}
+
+int SimAdapter::get_dev_id() const {
+    return 0;
+}
+
+int SimAdapter::send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) {
+    if (controller_fd < 0) return -1;
+
+    const unsigned char* p = (const unsigned char*)param;
+    uint16_t opcode = cmd_opcode_pack(ogf, ocf);
+    uint8_t status = 0;
+
+    if (opcode == cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_PARAMETERS)) {
+        cmd_complete(opcode, &status, 1);
+    } else if (opcode == cmd_opcode_pack(OGF_LE_CTL, OCF_LE_SET_SCAN_ENABLE) && plen >= 1) {
+        set_scanning(p[0] != 0);
+        cmd_complete(opcode, &status, 1);
+    } else if (opcode == cmd_opcode_pack(OGF_STATUS_PARAM, OCF_READ_RSSI) && plen >= 2) {
+        read_rssi_rp rp = {};
+        uint16_t handle;
+        memcpy(&handle, p, sizeof(handle));
+        rp.handle = handle;
+
+        int index = find_handle(btohs(handle));
+        int rssi = index >= 0 ? rssi_now(index) : ABSENT;
+        if (index >= 0 && rssi == ABSENT) drop_link(index, 0x08); // Connection Timeout
+        if (rssi == ABSENT) {
+            rp.status = 0x02; // Unknown Connection Identifier
+        } else {
+            rp.rssi = (int8_t)rssi;
+            stats.rssi_reads++;
+        }
+        cmd_complete(opcode, &rp, READ_RSSI_RP_SIZE);
+    } else if (opcode == cmd_opcode_pack(OGF_LINK_CTL, OCF_DISCONNECT) && plen >= DISCONNECT_CP_SIZE) {
+        const disconnect_cp* cp = (const disconnect_cp*)param;
+        int index = find_handle(btohs(cp->handle));
+        cmd_status(opcode, index >= 0 ? 0x00 : 0x02);
+        if (index >= 0) drop_link(index, 0x16); // Connection Terminated By Local Host
+    } else {
+        status = 0x01; // Unknown HCI Command
+        cmd_complete(opcode, &status, 1);
+    }
+    return 0;
+}
+
+int SimAdapter::get_conn_handle(const bdaddr_t& addr) {
+    int index = find_device(addr);
+    return index >= 0 ? devices[index].handle : -1;
+}
+
+int SimAdapter::connect_rfcomm(const bdaddr_t& addr, int channel, ConnectHandler handler) {
+    int index = find_device(addr);
+    PendingConnect pc;
+    pc.device = index;
+    pc.handler = std::move(handler);
+
+    int delay;
+    if (index < 0 || rssi_now(index) == ABSENT) {
+        // Nobody answers the page
+        delay = index < 0 ? 5120 : devices[index].page_timeout_ms;
+        pc.err = EHOSTDOWN;
+    } else {
+        const Device& dev = devices[index];
+        delay = dev.connect_latency_ms;
+        if (dev.handle >= 0) {
+            pc.err = EBUSY; // the previous ACL link is still up
+        } else if (std::uniform_real_distribution<double>(0, 1)(rng) < dev.connect_fail_rate) {
+            pc.err = ECONNREFUSED;
+        } else {
+            pc.err = 0;
+        }
+    }
+
+    int id = next_connect_id++;
+    pc.timer = loop.add_timer(delay > 0 ? delay : 1, 0, [this, id](uint64_t) { finish_connect(id); });
+    if (pc.timer < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pending[id] = std::move(pc);
+    return id;
+}
+
+void SimAdapter::cancel_rfcomm(int id) {
+    auto it = pending.find(id);
+    if (it == pending.end()) return;
+    loop.remove_timer(it->second.timer);
+    pending.erase(it);
+}
+
+int SimAdapter::find_device(const bdaddr_t& addr) const {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (bacmp(&devices[i].addr, &addr) == 0) return (int)i;
+    }
+    return -1;
+}
+
+int SimAdapter::find_handle(int handle) const {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].handle == handle) return (int)i;
+    }
+    return -1;
+}
+
+int SimAdapter::rssi_now(int index) {
+    const Device& dev = devices[index];
+    if (dev.rssi.empty()) return ABSENT;
+
+    double t = (monotonic_ms() - start_ms) / 1000.0;
+    const auto& pts = dev.rssi;
+    int level;
+    if (t <= pts.front().first) {
+        level = pts.front().second;
+    } else if (t >= pts.back().first) {
+        level = pts.back().second;
+    } else {
+        size_t i = 1;
+        while (pts[i].first < t) i++;
+        const auto& a = pts[i - 1];
+        const auto& b = pts[i];
+        // Steps into and out of range; ramps in between
+        if (a.second == ABSENT || b.second == ABSENT || b.first <= a.first) {
+            level = a.second;
+        } else {
+            level = (int)(a.second + (b.second - a.second) * (t - a.first) / (b.first - a.first));
+        }
+    }
+
+    if (level == ABSENT) return ABSENT;
+    if (dev.rssi_jitter > 0) {
+        level += std::uniform_int_distribution<int>(-dev.rssi_jitter, dev.rssi_jitter)(rng);
+    }
+    if (level > 20) level = 20;
+    if (level < -127) level = -127;
+    return level;
+}
+
+void SimAdapter::emit(uint8_t event, const void* params, uint8_t plen) {
+    if (controller_fd < 0) return;
+
+    unsigned char buf[1 + HCI_EVENT_HDR_SIZE + 255];
+    buf[0] = HCI_EVENT_PKT;
+    buf[1] = event;
+    buf[2] = plen;
+    memcpy(buf + 1 + HCI_EVENT_HDR_SIZE, params, plen);
+    // A full socket is the daemon not keeping up; the controller drops too
+    if (send(controller_fd, buf, 1 + HCI_EVENT_HDR_SIZE + plen, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        stats.events_dropped++;
+    }
+}
+
+void SimAdapter::cmd_complete(uint16_t opcode, const void* rp, uint8_t rplen) {
+    unsigned char params[EVT_CMD_COMPLETE_SIZE + 32];
+    evt_cmd_complete* cc = (evt_cmd_complete*)params;
+    cc->ncmd = 1;
+    cc->opcode = htobs(opcode);
+    memcpy(params + EVT_CMD_COMPLETE_SIZE, rp, rplen);
+    emit(EVT_CMD_COMPLETE, params, EVT_CMD_COMPLETE_SIZE + rplen);
+}
+
+void SimAdapter::cmd_status(uint16_t opcode, uint8_t status) {
+    evt_cmd_status cs;
+    cs.status = status;
+    cs.ncmd = 1;
+    cs.opcode = htobs(opcode);
+    emit(EVT_CMD_STATUS, &cs, EVT_CMD_STATUS_SIZE);
+}
+
+void SimAdapter::set_scanning(bool enable) {
+    if (enable == scanning) return;
+    scanning = enable;
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        Device& dev = devices[i];
+        if (!dev.is_ble) continue;
+        if (!enable) {
+            loop.remove_timer(dev.adv_timer);
+            dev.adv_timer = -1;
+            continue;
+        }
+        // Random phase so devices with equal intervals do not advertise in lockstep
+        int phase = std::uniform_int_distribution<int>(1, dev.adv_interval_ms)(rng);
+        int index = (int)i;
+        dev.adv_timer = loop.add_timer(phase, dev.adv_interval_ms, [this, index](uint64_t) { advertise(index); });
+    }
+}
+
+void SimAdapter::advertise(int index) {
+    const Device& dev = devices[index];
+    int rssi = rssi_now(index);
+    if (rssi == ABSENT) return;
+
+    // LE Advertising Report: one ADV_IND, public address, Flags AD and,
+    // if scripted, TX Power Level AD
+    unsigned char params[] = {
+        EVT_LE_ADVERTISING_REPORT, 1, 0x00, LE_PUBLIC_ADDRESS,
+        0, 0, 0, 0, 0, 0,
+        6, 0x02, 0x01, 0x06, 0x02, 0x0A, 0,
+        0
+    };
+    size_t plen = sizeof(params);
+    memcpy(params + 4, &dev.addr, 6);
+    if (dev.tx_power == ABSENT) {
+        // Drop the TX Power AD and close the gap before the RSSI byte
+        params[10] = 3;
+        plen -= 3;
+    } else {
+        params[16] = (unsigned char)(int8_t)dev.tx_power;
+    }
+    params[plen - 1] = (unsigned char)(int8_t)rssi;
+    emit(EVT_LE_META_EVENT, params, plen);
+    stats.adverts++;
+}
+
+void SimAdapter::finish_connect(int id) {
+    auto it = pending.find(id);
+    if (it == pending.end()) return;
+    PendingConnect pc = std::move(it->second);
+    pending.erase(it);
+    loop.remove_timer(pc.timer);
+
+    int sv[2];
+    if (pc.err == 0 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) < 0) {
+        pc.err = errno;
+    }
+    if (pc.err != 0) {
+        stats.connect_failures++;
+        pc.handler(-1, pc.err);
+        return;
+    }
+
+    Device& dev = devices[pc.device];
+    int index = pc.device;
+    if (!loop.add(sv[1], EPOLLIN, [this, index](uint32_t events) { on_peer_readable(index, events); })) {
+        close(sv[0]);
+        close(sv[1]);
+        stats.connect_failures++;
+        pc.handler(-1, ENOMEM);
+        return;
+    }
+    dev.peer_fd = sv[1];
+    dev.handle = next_handle;
+    next_handle = next_handle >= 0x0EFF ? 0x0001 : next_handle + 1;
+    stats.connects++;
+
+    evt_conn_complete cc = {};
+    cc.status = 0;
+    cc.handle = htobs((uint16_t)dev.handle);
+    bacpy(&cc.bdaddr, &dev.addr);
+    cc.link_type = ACL_LINK;
+    emit(EVT_CONN_COMPLETE, &cc, EVT_CONN_COMPLETE_SIZE);
+
+    pc.handler(sv[0], 0);
+}
+
+void SimAdapter::on_peer_readable(int index, uint32_t events) {
+    Device& dev = devices[index];
+    char buf[256];
+    ssize_t r = read(dev.peer_fd, buf, sizeof(buf));
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+        // The daemon closed its end of the RFCOMM link
+        drop_link(index, 0x16);
+        return;
+    }
+    if (r > 0 && memmem(buf, r, "AT", 2)) {
+        static const char ok[] = "\r\nOK\r\n";
+        if (write(dev.peer_fd, ok, sizeof(ok) - 1) < 0) drop_link(index, 0x16);
+    }
+}
+
+void SimAdapter::drop_link(int index, uint8_t reason) {
+    Device& dev = devices[index];
+    if (dev.peer_fd < 0) return;
+
+    loop.remove(dev.peer_fd);
+    close(dev.peer_fd);
+    dev.peer_fd = -1;
+
+    evt_disconn_complete dc;
+    dc.status = 0;
+    dc.handle = htobs((uint16_t)dev.handle);
+    dc.reason = reason;
+    emit(EVT_DISCONN_COMPLETE, &dc, EVT_DISCONN_COMPLETE_SIZE);
+    dev.handle = -1;
+    if (reason == 0x08) stats.links_lost++;
+}
+
+void SimAdapter::supervise() {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].peer_fd >= 0 && rssi_now((int)i) == ABSENT) drop_link((int)i, 0x08);
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef SIMADAPTER_HPP
+#define SIMADAPTER_HPP
+
+#include "Adapter.hpp"
+#include "EventLoop.hpp"
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+// An in-process controller driven by a script of devices. It answers the
+// HCI commands the daemon sends with the events a real controller would
+// produce, written into a socketpair that HciDevice reads like the raw
+// HCI socket, and hands out socketpairs as RFCOMM links.
+//
+// Script format (same layout as the config file):
+//
+//   seed=1
+//   duration=60             stop the run after this many seconds
+//   [DEVICE]
+//   mac=AA:BB:CC:DD:EE:FF
+//   name=Phone
+//   type=classic            (or ble)
+//   adv_interval=100        ms between advertisements (ble)
+//   tx_power=-4             advertise a TX Power Level of this many dBm (ble)
+//   connect_latency=300     ms until an RFCOMM connect completes
+//   connect_fail_rate=0.1   share of connects refused while in range
+//   page_timeout=5120       ms until a connect to an absent device fails
+//   rssi_jitter=3           +/- dB of uniform noise on every sample
+//   rssi=0:-50,30:-50,40:-90,60:off,90:-55
+//
+// rssi points are seconds since start and dBm, interpolated linearly;
+// "off" means out of range until the next point. The last value holds.
+// Without a duration (or --sim-duration) the run lasts until SIGINT or
+// SIGTERM; either way it ends with the simulator's stats and the cost
+// table, so a CI job needs no external timeout.
+class SimAdapter : public Adapter {
+public:
+    static const int ABSENT = -255;
+
+    struct Device {
+        std::string mac;
+        std::string name;
+        bdaddr_t addr;
+        bool is_ble = false;
+        int adv_interval_ms = 100;
+        int tx_power = ABSENT;   // no TX Power Level AD unless set
+        int connect_latency_ms = 300;
+        double connect_fail_rate = 0;
+        int page_timeout_ms = 5120;
+        int rssi_jitter = 0;
+        std::vector<std::pair<double, int>> rssi;
+
+        // Runtime state
+        int adv_timer = -1;
+        int handle = -1;
+        int peer_fd = -1;
+    };
+
+    explicit SimAdapter(EventLoop& loop);
+    ~SimAdapter();
+
+    bool load(const std::string& path);
+    const std::vector<Device>& get_devices() const;
+    // Seconds the script asks to run; 0 = until signalled
+    double get_duration() const;
+    void print_stats() const;
+
+    const char* name() const override;
+
+    int open_hci() override;
+    void close_hci() override;
+    int get_dev_id() const override;
+    int send_cmd(uint16_t ogf, uint16_t ocf, uint8_t plen, const void* param) override;
+    int get_conn_handle(const bdaddr_t& addr) override;
+
+    int connect_rfcomm(const bdaddr_t& addr, int channel, ConnectHandler handler) override;
+    void cancel_rfcomm(int id) override;
+
+private:
+    struct PendingConnect {
+        int timer;
+        int device;
+        int err;
+        ConnectHandler handler;
+    };
+
+    struct Stats {
+        unsigned long adverts = 0;
+        unsigned long rssi_reads = 0;
+        unsigned long connects = 0;
+        unsigned long connect_failures = 0;
+        unsigned long links_lost = 0;
+        unsigned long events_dropped = 0;
+    };
+
+    EventLoop& loop;
+    std::vector<Device> devices;
+    std::mt19937 rng;
+    double start_ms;
+    double duration_s;
+    int hci_fd;
+    int controller_fd;
+    bool scanning;
+    int supervision_timer;
+    int next_connect_id;
+    uint16_t next_handle;
+    std::unordered_map<int, PendingConnect> pending;
+    Stats stats;
+
+    int find_device(const bdaddr_t& addr) const;
+    int find_handle(int handle) const;
+    int rssi_now(int index);
+
+    void emit(uint8_t event, const void* params, uint8_t plen);
+    void cmd_complete(uint16_t opcode, const void* rp, uint8_t rplen);
+    void cmd_status(uint16_t opcode, uint8_t status);
+
+    void set_scanning(bool enable);
+    void advertise(int index);
+    void finish_connect(int id);
+    void on_peer_readable(int index, uint32_t events);
+    void drop_link(int index, uint8_t reason);
+    void supervise();
+};
+
+#endif // SIMADAPTER_HPP
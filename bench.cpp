@@ -0,0 +1,252 @@
+// Microbenchmarks for the code that runs on every advertisement or tick.
+// Built and run by `make bench`; no adapter is needed.
+
+#include "AdData.hpp"
+#include "BleScanner.hpp"
+#include "BlueProximity.hpp"
+#include "ConfigFile.hpp"
+#include "EventLoop.hpp"
+#include "HciDevice.hpp"
+#include "LockController.hpp"
+#include "Log.hpp"
+#include "ProximityEstimator.hpp"
+#include "RssiFilter.hpp"
+#include "SimAdapter.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Every heap allocation in the process goes through here
+static uint64_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    g_allocs++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+template <typename T>
+static inline void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// rate: ops per second the daemon sees in that scenario (0 = startup only);
+// load is the share of one core that rate costs at the measured speed.
+// mute runs the log writer into /dev/null unformatted while fn runs, so
+// the time is what queueing status lines costs the loop thread.
+template <typename Fn>
+static void run(const std::string& name, uint64_t ops, double rate, bool mute, Fn&& fn) {
+    if (mute) {
+        Log::set_blocking(true);
+        Log::start("/dev/null");
+    }
+
+    for (uint64_t i = 0; i < ops / 100 + 1; i++) fn(i); // warm up
+
+    uint64_t allocs = g_allocs;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ops; i++) fn(i);
+    auto end = std::chrono::steady_clock::now();
+    allocs = g_allocs - allocs;
+    if (mute) Log::stop();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / ops;
+    std::cout << std::left << std::setw(34) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(10) << ns
+              << std::setprecision(2) << std::setw(11) << (double)allocs / ops
+              << std::setprecision(0) << std::setw(14) << 1e9 / ns;
+    if (rate > 0) {
+        std::cout << std::setw(10) << rate << std::setprecision(4) << std::setw(10) << rate * ns / 1e7 << "%";
+    }
+    std::cout << std::endl;
+}
+
+// HCI LE Advertising Report with one report: Flags, a complete name and TX power
+static std::vector<unsigned char> make_adv_event(const bdaddr_t& addr, int rssi, const std::string& name) {
+    std::vector<unsigned char> ad = { 0x02, EIR_FLAGS, 0x06 };
+    ad.push_back((unsigned char)(name.size() + 1));
+    ad.push_back(EIR_NAME_COMPLETE);
+    ad.insert(ad.end(), name.begin(), name.end());
+    ad.insert(ad.end(), { 0x02, EIR_TX_POWER, (unsigned char)(int8_t)-8 });
+
+    std::vector<unsigned char> ev = { HCI_EVENT_PKT, EVT_LE_META_EVENT, 0,
+                                      EVT_LE_ADVERTISING_REPORT, 1, 0x00, 0x00 };
+    ev.insert(ev.end(), (const unsigned char*)&addr, (const unsigned char*)&addr + 6);
+    ev.push_back((unsigned char)ad.size());
+    ev.insert(ev.end(), ad.begin(), ad.end());
+    ev.push_back((unsigned char)(int8_t)rssi);
+    ev[2] = (unsigned char)(ev.size() - 1 - HCI_EVENT_HDR_SIZE);
+    return ev;
+}
+
+static bdaddr_t make_addr(int i) {
+    bdaddr_t addr;
+    for (int b = 0; b < 6; b++) addr.b[b] = (uint8_t)((i * 2654435761u) >> (b * 4)) ^ (uint8_t)b;
+    addr.b[5] = 0xC0 | (uint8_t)(i & 0x3F); // random static, so distinct per i
+    addr.b[4] = (uint8_t)(i >> 6);
+    return addr;
+}
+
+static BlueProximity::Config ble_config(const bdaddr_t& addr, int buffer_size) {
+    char mac[18];
+    ba2str(&addr, mac);
+    BlueProximity::Config cfg;
+    cfg.mac_address = mac;
+    cfg.is_ble = true;
+    cfg.buffer_size = buffer_size;
+    return cfg;
+}
+
+int main() {
+    EventLoop loop;
+    SimAdapter sim(loop); // never opened; nothing here touches a radio
+    HciDevice hci(loop, sim);
+
+    std::cout << std::left << std::setw(34) << "benchmark" << std::right
+              << std::setw(10) << "ns/op" << std::setw(11) << "allocs/op" << std::setw(14) << "ops/s"
+              << std::setw(10) << "rate/s" << std::setw(11) << "load" << std::endl;
+
+    // Advertising report walk. Realistic: a handful of our devices among ~30
+    // neighbours at 10 adverts/s. Crowded office: ~300 advertisers.
+    struct Scenario { const char* name; int monitored; int advertisers; double rate; };
+    const Scenario scenarios[] = {
+        { "adv_report/realistic (5 of 30)", 5, 30, 300 },
+        { "adv_report/crowded (5 of 300)", 5, 300, 3000 },
+        { "adv_report/crowded (50 of 300)", 50, 300, 3000 },
+    };
+    for (const auto& sc : scenarios) {
+        BleScanner scanner(hci);
+        std::vector<BlueProximity*> monitors;
+        std::vector<std::vector<unsigned char>> events;
+        for (int i = 0; i < sc.advertisers; i++) {
+            bdaddr_t addr = make_addr(i);
+            events.push_back(make_adv_event(addr, -40 - i % 50, "Device " + std::to_string(i)));
+            if (i < sc.monitored) {
+                monitors.push_back(new BlueProximity(ble_config(addr, 1), loop, hci));
+                scanner.add_monitor(monitors.back());
+            }
+        }
+        run(sc.name, 2000000, sc.rate, false, [&](uint64_t i) {
+            const auto& ev = events[i % events.size()];
+            scanner.on_hci_event(ev.data(), (int)ev.size());
+        });
+        for (auto* m : monitors) delete m;
+    }
+
+    // AD structure parsing as scan_ble does it for every report
+    {
+        std::vector<std::vector<unsigned char>> events;
+        for (int i = 0; i < 64; i++) {
+            events.push_back(make_adv_event(make_addr(i), -60, i % 2 ? "Galaxy Watch " + std::to_string(i) : "Pixel"));
+        }
+        run("parse_ad_data (name+tx)", 2000000, 3000, false, [&](uint64_t i) {
+            const auto& ev = events[i % events.size()];
+            const unsigned char* data = ev.data() + 1 + HCI_EVENT_HDR_SIZE + 2 + 8 + 1;
+            DeviceData dev;
+            dev.rssi = 0;
+            dev.has_tx_power = false;
+            parse_ad_data(data, ev[1 + HCI_EVENT_HDR_SIZE + 2 + 8], dev);
+            keep(dev);
+        });
+    }
+
+    // RSSI filtering and the per-tick update, one tick per monitor. Cost
+    // must not grow with the window.
+    {
+        std::vector<double> stream;
+        for (int i = 0; i < 1000; i++) stream.push_back(i % 9 == 0 ? RSSI_MISSING : -50.0 - (i * 7) % 30);
+        for (int window : { 10, 600 }) {
+            for (const char* spec : { "mean", "smooth", "robust", "hold:3,max" }) {
+                std::unique_ptr<RssiFilter> filter = make_rssi_filter(spec, window);
+                double out = 0;
+                run(std::string("RssiFilter ") + spec + " (window " + std::to_string(window) + ")", 5000000, 50, false, [&](uint64_t i) {
+                    out += filter->push(stream[i % stream.size()]);
+                });
+                keep(out);
+            }
+        }
+    }
+    for (int size : { 1, 10, 600 }) {
+        BlueProximity monitor(ble_config(make_addr(1), size), loop, hci);
+        run("update + status line (buffer " + std::to_string(size) + ")", 200000, 50, true, [&](uint64_t i) {
+            monitor.report_ble_rssi(-50 - (int)(i % 30), i + 1);
+            monitor.update();
+        });
+    }
+
+    // Lock/unlock decision over a stream that walks away and back
+    {
+        LockController::Config cfg;
+        cfg.lock_threshold = -80;
+        cfg.unlock_threshold = -60;
+        cfg.lock_duration = 6;
+        cfg.unlock_duration = 2;
+        LockController controller(cfg);
+        std::vector<double> stream;
+        for (int i = 0; i < 1000; i++) stream.push_back(i % 100 < 50 ? -55.0 : (i % 7 ? -90.0 : -255.0));
+        unsigned long transitions = 0;
+        run("LockController::update", 20000000, 1, false, [&](uint64_t i) {
+            transitions += controller.update(stream[i % stream.size()]) != LockController::NONE;
+        });
+        keep(transitions);
+    }
+
+    // Kalman estimator and the confidence query the tick makes per monitor
+    {
+        ProximityEstimator estimator{ ProximityEstimator::Config() };
+        std::vector<double> stream;
+        for (int i = 0; i < 1000; i++) stream.push_back(i % 100 < 50 ? -55.0 - i % 5 : (i % 7 ? -90.0 : -255.0));
+        double out = 0;
+        run("ProximityEstimator push + p_below", 5000000, 50, false, [&](uint64_t i) {
+            estimator.push(stream[i % stream.size()]);
+            out += estimator.p_below(-80);
+        });
+        keep(out);
+    }
+
+    // Config parsing at startup
+    for (int devices : { 3, 50 }) {
+        char path[] = "/tmp/bpbenchXXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        ConfigFile::GlobalConfig config = ConfigFile::load(path);
+        for (int i = 0; i < devices; i++) {
+            char mac[18];
+            bdaddr_t addr = make_addr(i);
+            ba2str(&addr, mac);
+            ConfigFile::DeviceConfig dc;
+            dc.mac = mac;
+            dc.name = "Device " + std::to_string(i);
+            dc.channel = 1;
+            dc.is_ble = i % 2;
+            config.devices.push_back(dc);
+        }
+        ConfigFile::save(path, config);
+
+        run("ConfigFile::load (" + std::to_string(devices) + " devices)", 20000, 0, false, [&](uint64_t) {
+            ConfigFile::GlobalConfig loaded = ConfigFile::load(path);
+            keep(loaded);
+        });
+        unlink(path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,11 @@
+// Prints a binary log written with --log-binary as text.
+#include "Log.hpp"
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <log file>" << std::endl;
+        return 1;
+    }
+    return Log::decode(argv[1]) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+// Drives LockObserver's D-Bus backend against a private dbus-daemon, with
+// a child process standing in for logind: it owns org.freedesktop.login1,
+// answers LockedHint reads for one session and announces changes with
+// PropertiesChanged when told to. Built and run by `make lockcheck`; needs
+// dbus-daemon but no system bus, logind session or root.
+
+#include "Clock.hpp"
+#include "EventLoop.hpp"
+#include "LockObserver.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+static const char* SESSION_ID = "c1";
+static const char* SESSION_PATH = "/org/freedesktop/login1/session/c1";
+static const char* SESSION_IFACE = "org.freedesktop.login1.Session";
+static const int CHANGES = 200;
+static const int CHANGE_TIMEOUT_MS = 2000;
+
+// dbus-daemon --print-address; the daemon's pid in *pid, or "" on failure
+static std::string start_bus(pid_t* pid) {
+    int fds[2];
+    if (pipe(fds) < 0) return "";
+    *pid = fork();
+    if (*pid == 0) {
+        close(fds[0]);
+        std::string print = "--print-address=" + std::to_string(fds[1]);
+        execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork", "--nopidfile", print.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    close(fds[1]);
+    std::string address;
+    char c;
+    while (*pid > 0 && read(fds[0], &c, 1) == 1 && c != '\n') address += c;
+    close(fds[0]);
+    return address;
+}
+
+static sd_bus* connect_bus(const std::string& address) {
+    sd_bus* bus = nullptr;
+    int r = sd_bus_new(&bus);
+    if (r >= 0) r = sd_bus_set_address(bus, address.c_str());
+    if (r >= 0) r = sd_bus_set_bus_client(bus, 1);
+    if (r >= 0) r = sd_bus_start(bus);
+    if (r < 0) {
+        if (bus) sd_bus_unref(bus);
+        return nullptr;
+    }
+    return bus;
+}
+
+// --- the logind stand-in ---
+
+static int on_session_call(sd_bus_message* m, void* userdata, sd_bus_error*) {
+    if (!sd_bus_message_is_method_call(m, "org.freedesktop.DBus.Properties", "Get")) return 0;
+    const char* iface = nullptr;
+    const char* prop = nullptr;
+    if (sd_bus_message_read(m, "ss", &iface, &prop) < 0 || strcmp(prop, "LockedHint") != 0) return 0;
+    return sd_bus_reply_method_return(m, "v", "b", *(int*)userdata);
+}
+
+// Owns the name, then reads '0'/'1' from cmd_fd and announces each as the
+// new LockedHint until cmd_fd closes. One byte on ready_fd once named.
+static int run_logind(const std::string& address, int cmd_fd, int ready_fd) {
+    sd_bus* bus = connect_bus(address);
+    int hint = 0;
+    if (!bus || sd_bus_add_object(bus, nullptr, SESSION_PATH, on_session_call, &hint) < 0 ||
+        sd_bus_request_name(bus, "org.freedesktop.login1", 0) < 0) {
+        return 1;
+    }
+    if (write(ready_fd, "r", 1) != 1) return 1;
+    close(ready_fd);
+
+    while (true) {
+        // sd-bus may already hold messages read along with earlier ones
+        int r;
+        while ((r = sd_bus_process(bus, nullptr)) > 0) {
+        }
+        if (r < 0) break;
+
+        struct pollfd p[2] = { { cmd_fd, POLLIN, 0 }, { sd_bus_get_fd(bus), (short)sd_bus_get_events(bus), 0 } };
+        if (poll(p, 2, -1) < 0 && errno != EINTR) break;
+        if (p[0].revents) {
+            char c;
+            if (read(cmd_fd, &c, 1) != 1) break;
+            hint = c == '1';
+            sd_bus_emit_signal(bus, SESSION_PATH, "org.freedesktop.DBus.Properties", "PropertiesChanged", "sa{sv}as",
+                               SESSION_IFACE, 1, "LockedHint", "b", hint, 0);
+            sd_bus_flush(bus);
+        }
+    }
+    sd_bus_flush_close_unref(bus);
+    return 0;
+}
+
+int main() {
+    pid_t bus_pid = -1;
+    std::string address = start_bus(&bus_pid);
+    if (address.empty()) {
+        fprintf(stderr, "Error: Could not start dbus-daemon\n");
+        return 1;
+    }
+    printf("Private bus: %s\n", address.c_str());
+    fflush(stdout);
+
+    int cmd[2], ready[2];
+    if (pipe(cmd) < 0 || pipe(ready) < 0) {
+        Log::errno_error("pipe");
+        kill(bus_pid, SIGTERM);
+        return 1;
+    }
+    pid_t logind_pid = fork();
+    if (logind_pid == 0) {
+        close(cmd[1]);
+        close(ready[0]);
+        _exit(run_logind(address, cmd[0], ready[1]));
+    }
+    close(cmd[0]);
+    close(ready[1]);
+
+    int failures = 0;
+    char c;
+    if (read(ready[0], &c, 1) != 1) {
+        fprintf(stderr, "Error: logind stand-in did not come up\n");
+        failures++;
+    }
+    close(ready[0]);
+
+    EventLoop loop;
+    LockObserver observer(loop);
+    observer.add_backend(std::unique_ptr<LockObserver::Backend>(new LogindDbusBackend(address)));
+
+    int reports = 0;
+    bool locked = false;
+    double sent_at = -1;
+    std::vector<double> latencies;
+    bool started = !failures && observer.start(SESSION_ID, [&](bool now_locked) {
+        reports++;
+        locked = now_locked;
+        if (sent_at >= 0) latencies.push_back(monotonic_ms() - sent_at);
+        sent_at = -1;
+    });
+    if (!started) {
+        fprintf(stderr, "Error: Observer did not start on the private bus\n");
+        failures++;
+    } else if (reports != 1 || locked) {
+        fprintf(stderr, "Error: Expected one initial unlocked report, got %d (%s)\n", reports, locked ? "locked" : "unlocked");
+        failures++;
+    }
+
+    for (int i = 0; started && i < CHANGES; i++) {
+        bool want = i % 2 == 0;
+        int before = reports;
+        sent_at = monotonic_ms();
+        if (write(cmd[1], want ? "1" : "0", 1) != 1) {
+            Log::errno_error("write");
+            failures++;
+            break;
+        }
+        double deadline = sent_at + CHANGE_TIMEOUT_MS;
+        while (reports == before && monotonic_ms() < deadline) loop.run_once(10);
+        if (reports == before || locked != want) {
+            fprintf(stderr, "Error: Change %d (%s) %s\n", i, want ? "lock" : "unlock",
+                    reports == before ? "never arrived" : "arrived with the wrong state");
+            failures++;
+            break;
+        }
+    }
+    observer.stop();
+
+    close(cmd[1]);
+    waitpid(logind_pid, nullptr, 0);
+    kill(bus_pid, SIGTERM);
+    waitpid(bus_pid, nullptr, 0);
+
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        printf("%zu lock changes observed; latency min %.3fms, median %.3fms, p99 %.3fms, max %.3fms\n",
+               latencies.size(), latencies.front(), latencies[latencies.size() / 2],
+               latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)], latencies.back());
+    }
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
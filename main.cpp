@@ -1,5 +1,21 @@
 #include "BlueProximity.hpp"
 #include "ConfigFile.hpp"
+#include "BleScanner.hpp"
+#include "EventLoop.hpp"
+#include "HciDevice.hpp"
+#include "BluezAdapter.hpp"
+#include "SimAdapter.hpp"
+#include "Clock.hpp"
+#include "CommandExecutor.hpp"
+#include "LockObserver.hpp"
+#include "LockController.hpp"
+#include "BtSnoop.hpp"
+#include "MetricsServer.hpp"
+#include "ControlServer.hpp"
+#include "ConfigWatcher.hpp"
+#include "Log.hpp"
+#include "SessionProbe.hpp"
+#include "DeviceCache.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -10,8 +26,14 @@
 #include <iomanip>
 #include <sys/wait.h>
 #include <ctime>
-#include <array>
 #include <sstream>
+#include <csignal>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 std::string get_config_path() {
     const char* home = getenv( "HOME" );
@@ -22,71 +44,35 @@ std::string get_config_path() {
     return std::string( home ) + "/.blueproximity/config";
 }
 
-std::string exec_command_output( const char* cmd ) {
-    std::array<char, 128> buffer;
-    std::string result;
-    FILE* pipe = popen( cmd, "r" );
-    if ( !pipe ) return "";
-    
-    while ( fgets( buffer.data(), buffer.size(), pipe ) != nullptr ) {
-        result += buffer.data();
-    }
-    pclose( pipe );
-    
-    // Trim trailing newline/whitespace
-    while ( !result.empty() && ( result.back() == '\n' || result.back() == '\r' || result.back() == ' ' ) ) {
-        result.pop_back();
-    }
-    return result;
-}
-
 struct SessionInfo {
     std::string username;
     std::string session_id;
     bool valid;
 };
 
-SessionInfo get_session_info() {
+SessionInfo get_session_info( const SessionProbe& probe ) {
     SessionInfo info;
     info.valid = false;
     
-    // Get username
-    const char* user = getenv( "USER" );
-    if ( !user ) {
-        struct passwd* pw = getpwuid( getuid() );
-        if ( pw ) user = pw->pw_name;
-    }
-    if ( !user ) {
-        std::cerr << "Warning: Could not determine username" << std::endl;
+    if ( probe.user.empty() ) {
+        Log::warn( "Warning: Could not determine username" );
         return info;
     }
-    info.username = user;
-    
-    // Get session ID
-    std::string cmd = "loginctl list-sessions --no-legend | grep " + info.username + " | awk '{print $1}' | head -n1";
-    info.session_id = exec_command_output( cmd.c_str() );
+    info.username = probe.user;
+    info.session_id = probe.session_id;
     
     if ( info.session_id.empty() ) {
-        std::cerr << "Warning: Could not determine session ID for user " << info.username << std::endl;
+        Log::warn( "Warning: Could not determine session ID for user %s", info.username );
         return info;
     }
     
     info.valid = true;
-    std::cout << "[ SYSTEM ] Session info cached: user=" << info.username 
-              << " session=" << info.session_id << std::endl;
+    Log::info( "[ SYSTEM ] Session info cached: user=%s session=%s", info.username, info.session_id );
     return info;
 }
 
-bool is_desktop_locked( const SessionInfo& session ) {
-    if ( !session.valid ) return false; // Assume unlocked if we can't check
-    
-    std::string cmd = "loginctl show-session " + session.session_id + " -p LockedHint";
-    std::string result = exec_command_output( cmd.c_str() );
-    
-    return ( result.find( "LockedHint=yes" ) != std::string::npos );
-}
-
-std::string detect_desktop_environment() {
+// Empty when the environment does not say; the running shell decides then
+std::string desktop_from_environment() {
     // Check XDG_CURRENT_DESKTOP first
     const char* xdg_desktop = getenv( "XDG_CURRENT_DESKTOP" );
     if ( xdg_desktop ) {
@@ -112,37 +98,23 @@ std::string detect_desktop_environment() {
         if ( sess.find( "cosmic" ) != std::string::npos ) return "cosmic";
     }
     
-    // Check for running processes
-    std::string gnome_check = exec_command_output( "pgrep -x gnome-shell > /dev/null 2>&1 && echo gnome" );
-    if ( !gnome_check.empty() ) return "gnome";
-    
-    std::string kde_check = exec_command_output( "pgrep -x plasmashell > /dev/null 2>&1 && echo kde" );
-    if ( !kde_check.empty() ) return "kde";
-    
-    std::string cosmic_check = exec_command_output( "pgrep -x cosmic-comp > /dev/null 2>&1 && echo cosmic" );
-    if ( !cosmic_check.empty() ) return "cosmic";
-    
-    return "unknown";
+    return "";
 }
 
-void setup_desktop_commands( ConfigFile::GlobalConfig& config ) {
+void setup_desktop_commands( ConfigFile::GlobalConfig& config, const SessionProbe& probe ) {
     // Detect and cache DISPLAY if not already set
     if ( config.display.empty() ) {
         const char* display_env = getenv( "DISPLAY" );
         if ( display_env ) {
             config.display = display_env;
-            std::cout << "[ SYSTEM ] Detected DISPLAY: " << config.display << std::endl;
+            Log::info( "[ SYSTEM ] Detected DISPLAY: %s", config.display );
         } else {
-            // Try to detect from active sessions
-            std::string detected_display = exec_command_output( "w -h | grep -m1 tty | awk '{print $3}'" );
-            if ( detected_display.empty() || detected_display == "-" ) {
-                detected_display = ":0"; // Default fallback
-            }
-            config.display = detected_display;
-            std::cout << "[ SYSTEM ] DISPLAY not set, using detected/default: " << config.display << std::endl;
+            // The session's own display, else the first local X server
+            config.display = probe.display.empty() ? ":0" : probe.display;
+            Log::info( "[ SYSTEM ] DISPLAY not set, using detected/default: %s", config.display );
         }
     } else {
-        std::cout << "[ SYSTEM ] Using configured DISPLAY: " << config.display << std::endl;
+        Log::info( "[ SYSTEM ] Using configured DISPLAY: %s", config.display );
     }
     
     // Detect and cache XAUTHORITY if not already set
@@ -150,7 +122,10 @@ void setup_desktop_commands( ConfigFile::GlobalConfig& config ) {
         const char* xauth_env = getenv( "XAUTHORITY" );
         if ( xauth_env ) {
             config.xauthority = xauth_env;
-            std::cout << "[ SYSTEM ] Detected XAUTHORITY: " << config.xauthority << std::endl;
+            Log::info( "[ SYSTEM ] Detected XAUTHORITY: %s", config.xauthority );
+        } else if ( !probe.xauthority.empty() ) {
+            config.xauthority = probe.xauthority;
+            Log::info( "[ SYSTEM ] XAUTHORITY not set, using the display manager's: %s", config.xauthority );
         } else {
             // Default to ~/.Xauthority
             const char* home = getenv( "HOME" );
@@ -160,19 +135,20 @@ void setup_desktop_commands( ConfigFile::GlobalConfig& config ) {
             }
             if ( home ) {
                 config.xauthority = std::string( home ) + "/.Xauthority";
-                std::cout << "[ SYSTEM ] XAUTHORITY not set, using default: " << config.xauthority << std::endl;
+                Log::info( "[ SYSTEM ] XAUTHORITY not set, using default: %s", config.xauthority );
             }
         }
     } else {
-        std::cout << "[ SYSTEM ] Using configured XAUTHORITY: " << config.xauthority << std::endl;
+        Log::info( "[ SYSTEM ] Using configured XAUTHORITY: %s", config.xauthority );
     }
     
     // Only detect if not already set
     if ( config.desktop_environment.empty() ) {
-        config.desktop_environment = detect_desktop_environment();
-        std::cout << "[ SYSTEM ] Detected desktop environment: " << config.desktop_environment << std::endl;
+        config.desktop_environment = desktop_from_environment();
+        if ( config.desktop_environment.empty() ) config.desktop_environment = probe.desktop.empty() ? "unknown" : probe.desktop;
+        Log::info( "[ SYSTEM ] Detected desktop environment: %s", config.desktop_environment );
     } else {
-        std::cout << "[ SYSTEM ] Using configured desktop environment: " << config.desktop_environment << std::endl;
+        Log::info( "[ SYSTEM ] Using configured desktop environment: %s", config.desktop_environment );
     }
     
     // Set default commands if not already set
@@ -198,6 +174,77 @@ void setup_desktop_commands( ConfigFile::GlobalConfig& config ) {
     }
 }
 
+// "AA:BB:CC:DD:EE:FF"
+static bool is_mac_address( const std::string& s ) {
+    if ( s.size() != 17 ) return false;
+    for ( size_t i = 0; i < s.size(); i++ ) {
+        if ( i % 3 == 2 ? s[i] != ':' : !isxdigit( (unsigned char)s[i] ) ) return false;
+    }
+    return true;
+}
+
+// The per-device defaults the config file's globals stand for
+static void set_monitor_defaults( BlueProximity::Config& cfg, const ConfigFile::GlobalConfig& config ) {
+    cfg.lock_distance = config.lock_distance;
+    cfg.unlock_distance = config.unlock_distance;
+    cfg.lock_duration = config.lock_duration;
+    cfg.unlock_duration = config.unlock_duration;
+    cfg.lock_command = config.lock_cmd;
+    cfg.unlock_command = config.unlock_cmd;
+    cfg.proximity_command = config.prox_cmd;
+    cfg.proximity_interval = config.prox_interval;
+    cfg.buffer_size = config.buffer_size;
+    cfg.sample_min = config.sample_min;
+    cfg.sample_max = config.sample_max;
+    cfg.filter = config.rssi_filter;
+    cfg.connect_timeout_ms = config.connect_timeout_ms;
+    cfg.reconnect_max_ms = config.reconnect_max_ms;
+    cfg.estimator.ref_rssi = config.ref_rssi;
+    cfg.estimator.path_loss_exponent = config.path_loss_exponent;
+    cfg.debug = config.debug;
+}
+
+static BlueProximity::Config make_device_config( const BlueProximity::Config& base, const ConfigFile::DeviceConfig& dev ) {
+    BlueProximity::Config cfg = base;
+    cfg.mac_address = dev.mac;
+    cfg.name = dev.name;
+    cfg.is_ble = dev.is_ble;
+    cfg.channel = dev.channel;
+    if ( !dev.filter.empty() ) cfg.filter = dev.filter;
+    return cfg;
+}
+
+// An inquiry's results into the device cache
+static void cache_scanned( DeviceCache& cache, const std::vector<DeviceInfo>& scanned ) {
+    for ( const auto& dev : scanned ) {
+        DeviceCache::Entry entry;
+        if ( str2ba( dev.mac.c_str(), &entry.addr ) < 0 ) continue;
+        if ( dev.name != "[unknown]" ) entry.name = dev.name;
+        entry.classic = true;
+        entry.dev_class = dev.dev_class;
+        cache.update( entry );
+    }
+}
+
+// "3m ago", "2h ago", "5d ago"
+static std::string seen_ago( time_t when ) {
+    long secs = (long)( time( nullptr ) - when );
+    if ( secs < 60 ) return "just now";
+    if ( secs < 3600 ) return std::to_string( secs / 60 ) + "m ago";
+    if ( secs < 86400 ) return std::to_string( secs / 3600 ) + "h ago";
+    return std::to_string( secs / 86400 ) + "d ago";
+}
+
+// Whether a running monitor can be kept as is. Thresholds are left out:
+// they are pushed to running monitors with set_distances().
+static bool same_monitor_settings( const BlueProximity::Config& a, const BlueProximity::Config& b ) {
+    return a.name == b.name && a.is_ble == b.is_ble && a.channel == b.channel && a.filter == b.filter
+        && a.buffer_size == b.buffer_size && a.sample_min == b.sample_min && a.sample_max == b.sample_max
+        && a.connect_timeout_ms == b.connect_timeout_ms && a.reconnect_max_ms == b.reconnect_max_ms
+        && a.estimate == b.estimate && a.estimator.ref_rssi == b.estimator.ref_rssi
+        && a.estimator.path_loss_exponent == b.estimator.path_loss_exponent && a.debug == b.debug;
+}
+
 void print_help(const char* prog_name) {
     std::cout << "Usage: " << prog_name << " [options]\n"
               << "Options:\n"
@@ -213,58 +260,44 @@ void print_help(const char* prog_name) {
               << "  --prox-cmd <command>         Command to run when in proximity\n"
               << "  --prox-interval <secs>       Interval for proximity command (default: 60)\n"
               << "  --buffer-size <size>         RSSI buffer size (default: 1)\n"
+              << "  --sample-min <secs>          Shortest interval between samples, near a threshold (default: 1)\n"
+              << "  --sample-max <secs>          Longest interval, when stable and far from both (default: 4)\n"
+              << "  --filter <spec>              RSSI filter: mean, smooth, robust or a stage list (default: mean)\n"
+              << "  --lock-mode <mode>           count: lock after lock-duration ticks past lock-distance (default)\n"
+              << "                               confidence: lock once the estimator is sure the devices left\n"
+              << "  --lock-confidence <p>        Probability of departure that locks in confidence mode (default: 0.95)\n"
+              << "  --connect-timeout <ms>       Give up on an RFCOMM connect after this (default: 5000)\n"
+              << "  --reconnect-max <ms>         Longest backoff between reconnects (default: 15000)\n"
+              << "  --record <file>              Record consumed HCI traffic to a btsnoop file\n"
+              << "  --replay <file>              Run a recorded btsnoop file through the decision logic\n"
+              << "  --simulate <script>          Use a simulated adapter driven by a device script\n"
+              << "  --sim-duration <secs>        End the simulation after this long (overrides the script's duration)\n"
+              << "  --metrics <address>          Serve OpenMetrics on unix:<path> or a loopback [host:]port\n"
+              << "  --control <path>             Accept runtime commands on a Unix socket (list, add, remove, set, ...)\n"
+              << "  --log-level <level>          error, warn, info (default) or debug\n"
+              << "  --log-binary <file>          Write the log unformatted to a file; read it with bplog\n"
               << "  -d, --debug                  Enable debug output (AT commands)\n"
               << "  -h, --help                   Show this help message\n";
 }
 
-void execute_command( const std::string& cmd, const std::string& display = "", const std::string& xauthority = "" ) {
-    if ( cmd.empty() ) return;
-    std::cout << "[ SYSTEM ] Executing: " << cmd << std::endl;
-    
-    std::string full_cmd = cmd;
-    if ( !display.empty() ) {
-        full_cmd = "DISPLAY=" + display + " ";
-        if ( !xauthority.empty() ) {
-            full_cmd += "XAUTHORITY=" + xauthority + " ";
-        }
-        full_cmd += cmd;
-    }
-    
-    std::string bg_cmd = full_cmd + " &";
-    int ret = system( bg_cmd.c_str() );
-    if ( ret == -1 ) {
-        std::cerr << "Error: system() call failed (fork failure)" << std::endl;
-    } else {
-        if ( WIFEXITED( ret ) ) {
-            int exit_status = WEXITSTATUS( ret );
-            if ( exit_status != 0 ) {
-                std::cerr << "Warning: Command launch shell returned non-zero: " << exit_status << std::endl;
-            }
-        }
-    }
-}
-
 int main(int argc, char* argv[]) {
+    double main_started = monotonic_ms();
     std::string config_path = get_config_path();
     ConfigFile::GlobalConfig config = ConfigFile::load(config_path);
     
+    // Session, display and running shell in one pass over /proc and /run;
+    // the shell is only looked for when nothing else names the desktop
+    bool want_desktop = config.desktop_environment.empty() && desktop_from_environment().empty();
+    SessionProbe probe = SessionProbe::run( want_desktop );
+
     // Setup desktop environment and default commands
-    setup_desktop_commands( config );
+    setup_desktop_commands( config, probe );
     
     bool config_changed = false;
     std::vector<BlueProximity::Config> cmd_devices;
 
     BlueProximity::Config base_config;
-    base_config.lock_distance = config.lock_distance;
-    base_config.unlock_distance = config.unlock_distance;
-    base_config.lock_duration = config.lock_duration;
-    base_config.unlock_duration = config.unlock_duration;
-    base_config.lock_command = config.lock_cmd;
-    base_config.unlock_command = config.unlock_cmd;
-    base_config.proximity_command = config.prox_cmd;
-    base_config.proximity_interval = config.prox_interval;
-    base_config.buffer_size = config.buffer_size;
-    base_config.debug = config.debug;
+    set_monitor_defaults( base_config, config );
 
     static struct option long_options[] = {
         {"mac",             required_argument, 0, 'm'},
@@ -280,17 +313,37 @@ int main(int argc, char* argv[]) {
         {"prox-cmd",        required_argument, 0, '3'},
         {"prox-interval",   required_argument, 0, 'i'},
         {"buffer-size",     required_argument, 0, 'b'},
+        {"sample-min",      required_argument, 0, 'N'},
+        {"sample-max",      required_argument, 0, 'X'},
+        {"filter",          required_argument, 0, 'F'},
+        {"lock-mode",       required_argument, 0, 'K'},
+        {"lock-confidence", required_argument, 0, 'Q'},
+        {"connect-timeout", required_argument, 0, 'T'},
+        {"reconnect-max",   required_argument, 0, 'R'},
+        {"record",          required_argument, 0, 'W'},
+        {"replay",          required_argument, 0, 'P'},
+        {"simulate",        required_argument, 0, 'S'},
+        {"sim-duration",    required_argument, 0, 'Y'},
+        {"metrics",         required_argument, 0, 'E'},
+        {"control",         required_argument, 0, 'O'},
+        {"log-level",       required_argument, 0, 'G'},
+        {"log-binary",      required_argument, 0, 'B'},
         {"debug",           no_argument,       0, 'd'},
         {"help",            no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
+    std::string record_path;
+    std::string replay_path;
+    std::string sim_path;
+    double sim_duration = -1;   // -1 = the script's
+
     int opt;
     int long_index = 0;
     while ((opt = getopt_long(argc, argv, "m:M:c:h:d", long_options, &long_index)) != -1) {
         switch (opt) {
             case 'm': {
-                std::cout << "Adding Classic Device (CLI): " << optarg << std::endl;
+                Log::info( "Adding Classic Device (CLI): %s", optarg );
                 BlueProximity::Config cfg = base_config;
                 cfg.mac_address = optarg;
                 cfg.is_ble = false;
@@ -299,7 +352,7 @@ int main(int argc, char* argv[]) {
                 break;
             }
             case 'M': {
-                std::cout << "Adding BLE Device (CLI): " << optarg << std::endl;
+                Log::info( "Adding BLE Device (CLI): %s", optarg );
                 BlueProximity::Config cfg = base_config;
                 cfg.mac_address = optarg;
                 cfg.is_ble = true;
@@ -317,12 +370,98 @@ int main(int argc, char* argv[]) {
             case '3': base_config.proximity_command = config.prox_cmd = optarg; config_changed = true; break;
             case 'i': base_config.proximity_interval = config.prox_interval = std::atoi(optarg); config_changed = true; break;
             case 'b': base_config.buffer_size = config.buffer_size = std::atoi(optarg); config_changed = true; break;
+            case 'N': base_config.sample_min = config.sample_min = std::atoi(optarg); config_changed = true; break;
+            case 'X': base_config.sample_max = config.sample_max = std::atoi(optarg); config_changed = true; break;
+            case 'F': base_config.filter = config.rssi_filter = optarg; config_changed = true; break;
+            case 'K': config.lock_mode = optarg; config_changed = true; break;
+            case 'Q': config.lock_confidence = std::atof(optarg); config_changed = true; break;
+            case 'T': base_config.connect_timeout_ms = config.connect_timeout_ms = std::atoi(optarg); config_changed = true; break;
+            case 'R': base_config.reconnect_max_ms = config.reconnect_max_ms = std::atoi(optarg); config_changed = true; break;
+            case 'W': record_path = optarg; break;
+            case 'P': replay_path = optarg; break;
+            case 'S': sim_path = optarg; break;
+            case 'Y': sim_duration = std::atof(optarg); break;
+            case 'E': config.metrics = optarg; config_changed = true; break;
+            case 'O': config.control = optarg; config_changed = true; break;
+            case 'G': config.log_level = optarg; config_changed = true; break;
+            case 'B': config.log_binary = optarg; config_changed = true; break;
             case 'd': base_config.debug = config.debug = true; config_changed = true; break;
             case 'h': print_help(argv[0]); return 0;
             default: print_help(argv[0]); return 1;
         }
     }
     
+    bool replaying = !replay_path.empty();
+    bool simulating = !sim_path.empty();
+    if ( replaying && simulating ) {
+        Log::error( "Error: --replay and --simulate cannot be combined." );
+        return 1;
+    }
+    if ( sim_duration >= 0 && !simulating ) {
+        Log::error( "Error: --sim-duration needs --simulate." );
+        return 1;
+    }
+    if ( config.lock_mode != "count" && config.lock_mode != "confidence" ) {
+        Log::error( "Error: --lock-mode must be count or confidence." );
+        return 1;
+    }
+    if ( config.lock_confidence <= 0.5 || config.lock_confidence >= 1 ) {
+        Log::error( "Error: --lock-confidence must be between 0.5 and 1." );
+        return 1;
+    }
+    Log::Level log_level;
+    if ( !Log::parse_level( config.log_level, log_level ) ) {
+        Log::error( "Error: --log-level must be error, warn, info or debug." );
+        return 1;
+    }
+    if ( config.debug ) log_level = Log::DEBUG;
+    if ( log_level == Log::DEBUG ) base_config.debug = true;
+    Log::set_level( log_level );
+    bool confidence_mode = config.lock_mode == "confidence";
+    base_config.estimate = confidence_mode;
+
+    // Without a real radio nothing is executed or saved
+    bool dry_run = replaying || simulating;
+
+    // Every monitor, the LE scan and the tick timer share one event loop
+    EventLoop loop;
+    BluezAdapter bluez( loop );
+    SimAdapter sim( loop );
+    if ( simulating && !sim.load( sim_path ) ) return 1;
+    Adapter& adapter = simulating ? static_cast<Adapter&>( sim ) : static_cast<Adapter&>( bluez );
+
+    HciDevice hci( loop, adapter );
+    hci.set_replay( replaying );
+
+    BtSnoopWriter recorder;
+    if ( !record_path.empty() && !replaying ) {
+        if ( !recorder.open( record_path ) ) return 1;
+        hci.set_recorder( &recorder );
+        Log::info( "[ SYSTEM ] Recording HCI traffic to %s", record_path );
+    }
+
+    if ( !hci.open() ) {
+        Log::warn( "Warning: Failed to open HCI device, will keep retrying" );
+    }
+
+    // Reject a bad filter spec up front rather than per monitor
+    std::vector<std::string> filter_specs( 1, base_config.filter );
+    for ( const auto& dev : config.devices ) filter_specs.push_back( dev.filter );
+    for ( const auto& spec : filter_specs ) {
+        std::string error;
+        if ( !make_rssi_filter( spec, 1, &error ) ) {
+            Log::error( "Error: Invalid RSSI filter '%s': %s", spec, error );
+            return 1;
+        }
+    }
+
+    // Devices seen before, shared with the scan tools; scripted and traced
+    // devices are kept out of it
+    DeviceCache device_cache;
+    if ( !simulating && !replaying && !device_cache.open( DeviceCache::default_path() ) ) {
+        Log::warn( "Warning: Cannot open device cache %s", DeviceCache::default_path() );
+    }
+
     std::vector<BlueProximity*> monitors;
     size_t max_name_len = 0;
     auto update_len = [&](const std::string& name, const std::string& mac) {
@@ -331,25 +470,101 @@ int main(int argc, char* argv[]) {
     };
 
     if (cmd_devices.empty()) {
+        if (config.devices.empty() && simulating) {
+            // Follow every scripted device unless told otherwise
+            for (const auto& dev : sim.get_devices()) {
+                ConfigFile::DeviceConfig dc;
+                dc.mac = dev.mac;
+                dc.name = dev.name;
+                dc.is_ble = dev.is_ble;
+                dc.channel = 1;
+                config.devices.push_back(dc);
+            }
+        }
+        if (config.devices.empty() && replaying) {
+            Log::error( "Error: Replay needs the devices to follow (config or --mac/--blemac)." );
+            return 1;
+        }
         if (config.devices.empty()) {
-            std::cout << "No devices configured. Scanning..." << std::endl;
-            auto scanned = BlueProximity::scan_devices();
-            if (scanned.empty()) {
-                std::cerr << "No devices found during scan." << std::endl;
+            // Devices seen before are offered at once while an inquiry
+            // refreshes the cache; with nothing cached, wait for it. The
+            // scan gets its own mapping so its flock() excludes ours, and
+            // shares only what it found. Once a device is picked the scan
+            // is stopped, so it does not compete with the first connect.
+            std::vector<DeviceCache::Entry> candidates = device_cache.entries();
+            std::string cache_path = device_cache.is_open() ? DeviceCache::default_path() : "";
+            auto found = std::make_shared<std::vector<DeviceInfo>>();
+            auto scan_error = std::make_shared<std::string>();
+            auto stop_scan = std::make_shared<std::atomic<bool>>( false );
+            std::thread scan( [cache_path, found, scan_error, stop_scan]() {
+                *found = BlueProximity::scan_devices( scan_error.get(), stop_scan.get() );
+                DeviceCache cache;
+                if ( !cache_path.empty() && cache.open( cache_path ) ) cache_scanned( cache, *found );
+            } );
+            auto finish_scan = [&]() {
+                scan.join();
+                if ( !scan_error->empty() ) Log::error( "%s", *scan_error );
+                candidates = device_cache.entries();
+                // Without a cache, the scan is all there is
+                if ( !device_cache.is_open() ) {
+                    for ( const auto& dev : *found ) {
+                        DeviceCache::Entry entry;
+                        str2ba( dev.mac.c_str(), &entry.addr );
+                        if ( dev.name != "[unknown]" ) entry.name = dev.name;
+                        entry.classic = true;
+                        entry.last_seen = time( nullptr );
+                        candidates.push_back( entry );
+                    }
+                }
+            };
+            if ( candidates.empty() ) {
+                Log::info( "No devices configured. Scanning..." );
+                finish_scan();
+            } else {
+                Log::info( "No devices configured. Listing devices seen before; scanning meanwhile..." );
+            }
+
+            int choice = 0;
+            while ( !candidates.empty() ) {
+                std::cout << ( scan.joinable() ? "Devices seen before:\n" : "Found devices:\n" );
+                for ( size_t i = 0; i < candidates.size(); ++i ) {
+                    const auto& entry = candidates[i];
+                    char mac[18];
+                    ba2str( &entry.addr, mac );
+                    std::cout << i + 1 << ". " << ( entry.name.empty() ? "[unknown]" : entry.name ) << " (" << mac << ")"
+                              << ( entry.ble && !entry.classic ? " BLE" : "" ) << ", seen " << seen_ago( entry.last_seen ) << "\n";
+                }
+                std::cout << "Enter number for Primary device (0 to skip"
+                          << ( scan.joinable() ? ", s to wait for the scan" : "" ) << "): " << std::flush;
+                std::string answer;
+                if ( !( std::cin >> answer ) ) break;
+                if ( answer == "s" && scan.joinable() ) {
+                    finish_scan();
+                    continue;
+                }
+                choice = std::atoi( answer.c_str() );
+                break;
+            }
+            if ( candidates.empty() ) {
+                Log::error( "No devices found during scan." );
                 return 1;
             }
-            std::cout << "Found devices:\n";
-            for (size_t i = 0; i < scanned.size(); ++i) {
-                std::cout << i + 1 << ". " << scanned[i].name << " (" << scanned[i].mac << ")\n";
+            // Still running: cancel the inquiry and name requests, keeping
+            // what was heard so far
+            if ( scan.joinable() ) {
+                *stop_scan = true;
+                scan.join();
             }
-            std::cout << "Enter number for Primary device (0 to skip): ";
-            int choice;
-            if (std::cin >> choice && choice > 0 && choice <= (int)scanned.size()) {
+
+            if ( choice > 0 && choice <= (int)candidates.size() ) {
+                const auto& entry = candidates[choice - 1];
+                char mac[18];
+                ba2str( &entry.addr, mac );
                 ConfigFile::DeviceConfig dc;
-                dc.mac = scanned[choice-1].mac;
-                dc.name = scanned[choice-1].name;
-                dc.is_ble = false; 
-                dc.channel = 1; 
+                dc.mac = mac;
+                dc.name = entry.name;
+                dc.is_ble = entry.ble && !entry.classic;
+                dc.channel = entry.channel ? entry.channel : 1;
                 config.devices.push_back(dc);
                 config_changed = true;
             }
@@ -358,14 +573,10 @@ int main(int argc, char* argv[]) {
             update_len(dev.name, dev.mac);
         }
         for (const auto& dev : config.devices) {
-            std::cout << "Loading Device (Config): " << (dev.name.empty() ? dev.mac : dev.name) << " (" << dev.mac << ")" << std::endl;
-            BlueProximity::Config cfg = base_config;
-            cfg.mac_address = dev.mac;
-            cfg.name = dev.name;
-            cfg.is_ble = dev.is_ble;
-            cfg.channel = dev.channel;
+            Log::info( "Loading Device (Config): %s (%s)", dev.name.empty() ? dev.mac : dev.name, dev.mac );
+            BlueProximity::Config cfg = make_device_config(base_config, dev);
             cfg.name_padding = max_name_len;
-            monitors.push_back(new BlueProximity(cfg));
+            monitors.push_back(new BlueProximity(cfg, loop, hci));
         }
     } else {
         config.devices.clear(); 
@@ -375,8 +586,15 @@ int main(int argc, char* argv[]) {
         for (const auto& cfg : cmd_devices) {
             BlueProximity::Config final_cfg = cfg;
             final_cfg.debug = base_config.debug; // Force debug update from base_config
+            final_cfg.filter = base_config.filter;
+            final_cfg.lock_distance = base_config.lock_distance;
+            final_cfg.unlock_distance = base_config.unlock_distance;
+            final_cfg.sample_min = base_config.sample_min;
+            final_cfg.sample_max = base_config.sample_max;
+            final_cfg.estimate = base_config.estimate;
+            final_cfg.estimator = base_config.estimator;
             final_cfg.name_padding = max_name_len;
-            monitors.push_back(new BlueProximity(final_cfg));
+            monitors.push_back(new BlueProximity(final_cfg, loop, hci));
             
             ConfigFile::DeviceConfig dc;
             dc.mac = cfg.mac_address;
@@ -389,133 +607,687 @@ int main(int argc, char* argv[]) {
     }
 
     if (monitors.empty()) {
-        std::cerr << "Error: No devices configured or selected.\n";
+        Log::error( "Error: No devices configured or selected." );
         return 1;
     }
     
-    if (config_changed) {
+    auto save_config = [&]() {
         std::string dir = config_path.substr(0, config_path.find_last_of('/'));
         std::string cmd = "mkdir -p " + dir;
         int ret = system(cmd.c_str());
-        if (ret != 0) std::cerr << "Warning: Failed to create config directory.\n";
-        std::cout << "Saving configuration to " << config_path << std::endl;
+        if (ret != 0) Log::warn( "Warning: Failed to create config directory." );
+        Log::info( "Saving configuration to %s", config_path );
         ConfigFile::save(config_path, config);
-    }
+    };
+    if (config_changed && !dry_run) save_config();
     
     // Cache session info at startup
-    SessionInfo session = get_session_info();
+    SessionInfo session = get_session_info( probe );
     if ( !session.valid ) {
-        std::cerr << "Warning: Session info unavailable. Lock state sync will be disabled." << std::endl;
+        Log::warn( "Warning: Session info unavailable. Lock state sync will be disabled." );
     }
     
-    std::cout << "Starting monitoring loop..." << std::endl;
+    // One shared LE scan feeds every BLE monitor
+    BleScanner scanner( hci );
+    for ( auto* monitor : monitors ) {
+        if ( monitor->is_ble_device() ) scanner.add_monitor( monitor );
+    }
+    if ( scanner.has_monitors() ) scanner.start();
+
+    // Lock/unlock/proximity commands are spawned directly and reaped by the loop
+    CommandExecutor executor( loop );
+    executor.set_display( config.display, config.xauthority );
+    executor.set_dry_run( dry_run );
+
+    // Leave the loop on SIGINT/SIGTERM so the LE scan gets disabled again
+    auto shutdown = [&]( int ) { loop.stop(); };
+    loop.add_signal( SIGINT, shutdown );
+    loop.add_signal( SIGTERM, shutdown );
+
+    // From here on the loop only queues log records; a writer thread
+    // formats them. Replay and simulation wait rather than drop any.
+    Log::set_blocking( dry_run );
+    if ( !Log::start( config.log_binary ) ) return 1;
+    Log::info( "Starting monitoring loop..." );
+    double loop_started = monotonic_ms();
 
-    enum State { GONE, ACTIVE };
-    State current_state = GONE;
-    int duration_count = 0;
+    LockController::Config lock_cfg;
+    lock_cfg.lock_threshold = -config.lock_distance;
+    lock_cfg.unlock_threshold = -config.unlock_distance;
+    lock_cfg.lock_duration = config.lock_duration;
+    lock_cfg.unlock_duration = config.unlock_duration;
+    lock_cfg.mode = confidence_mode ? LockController::CONFIDENCE : LockController::COUNT;
+    lock_cfg.lock_confidence = config.lock_confidence;
+    LockController controller( lock_cfg );
+
+    int lock_count = 0;
+    int unlock_count = 0;
+    bool paused = false; // decisions suspended from the control socket
     time_t last_prox_time = 0;
-    time_t last_lock_check = 0;
-    const int LOCK_CHECK_INTERVAL = 30; // Check lock state every 30 seconds
+    const int TICK_INTERVAL_MS = 1000;
 
-    int lock_threshold = -config.lock_distance;
-    int unlock_threshold = -config.unlock_distance;
+    // Tick latency: how late the tick started against its schedule, and
+    // how long it ran. Monitors never block, so both stay bounded no
+    // matter how many devices are configured or how many are missing.
+    double next_tick_due = monotonic_ms();
+    double max_tick_late = 0;
+    double max_tick_run = 0;
+    uint64_t missed_ticks = 0;
 
-    while ( true ) {
-        time_t now = time( NULL );
+    // Per-device cost, closed into one-minute buckets; `kill -USR1` dumps it
+    uint64_t cost_ticks = 0;
+    auto print_costs = [&]() {
+        double minutes = cost_ticks * TICK_INTERVAL_MS / 60000.0;
+        // Rare and multi-line: formatted here, queued as one record
+        std::ostringstream table;
+        DeviceCost::print_header( table );
+        for ( auto* monitor : monitors ) {
+            monitor->get_cost().print( table, monitor->get_display_name(), minutes );
+        }
+        Log::info( "[ COST ] %.1f minutes monitored\n%s", minutes, table.str() );
+        Log::wake();
+    };
+    loop.add_signal( SIGUSR1, [&]( int ) { print_costs(); } );
+
+    // OpenMetrics exposition, rendered when scraped
+    LatencyHistogram tick_duration;
+    LatencyHistogram lock_spawn;
+    LatencyHistogram unlock_spawn;
+    auto render_metrics = [&]( std::string& out ) {
+        char line[256];
+        std::vector<std::string> labels;
+        for ( auto* monitor : monitors ) {
+            char addr[18];
+            ba2str( &monitor->get_bdaddr(), addr );
+            labels.push_back( "device=\"" + MetricsServer::escape( monitor->get_display_name() ) + "\",mac=\"" + addr
+                              + "\",type=\"" + ( monitor->is_ble_device() ? "ble" : "classic" ) + "\"" );
+        }
+        auto sample = [&]( const char* name, const std::string& lbl, double value ) {
+            out += name;
+            out += "{" + lbl + "} ";
+            if ( std::isnan( value ) ) snprintf( line, sizeof( line ), "NaN\n" );
+            else snprintf( line, sizeof( line ), "%.6g\n", value );
+            out += line;
+        };
+
+        MetricsServer::family( out, "blueproximity_state", "gauge", "1 while the devices are present (unlocked), 0 when gone" );
+        snprintf( line, sizeof( line ), "blueproximity_state %d\n", controller.get_state() == LockController::ACTIVE ? 1 : 0 );
+        out += line;
+        MetricsServer::family( out, "blueproximity_locks", "counter", "Lock commands issued" );
+        snprintf( line, sizeof( line ), "blueproximity_locks_total %d\n", lock_count );
+        out += line;
+        MetricsServer::family( out, "blueproximity_unlocks", "counter", "Unlock commands issued" );
+        snprintf( line, sizeof( line ), "blueproximity_unlocks_total %d\n", unlock_count );
+        out += line;
+        MetricsServer::family( out, "blueproximity_tick_duration_seconds", "histogram", "Time spent in one decision tick", "seconds" );
+        tick_duration.write_openmetrics( out, "blueproximity_tick_duration_seconds", "" );
+        MetricsServer::family( out, "blueproximity_command_spawn_seconds", "histogram", "posix_spawn() to exec of the lock/unlock command", "seconds" );
+        lock_spawn.write_openmetrics( out, "blueproximity_command_spawn_seconds", "command=\"lock\"" );
+        unlock_spawn.write_openmetrics( out, "blueproximity_command_spawn_seconds", "command=\"unlock\"" );
+
+        MetricsServer::family( out, "blueproximity_device_rssi_dbm", "gauge", "Filtered RSSI, NaN while nothing is heard" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            double avg = monitors[i]->get_average_rssi();
+            sample( "blueproximity_device_rssi_dbm", labels[i], rssi_missing( avg ) ? NAN : avg );
+        }
+        MetricsServer::family( out, "blueproximity_device_sample_rssi_dbm", "gauge", "Last raw RSSI sample, NaN if it was missing" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            int raw = monitors[i]->get_last_sample();
+            sample( "blueproximity_device_sample_rssi_dbm", labels[i], raw <= -255 ? NAN : raw );
+        }
+        MetricsServer::family( out, "blueproximity_device_link_state", "gauge", "Classic RFCOMM link: 0 down, 1 connecting, 2 up" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            if ( !monitors[i]->is_ble_device() ) sample( "blueproximity_device_link_state", labels[i], monitors[i]->get_link_state() );
+        }
+        MetricsServer::family( out, "blueproximity_device_sample_interval_seconds", "gauge", "Current adaptive sampling interval", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            sample( "blueproximity_device_sample_interval_seconds", labels[i], monitors[i]->get_sample_interval() * TICK_INTERVAL_MS / 1000.0 );
+        }
+        if ( confidence_mode ) {
+            MetricsServer::family( out, "blueproximity_device_departed_probability", "gauge", "Estimated probability the device is past the lock threshold" );
+            for ( size_t i = 0; i < monitors.size(); i++ ) {
+                sample( "blueproximity_device_departed_probability", labels[i], monitors[i]->get_estimator().p_below( lock_cfg.lock_threshold ) );
+            }
+        }
+
+        MetricsServer::family( out, "blueproximity_read_rssi_seconds", "histogram", "HCI Read RSSI command to Command Complete", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            if ( !monitors[i]->is_ble_device() ) monitors[i]->get_latency().read_rssi.write_openmetrics( out, "blueproximity_read_rssi_seconds", labels[i] );
+        }
+        MetricsServer::family( out, "blueproximity_rfcomm_connect_seconds", "histogram", "RFCOMM connect to link established", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            if ( !monitors[i]->is_ble_device() ) monitors[i]->get_latency().connect.write_openmetrics( out, "blueproximity_rfcomm_connect_seconds", labels[i] );
+        }
+        MetricsServer::family( out, "blueproximity_keepalive_rtt_seconds", "histogram", "AT keepalive to the first reply byte", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            if ( !monitors[i]->is_ble_device() ) monitors[i]->get_latency().keepalive_rtt.write_openmetrics( out, "blueproximity_keepalive_rtt_seconds", labels[i] );
+        }
+        MetricsServer::family( out, "blueproximity_first_advert_seconds", "histogram", "LE scan enabled to the first advert from the device", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            if ( monitors[i]->is_ble_device() ) monitors[i]->get_latency().first_advert.write_openmetrics( out, "blueproximity_first_advert_seconds", labels[i] );
+        }
+
+        MetricsServer::family( out, "blueproximity_device_hci_commands", "counter", "HCI commands queued for the device" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            sample( "blueproximity_device_hci_commands_total", labels[i], monitors[i]->get_cost().total.hci_commands );
+        }
+        MetricsServer::family( out, "blueproximity_device_syscalls", "counter", "Syscalls issued on the device's behalf" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            sample( "blueproximity_device_syscalls_total", labels[i], monitors[i]->get_cost().total.syscalls );
+        }
+        MetricsServer::family( out, "blueproximity_device_wakeups", "counter", "Loop callbacks and HCI events for the device" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            sample( "blueproximity_device_wakeups_total", labels[i], monitors[i]->get_cost().total.wakeups );
+        }
+        MetricsServer::family( out, "blueproximity_device_update_cpu_seconds", "counter", "Thread CPU time in the per-tick update", "seconds" );
+        for ( size_t i = 0; i < monitors.size(); i++ ) {
+            sample( "blueproximity_device_update_cpu_seconds_total", labels[i], monitors[i]->get_cost().total.update_cpu_ns / 1e9 );
+        }
+        out += "# EOF\n";
+    };
+    MetricsServer metrics( loop, render_metrics );
+    if ( !config.metrics.empty() ) {
+        if ( !metrics.listen( config.metrics ) ) return 1;
+        Log::info( "[ SYSTEM ] Serving metrics on %s", config.metrics );
+    }
+
+    auto lock_now = [&]() {
+        lock_count++;
+        if ( executor.execute( config.lock_cmd ) > 0 ) lock_spawn.record_ms( executor.get_last_spawn_latency() );
+    };
+    auto unlock_now = [&]() {
+        unlock_count++;
+        if ( executor.execute( config.unlock_cmd ) > 0 ) unlock_spawn.record_ms( executor.get_last_spawn_latency() );
+    };
+
+    // Name column width follows the longest name still monitored
+    auto repad = [&]() {
+        size_t len = 0;
+        for ( auto* monitor : monitors ) len = std::max( len, monitor->get_display_name().length() );
+        for ( auto* monitor : monitors ) monitor->set_name_padding( len );
+    };
+    auto start_monitor = [&]( const BlueProximity::Config& cfg ) {
+        BlueProximity* monitor = new BlueProximity( cfg, loop, hci );
+        monitors.push_back( monitor );
+        repad();
+        if ( cfg.is_ble ) {
+            scanner.add_monitor( monitor );
+            if ( !scanner.is_scanning() ) scanner.start();
+        }
+        return monitor;
+    };
+    auto stop_monitor = [&]( std::vector<BlueProximity*>::iterator it ) {
+        BlueProximity* monitor = *it;
+        if ( monitor->is_ble_device() ) {
+            scanner.remove_monitor( monitor );
+            if ( !scanner.has_monitors() ) scanner.stop();
+        }
+        it = monitors.erase( it );
+        delete monitor;
+        repad();
+        return it;
+    };
+    // Pushes config's thresholds to the controller and every monitor
+    auto apply_thresholds = [&]() {
+        lock_cfg.lock_threshold = -config.lock_distance;
+        lock_cfg.unlock_threshold = -config.unlock_distance;
+        lock_cfg.lock_duration = config.lock_duration;
+        lock_cfg.unlock_duration = config.unlock_duration;
+        lock_cfg.lock_confidence = config.lock_confidence;
+        controller.set_config( lock_cfg );
+        for ( auto* monitor : monitors ) monitor->set_distances( config.lock_distance, config.unlock_distance );
+    };
+    auto find_monitor = [&]( const std::string& key ) -> std::vector<BlueProximity*>::iterator {
+        bdaddr_t addr;
+        bool by_mac = is_mac_address( key );
+        if ( by_mac ) str2ba( key.c_str(), &addr );
+        return std::find_if( monitors.begin(), monitors.end(), [&]( BlueProximity* monitor ) {
+            return by_mac ? bacmp( &monitor->get_bdaddr(), &addr ) == 0 : monitor->get_config().name == key;
+        } );
+    };
+    auto parse_int = []( const std::string& s, int& value ) {
+        char* end;
+        long v = strtol( s.c_str(), &end, 10 );
+        if ( s.empty() || *end || v < 0 || v > 1000 ) return false;
+        value = (int)v;
+        return true;
+    };
+
+    // Runtime control, one command per line; see README "Control socket"
+    auto control = [&]( const std::vector<std::string>& words, std::string& reply ) -> std::string {
+        const std::string& cmd = words[0];
+        char line[256];
+        if ( cmd == "help" ) {
+            reply += "list | status | add <mac> [ble|classic] [name] | remove <mac|name>\n"
+                     "set <lock_distance|unlock_distance|lock_duration|unlock_duration|lock_confidence> <value>\n"
+                     "lock | unlock | pause | resume | save\n";
+            return "";
+        }
+        if ( cmd == "list" ) {
+            for ( auto* monitor : monitors ) {
+                char addr[18];
+                ba2str( &monitor->get_bdaddr(), addr );
+                double avg = monitor->get_average_rssi();
+                int raw = monitor->get_last_sample();
+                reply += addr;
+                reply += monitor->is_ble_device() ? " ble" : " classic";
+                // "-" while nothing is heard
+                if ( raw <= -255 ) reply += " rssi=-";
+                else reply += " rssi=" + std::to_string( raw );
+                if ( rssi_missing( avg ) ) reply += " avg=-";
+                else {
+                    snprintf( line, sizeof( line ), " avg=%.1f", avg );
+                    reply += line;
+                }
+                reply += " interval=" + std::to_string( monitor->get_sample_interval() * TICK_INTERVAL_MS / 1000 ) + "s";
+                if ( !monitor->is_ble_device() ) {
+                    static const char* const LINK[] = { "down", "connecting", "up" };
+                    reply += std::string( " link=" ) + LINK[monitor->get_link_state()];
+                }
+                if ( !monitor->get_config().name.empty() ) reply += " name=\"" + monitor->get_config().name + "\"";
+                reply += "\n";
+            }
+            return "";
+        }
+        if ( cmd == "status" ) {
+            snprintf( line, sizeof( line ), "state=%s%s locks=%d unlocks=%d devices=%zu\n",
+                      controller.get_state() == LockController::ACTIVE ? "ACTIVE" : "GONE", paused ? " paused" : "",
+                      lock_count, unlock_count, monitors.size() );
+            reply += line;
+            snprintf( line, sizeof( line ), "lock_distance=%d unlock_distance=%d lock_duration=%d unlock_duration=%d lock_confidence=%g\n",
+                      config.lock_distance, config.unlock_distance, config.lock_duration, config.unlock_duration, config.lock_confidence );
+            reply += line;
+            return "";
+        }
+        if ( cmd == "add" ) {
+            if ( words.size() < 2 || words.size() > 4 ) return "usage: add <mac> [ble|classic] [name]";
+            if ( !is_mac_address( words[1] ) ) return "bad address";
+            if ( find_monitor( words[1] ) != monitors.end() ) return "already monitored";
+            bool is_ble = false;
+            if ( words.size() > 2 ) {
+                if ( words[2] != "ble" && words[2] != "classic" ) return "type must be ble or classic";
+                is_ble = words[2] == "ble";
+            }
+            ConfigFile::DeviceConfig dc;
+            dc.mac = words[1];
+            dc.name = words.size() > 3 ? words[3] : "";
+            dc.is_ble = is_ble;
+            dc.channel = base_config.channel;
+            BlueProximity* monitor = start_monitor( make_device_config( base_config, dc ) );
+            config.devices.push_back( dc );
+            Log::info( "[ CONTROL ] Added %s device %s", is_ble ? "BLE" : "Classic", monitor->get_display_name() );
+            return "";
+        }
+        if ( cmd == "remove" ) {
+            if ( words.size() != 2 ) return "usage: remove <mac|name>";
+            auto it = find_monitor( words[1] );
+            if ( it == monitors.end() ) return "no such device";
+            if ( monitors.size() == 1 ) return "cannot remove the last device";
+            Log::info( "[ CONTROL ] Removed device %s", (*it)->get_display_name() );
+            bdaddr_t addr = (*it)->get_bdaddr();
+            stop_monitor( it );
+
+            config.devices.erase( std::remove_if( config.devices.begin(), config.devices.end(), [&]( const ConfigFile::DeviceConfig& dev ) {
+                bdaddr_t dev_addr;
+                str2ba( dev.mac.c_str(), &dev_addr );
+                return bacmp( &dev_addr, &addr ) == 0;
+            } ), config.devices.end() );
+            return "";
+        }
+        if ( cmd == "set" ) {
+            if ( words.size() != 3 ) return "usage: set <key> <value>";
+            const std::string& key = words[1];
+            int value = 0;
+            if ( key == "lock_confidence" ) {
+                char* end;
+                double p = strtod( words[2].c_str(), &end );
+                if ( words[2].empty() || *end || p <= 0.5 || p >= 1 ) return "lock_confidence must be between 0.5 and 1";
+                config.lock_confidence = p;
+            } else if ( key == "lock_distance" || key == "unlock_distance" || key == "lock_duration" || key == "unlock_duration" ) {
+                if ( !parse_int( words[2], value ) ) return "value must be a whole number from 0 to 1000";
+                if ( key == "lock_distance" ) base_config.lock_distance = config.lock_distance = value;
+                else if ( key == "unlock_distance" ) base_config.unlock_distance = config.unlock_distance = value;
+                else if ( key == "lock_duration" ) base_config.lock_duration = config.lock_duration = value;
+                else base_config.unlock_duration = config.unlock_duration = value;
+            } else {
+                return "unknown setting " + key;
+            }
+            apply_thresholds();
+            Log::info( "[ CONTROL ] %s set to %s", key, words[2] );
+            return "";
+        }
+        if ( cmd == "lock" || cmd == "unlock" ) {
+            if ( words.size() != 1 ) return "usage: " + cmd;
+            // The controller starts over from the forced state
+            if ( cmd == "lock" ) {
+                Log::info( "[ CONTROL ] Forcing GONE (Locking)" );
+                lock_now();
+                controller.force( LockController::GONE );
+            } else {
+                Log::info( "[ CONTROL ] Forcing ACTIVE (Unlocking)" );
+                unlock_now();
+                controller.force( LockController::ACTIVE );
+            }
+            return "";
+        }
+        if ( cmd == "pause" || cmd == "resume" ) {
+            paused = cmd == "pause";
+            Log::info( "[ CONTROL ] Lock decisions %s", paused ? "paused" : "resumed" );
+            return "";
+        }
+        if ( cmd == "save" ) {
+            if ( dry_run ) return "not saved in replay or simulation";
+            save_config();
+            return "";
+        }
+        return "unknown command " + cmd + " (try help)";
+    };
+    ControlServer control_server( loop, control );
+    if ( !config.control.empty() ) {
+        if ( !control_server.listen( config.control ) ) return 1;
+        Log::info( "[ SYSTEM ] Accepting control commands on %s", config.control );
+    }
+
+    // Re-reads the config file and changes only what differs: monitors
+    // whose settings are unchanged keep their links and filter history
+    auto reload_config = [&]() {
+        ConfigFile::GlobalConfig next;
+        try {
+            next = ConfigFile::load( config_path );
+        } catch ( const std::exception& e ) {
+            Log::warn( "Warning: Ignoring the changed config, a value does not parse (%s)", e.what() );
+            return;
+        }
+        // Detected at startup rather than stored
+        if ( next.display.empty() ) next.display = config.display;
+        if ( next.xauthority.empty() ) next.xauthority = config.xauthority;
+        if ( next.desktop_environment.empty() ) next.desktop_environment = config.desktop_environment;
+        if ( next.lock_cmd.empty() ) next.lock_cmd = config.lock_cmd;
+        if ( next.unlock_cmd.empty() ) next.unlock_cmd = config.unlock_cmd;
+        if ( next.prox_cmd.empty() ) next.prox_cmd = config.prox_cmd;
+
+        // Validate everything before changing anything
+        std::string problem;
+        Log::Level level;
+        if ( next.devices.empty() ) problem = "no devices are listed";
+        else if ( next.lock_confidence <= 0.5 || next.lock_confidence >= 1 ) problem = "lock_confidence must be between 0.5 and 1";
+        else if ( !Log::parse_level( next.log_level, level ) ) problem = "log_level must be error, warn, info or debug";
+        for ( const auto& dev : next.devices ) {
+            std::string error;
+            if ( !problem.empty() ) break;
+            if ( !is_mac_address( dev.mac ) ) problem = "bad device address '" + dev.mac + "'";
+            else if ( !make_rssi_filter( dev.filter.empty() ? next.rssi_filter : dev.filter, 1, &error ) ) problem = "invalid RSSI filter: " + error;
+        }
+        if ( !problem.empty() ) {
+            Log::warn( "Warning: Ignoring the changed config: %s", problem );
+            return;
+        }
+
+        // Bound at startup
+        auto fixed = [&]( const char* key, std::string& next_value, const std::string& value ) {
+            if ( next_value == value ) return;
+            Log::warn( "Warning: %s changed in the config; it takes effect after a restart", key );
+            next_value = value;
+        };
+        fixed( "lock_mode", next.lock_mode, config.lock_mode );
+        fixed( "metrics", next.metrics, config.metrics );
+        fixed( "control", next.control, config.control );
+        fixed( "log_binary", next.log_binary, config.log_binary );
+
+        if ( next.debug ) level = Log::DEBUG;
+        BlueProximity::Config next_base = base_config;
+        set_monitor_defaults( next_base, next );
+        next_base.debug = level == Log::DEBUG;
+
+        std::vector<BlueProximity::Config> wanted;
+        auto find_wanted = [&]( const bdaddr_t& addr ) {
+            return std::find_if( wanted.begin(), wanted.end(), [&]( const BlueProximity::Config& cfg ) {
+                bdaddr_t cfg_addr;
+                str2ba( cfg.mac_address.c_str(), &cfg_addr );
+                return bacmp( &cfg_addr, &addr ) == 0;
+            } );
+        };
+        for ( const auto& dev : next.devices ) {
+            bdaddr_t addr;
+            str2ba( dev.mac.c_str(), &addr );
+            if ( find_wanted( addr ) == wanted.end() ) wanted.push_back( make_device_config( next_base, dev ) );
+        }
+
+        // Tear down what went away or changed, then start what is missing
+        size_t removed = 0;
+        size_t restarted = 0;
+        size_t started = 0;
+        for ( auto it = monitors.begin(); it != monitors.end(); ) {
+            auto want = find_wanted( (*it)->get_bdaddr() );
+            if ( want != wanted.end() && same_monitor_settings( (*it)->get_config(), *want ) ) {
+                ++it;
+                continue;
+            }
+            if ( want == wanted.end() ) removed++;
+            else restarted++;
+            it = stop_monitor( it );
+        }
+        for ( const auto& cfg : wanted ) {
+            bdaddr_t addr;
+            str2ba( cfg.mac_address.c_str(), &addr );
+            bool running = std::any_of( monitors.begin(), monitors.end(), [&]( BlueProximity* monitor ) {
+                return bacmp( &monitor->get_bdaddr(), &addr ) == 0;
+            } );
+            if ( !running ) {
+                start_monitor( cfg );
+                started++;
+            }
+        }
+
+        // Globals all switch over together, before the tick decides anything
+        bool thresholds_changed = next.lock_distance != config.lock_distance || next.unlock_distance != config.unlock_distance
+            || next.lock_duration != config.lock_duration || next.unlock_duration != config.unlock_duration
+            || next.lock_confidence != config.lock_confidence;
+        config = next;
+        base_config = next_base;
+        Log::set_level( level );
+        executor.set_display( config.display, config.xauthority );
+        if ( thresholds_changed ) apply_thresholds();
+
+        Log::info( "[ SYSTEM ] Reloaded %s: %zu added, %zu removed, %zu restarted%s", config_path,
+                   started - restarted, removed, restarted, thresholds_changed ? ", new thresholds" : "" );
+    };
+
+    // Edits to the config file are applied at the start of the next tick
+    bool reload_pending = false;
+    ConfigWatcher config_watcher( loop );
+    if ( !replaying && !config_watcher.start( config_path, [&]() { reload_pending = true; } ) ) {
+        Log::warn( "Warning: Cannot watch %s; config changes need a restart", config_path );
+    }
+
+    // Sync internal state with the desktop's actual lock state as soon as
+    // the observer reports it (covers timeout-based and manual locks)
+    auto sync_lock_state = [&]( bool desktop_locked ) {
+        controller.sync( desktop_locked );
+    };
+
+    LockObserver lock_observer( loop );
+    lock_observer.add_backend( std::unique_ptr<LockObserver::Backend>( new LogindDbusBackend() ) );
+    lock_observer.add_backend( std::unique_ptr<LockObserver::Backend>( new LoginctlPollBackend( 30 ) ) );
+    if ( session.valid && !dry_run && !lock_observer.start( session.session_id, sync_lock_state ) ) {
+        Log::warn( "Warning: No lock state backend available. Lock state sync will be disabled." );
+    }
+
+    // Startup time, reported once the first device is heard; replay has
+    // no meaningful clock for it
+    bool startup_reported = replaying;
+    auto report_startup = [&]() {
+        const BlueProximity* first = nullptr;
+        for ( auto* monitor : monitors ) {
+            double at = monitor->get_first_rssi_at();
+            if ( at >= 0 && ( !first || at < first->get_first_rssi_at() ) ) first = monitor;
+        }
+        if ( !first ) return;
+        startup_reported = true;
+        Log::info( "[ SYSTEM ] Startup: session probe %.1fms, monitoring at %.1fms, first RSSI sample at %.1fms (%s)",
+                   probe.elapsed_ms, loop_started - main_started, first->get_first_rssi_at() - main_started,
+                   first->get_display_name() );
+    };
+
+    auto tick = [&]( uint64_t expirations ) {
+        double tick_start = monotonic_ms();
+        double tick_late = tick_start - next_tick_due;
+        if ( tick_late < 0 ) tick_late = 0;
+        next_tick_due += TICK_INTERVAL_MS * (double)expirations;
+        if ( expirations > 1 ) missed_ticks += expirations - 1;
+        if ( tick_late > max_tick_late ) max_tick_late = tick_late;
+
+        time_t now = wall_time();
         double best_avg_rssi = -255.0;
-        
-        // Update all monitors and find best signal FIRST
+        double p_departed = 1.0;
+
+        if ( reload_pending ) {
+            reload_pending = false;
+            reload_config();
+        }
+
+        // Adapter went away (e.g. rfkill, USB replug); try to get it back
+        if ( !hci.is_open() ) hci.open();
+
+        // Collect every monitor's latest sample and queue the next one
         for ( auto* monitor : monitors ) {
             monitor->update(); // prints status
+            // The LE scan is shared; each BLE device is charged all of it
+            if ( monitor->is_ble_device() && scanner.is_scanning() ) monitor->get_cost().total.scan_ms += TICK_INTERVAL_MS;
             double avg = monitor->get_average_rssi();
             if ( avg > best_avg_rssi ) {
                 best_avg_rssi = avg;
             }
+            // Gone only if every device is gone
+            if ( confidence_mode ) p_departed *= monitor->get_estimator().p_below( lock_cfg.lock_threshold );
         }
         
-        // Periodically check actual desktop lock state to sync with system
-        if ( session.valid && ( now - last_lock_check >= LOCK_CHECK_INTERVAL ) ) {
-            bool desktop_locked = is_desktop_locked( session );
-            State expected_state = desktop_locked ? GONE : ACTIVE;
-            
-            if ( current_state != expected_state ) {
-                std::cout << "[ SYSTEM ] Desktop lock state mismatch detected. ";
-                std::cout << "Desktop is " << ( desktop_locked ? "LOCKED" : "UNLOCKED" );
-                std::cout << ", internal state was " << ( current_state == ACTIVE ? "ACTIVE" : "GONE" );
-                std::cout << ". Syncing..." << std::endl;
-                
-                // Smart duration_count handling based on RSSI and transition direction
-                if ( current_state == ACTIVE && expected_state == GONE ) {
-                    // Desktop locked externally while we thought it was unlocked
-                    // If RSSI is good (above unlock threshold), start unlock counter at 1
-                    if ( best_avg_rssi >= unlock_threshold && best_avg_rssi != -255.0 ) {
-                        duration_count = 1;
-                        std::cout << "[ SYSTEM ] RSSI is good (" << best_avg_rssi 
-                                  << "), starting unlock counter at 1" << std::endl;
-                    } else {
-                        duration_count = 0;
-                    }
-                } else {
-                    // Any other transition: reset to 0
-                    duration_count = 0;
-                }
-                
-                current_state = expected_state;
+        if ( !startup_reported ) report_startup();
+
+        if ( ++cost_ticks % ( 60000 / TICK_INTERVAL_MS ) == 0 ) {
+            for ( auto* monitor : monitors ) monitor->get_cost().roll_minute();
+
+            // Refresh the cache with the devices heard this minute
+            for ( auto* monitor : monitors ) {
+                if ( !device_cache.is_open() || monitor->get_last_sample() == -255 ) continue;
+                const BlueProximity::Config& cfg = monitor->get_config();
+                DeviceCache::Entry entry;
+                bacpy( &entry.addr, &monitor->get_bdaddr() );
+                entry.name = cfg.name;
+                entry.ble = cfg.is_ble;
+                entry.classic = !cfg.is_ble;
+                entry.rssi = monitor->get_last_sample();
+                if ( monitor->get_link_state() == 2 ) entry.channel = cfg.channel;
+                entry.last_seen = now;
+                device_cache.update( entry );
             }
-            last_lock_check = now;
         }
 
         // Global State Machine Logic
-        int required_duration = ( current_state == ACTIVE ) ? config.lock_duration : config.unlock_duration;
-        
-        if ( current_state == ACTIVE ) {
-            // Check if we should lock
-            if ( best_avg_rssi <= lock_threshold ) {
-                duration_count++;
-                if ( duration_count >= config.lock_duration ) {
-                    std::cout << "[ SYSTEM ] Transitioning to GONE (Locking)" << std::endl;
-                    current_state = GONE;
-                    execute_command( config.lock_cmd, config.display, config.xauthority );
-                    duration_count = 0;
-                }
-            } else {
-                duration_count = 0; // Reset if any signal is good
-            }
-        } else {
-            // Check if we should unlock
-            if ( best_avg_rssi >= unlock_threshold && best_avg_rssi != -255.0 ) {
-                duration_count++;
-                if ( duration_count >= config.unlock_duration ) {
-                    std::cout << "[ SYSTEM ] Transitioning to ACTIVE (Unlocking)" << std::endl;
-                    current_state = ACTIVE;
-                    execute_command( config.unlock_cmd, config.display, config.xauthority );
-                    duration_count = 0;
-                }
-            } else {
-                duration_count = 0;
-            }
+        int required_duration = controller.required_duration();
+        switch ( paused ? LockController::NONE : controller.update( best_avg_rssi, p_departed ) ) {
+            case LockController::LOCK:
+                Log::info( "[ SYSTEM ] Transitioning to GONE (Locking)" );
+                lock_now();
+                break;
+            case LockController::UNLOCK:
+                Log::info( "[ SYSTEM ] Transitioning to ACTIVE (Unlocking)" );
+                unlock_now();
+                break;
+            case LockController::NONE:
+                break;
         }
+        bool active = controller.get_state() == LockController::ACTIVE;
 
         // Proximity Command
-        if ( current_state == ACTIVE && !config.prox_cmd.empty() ) {
+        if ( active && !config.prox_cmd.empty() ) {
             if ( now - last_prox_time >= config.prox_interval ) {
-                execute_command( config.prox_cmd, config.display, config.xauthority );
+                executor.execute( config.prox_cmd );
                 last_prox_time = now;
             }
         }
 
+        double tick_run = monotonic_ms() - tick_start;
+        tick_duration.record_ms( tick_run );
+        if ( tick_run > max_tick_run ) max_tick_run = tick_run;
+
         // Display Aggregated Status
-        std::cout << "[ SYSTEM        ] Best Avg RSSI: " << std::fixed << std::setprecision( 1 ) << std::setw( 5 ) << best_avg_rssi 
-                  << " Conf: " << duration_count << "/" << required_duration
-                  << " State: " << ( current_state == ACTIVE ? "ACTIVE" : "GONE" ) << std::endl;
-        std::cout << "------------------------------------------------------------" << std::endl;
+        {
+            Log::Line status( Log::INFO );
+            status.add( "[ SYSTEM        ] Best Avg RSSI: %5.1f", best_avg_rssi );
+            if ( confidence_mode && active ) {
+                status.add( " P(gone): %.2f/%.2f", p_departed, config.lock_confidence );
+            } else {
+                status.add( " Conf: %d/%d", controller.get_duration_count(), required_duration );
+            }
+            status.add( " State: %s", active ? "ACTIVE" : "GONE" );
+            if ( paused ) status.add( " (paused)" );
+        }
+        Log::info( "[ SYSTEM        ] Tick late: %.1fms (max %.1f) run: %.1fms (max %.1f) missed: %llu",
+                   tick_late, max_tick_late, tick_run, max_tick_run, missed_ticks );
+        Log::info( "------------------------------------------------------------" );
+        // One batch per tick for the log writer
+        Log::wake();
+    };
+
+    if ( replaying ) {
+        // Feed the trace through the same parsing and decision code as fast
+        // as possible; ticks fire whenever trace time crosses a tick boundary
+        BtSnoopReader reader;
+        if ( !reader.open( replay_path ) ) return 1;
 
-        sleep( 1 ); 
+        const uint64_t TICK_US = TICK_INTERVAL_MS * 1000ULL;
+        const uint64_t MAX_GAP_US = 60 * 1000000ULL; // daemon was not running
+        BtSnoopReader::Record rec;
+        uint64_t next_tick_us = 0;
+        uint64_t packets = 0;
+        uint64_t ticks = 0;
+        auto started = std::chrono::steady_clock::now();
+
+        while ( reader.next( rec ) ) {
+            if ( next_tick_us == 0 || rec.unix_us > next_tick_us + MAX_GAP_US ) {
+                next_tick_us = rec.unix_us + TICK_US;
+                next_tick_due = rec.unix_us / 1000.0 + TICK_INTERVAL_MS;
+            }
+            while ( rec.unix_us >= next_tick_us ) {
+                set_replay_time_us( next_tick_us );
+                tick( 1 );
+                ticks++;
+                next_tick_us += TICK_US;
+            }
+            set_replay_time_us( rec.unix_us );
+            if ( rec.received ) hci.inject( rec.data, (int)rec.len );
+            packets++;
+        }
+
+        double elapsed = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - started ).count();
+        Log::info( "[ REPLAY ] %llu packets, %llu ticks (%llus of trace) in %gms; %d locks, %d unlocks",
+                   packets, ticks, ticks * TICK_INTERVAL_MS / 1000, elapsed, lock_count, unlock_count );
+        print_costs();
+    } else {
+        if ( loop.add_timer( 0, TICK_INTERVAL_MS, tick ) < 0 ) {
+            Log::error( "Error: Failed to create tick timer" );
+            return 1;
+        }
+        // A bounded simulation ends itself, the same way a signal would
+        double duration = simulating ? ( sim_duration >= 0 ? sim_duration : sim.get_duration() ) : 0;
+        if ( duration > 0 && loop.add_timer( std::max( 1, (int)( duration * 1000 ) ), 0, [&]( uint64_t ) { loop.stop(); } ) < 0 ) {
+            Log::error( "Error: Failed to create simulation timer" );
+            return 1;
+        }
+        loop.run();
+        if ( simulating ) {
+            sim.print_stats();
+            Log::info( "[ SIM ] %d locks, %d unlocks", lock_count, unlock_count );
+            print_costs();
+        }
     }
 
+    scanner.stop();
     for ( auto* monitor : monitors ) {
         delete monitor;
     }
+    Log::stop();
 
     return 0;
 }
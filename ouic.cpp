@@ -0,0 +1,56 @@
+// Compiles the IEEE registry text files into the vendor index the scan
+// tools map, or looks addresses up in it.
+#include "OuiIndex.hpp"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+static int usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-o <index>] [registry files...]\n"
+              << "       " << prog << " [-i <index>] -l <address>...\n"
+              << "Without files, compiles oui.txt, mam.txt, oui36.txt and iab.txt from /usr/share/ieee-data.\n"
+              << "The index defaults to " << OuiIndex::default_path() << std::endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    std::string index_path = OuiIndex::default_path();
+    std::vector<std::string> args;
+    bool lookup = false;
+    for (int i = 1; i < argc; i++) {
+        if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "-i")) && i + 1 < argc) index_path = argv[++i];
+        else if (!strcmp(argv[i], "-l")) lookup = true;
+        else if (argv[i][0] == '-') return usage(argv[0]);
+        else args.push_back(argv[i]);
+    }
+
+    if (lookup) {
+        OuiIndex index;
+        if (!index.open(index_path)) {
+            std::cerr << "Cannot open index " << index_path << "; run " << argv[0] << " first" << std::endl;
+            return 1;
+        }
+        for (const auto& mac : args) {
+            const char* vendor = index.lookup(mac);
+            std::cout << mac << " " << (vendor ? vendor : "(unknown)") << std::endl;
+        }
+        return 0;
+    }
+
+    if (args.empty()) args = OuiIndex::default_sources();
+    if (args.empty()) {
+        std::cerr << "No registry files in /usr/share/ieee-data (package ieee-data)" << std::endl;
+        return usage(argv[0]);
+    }
+    auto started = std::chrono::steady_clock::now();
+    std::string error;
+    long entries = OuiIndex::compile(args, index_path, &error);
+    if (entries < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Compiled " << entries << " prefixes from " << args.size() << " files into " << index_path
+              << " in " << elapsed << "ms" << std::endl;
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -17,9 +19,27 @@
 #include <algorithm>
 #include <memory>
 #include <array>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "AdvParser.hpp"
+#include "Bdaddr.hpp"
+#include "DeviceCache.hpp"
+#include "Inquiry.hpp"
+#include "OuiIndex.hpp"
 
 using namespace std;
 
+extern char** environ;
+
 struct DeviceInfo {
     string mac;
     string name;
@@ -27,53 +47,159 @@ struct DeviceInfo {
     string type; // "BT" or "BLE"
     string services;
     string vendor;
+    bool probed = false;
+    bool timed_out = false;
+    int reported_rssi = 0;
+    uint32_t dev_class = 0;
+    int channel = 0;      // first RFCOMM channel sdptool listed
 };
 
 map<string, DeviceInfo> devices;
 
-// Helper to run shell command and get output
-string exec(const char* cmd) {
-    array<char, 128> buffer;
-    string result;
-    unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) {
-        return "popen failed";
+// table waits for the scan and probes and prints the tables; json (one
+// object per line) and columns stream a record per device as soon as it
+// is heard, and again as its name, RSSI, type or services change
+enum Format { TABLE, JSON, COLUMNS };
+Format output = TABLE;
+mutex output_lock;
+auto started_at = chrono::steady_clock::now();
+
+// Progress messages; kept off stdout when it carries records
+ostream& status() {
+    return output == TABLE ? cout : cerr;
+}
+
+// RSSI moves by a few dB between adverts; only report real movement
+static const int RSSI_STEP = 5;
+
+// Length of the well-formed UTF-8 sequence starting at s[i], or 0 if the
+// bytes there are not one (stray continuation, overlong form, surrogate,
+// above U+10FFFF, or cut short)
+static size_t utf8_length(const string& s, size_t i) {
+    unsigned char c = s[i];
+    if (c < 0x80) return 1;
+    if (c < 0xc2 || c > 0xf4) return 0; // continuation, overlong lead, or past U+10FFFF
+    size_t len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+    uint32_t cp = c & (0x7f >> len);
+    if (i + len > s.size()) return 0;
+    for (size_t k = 1; k < len; k++) {
+        unsigned char cc = s[i + k];
+        if ((cc & 0xc0) != 0x80) return 0;
+        cp = (cp << 6) | (cc & 0x3f);
     }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+    if ((len == 3 && cp < 0x800) || (len == 4 && (cp < 0x10000 || cp > 0x10ffff))) return 0;
+    if (cp >= 0xd800 && cp <= 0xdfff) return 0;
+    return len;
+}
+
+// Names come off the air, and a Shortened Local Name is often cut inside
+// a multi-byte character; bytes that are not valid UTF-8 become U+FFFD so
+// every line still parses
+string json_string(const string& s) {
+    string out = "\"";
+    for (size_t i = 0; i < s.size();) {
+        unsigned char c = s[i];
+        size_t len = utf8_length(s, i);
+        if (len == 0) {
+            out += "\\ufffd";
+            i++;
+        } else if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+            i++;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+            i++;
+        } else {
+            out.append(s, i, len);
+            i += len;
+        }
     }
-    return result;
+    return out + "\"";
 }
 
-string get_vendor(string mac) {
-    if (mac.length() < 8) return "";
-    string prefix = mac.substr(0, 8);
-    replace(prefix.begin(), prefix.end(), ':', '-');
-    transform(prefix.begin(), prefix.end(), prefix.begin(), ::toupper);
-    
-    string cmd = "grep -i \"^" + prefix + ".*(hex)\" /usr/share/ieee-data/oui.txt";
-    string output = exec(cmd.c_str());
-    
-    if (output.empty()) return "";
-    
-    size_t pos = output.find("(hex)");
-    if (pos != string::npos) {
-        string vendor = output.substr(pos + 5);
-        // Trim whitespace
-        size_t first = vendor.find_first_not_of(" \t");
-        if (string::npos == first) return "";
-        size_t last = vendor.find_last_not_of(" \t\n\r");
-        return vendor.substr(first, (last - first + 1));
+// One record: event is "new" the first time a device is reported and
+// "update" after. Every record carries the whole device, so a reader can
+// act on any line alone.
+void print_record(const char* event, DeviceInfo& d) {
+    if (output == TABLE) return;
+    double t = chrono::duration<double>(chrono::steady_clock::now() - started_at).count();
+    lock_guard<mutex> lock(output_lock);
+    d.reported_rssi = d.rssi;
+    string services = d.services;
+    replace(services.begin(), services.end(), '\n', ' ');
+
+    if (output == JSON) {
+        cout << "{\"event\":\"" << event << "\",\"t\":" << fixed << setprecision(3) << t << defaultfloat
+             << ",\"mac\":\"" << d.mac << "\",\"type\":\"" << d.type << "\",\"rssi\":" << d.rssi
+             << ",\"name\":" << json_string(d.name == "[Unknown]" ? "" : d.name)
+             << ",\"vendor\":" << json_string(d.vendor);
+        if (d.probed) {
+            cout << ",\"services\":" << json_string(services) << ",\"timed_out\":" << (d.timed_out ? "true" : "false");
+        }
+        cout << "}" << endl;
+    } else {
+        string name = d.name.substr(0, 29);
+        string vendor = d.vendor.length() > 24 ? d.vendor.substr(0, 21) + "..." : d.vendor;
+        if (d.timed_out) services = "(timed out) " + services;
+        cout << left << setw(7) << event << right << setw(8) << fixed << setprecision(3) << t << defaultfloat << "  "
+             << left << setw(18) << d.mac << setw(5) << d.type << setw(5) << d.rssi << setw(30) << name
+             << setw(25) << vendor << services << endl;
+    }
+}
+
+// Compiled from /usr/share/ieee-data by ouic; see OuiIndex.hpp
+OuiIndex vendors;
+
+void open_vendor_index() {
+    string path = OuiIndex::default_path();
+    if (vendors.open(path)) return;
+    // First run: build it once from the registry files, if installed
+    vector<string> sources = OuiIndex::default_sources();
+    string error;
+    if (sources.empty() || OuiIndex::compile(sources, path, &error) < 0 || !vendors.open(path)) {
+        cerr << "No vendor index (" << (error.empty() ? "install ieee-data and run ouic" : error) << "); vendors will be blank" << endl;
     }
-    return "";
 }
 
-// BLE Scan
-void scan_ble(int duration_sec) {
+// Shared with the daemon, which offers these devices on its first run
+DeviceCache cache;
+
+void cache_devices() {
+    for (const auto& pair : devices) {
+        const DeviceInfo& d = pair.second;
+        DeviceCache::Entry entry;
+        if (str2ba(d.mac.c_str(), &entry.addr) < 0) continue;
+        if (d.name != "[Unknown]") entry.name = d.name;
+        entry.ble = d.type == "BLE";
+        entry.classic = d.type == "BT" || d.dev_class != 0;
+        if (d.rssi != 0) entry.rssi = d.rssi; // 0 = inquiry gave none
+        entry.dev_class = d.dev_class;
+        entry.channel = d.channel;
+        cache.update(entry);
+    }
+}
+
+string get_vendor(const string& mac) {
+    const char* vendor = vendors.lookup(mac);
+    return vendor ? vendor : "";
+}
+
+// LE scan and BR/EDR inquiry at the same time on one HCI socket; the
+// controller interleaves them. Inquiry is started with a plain command
+// rather than the blocking hci_inquiry(), and its results are read as
+// events alongside the advertising reports, so both land in the device
+// table as they arrive and the whole takes about duration_sec. Classic
+// names come from EIR data, or are paged for together afterwards.
+void discover(int duration_sec) {
     int dev_id = hci_get_route(NULL);
     int sock = hci_open_dev(dev_id);
     if (dev_id < 0 || sock < 0) return;
 
+    Inquiry::set_extended_mode(sock);
+
     // Set scan parameters
     hci_le_set_scan_parameters(sock, 0x01, 0x10, 0x10, 0x00, 0x00, 1000);
     hci_le_set_scan_enable(sock, 0x01, 0, 1000);
@@ -83,192 +209,322 @@ void scan_ble(int duration_sec) {
     hci_filter_clear(&nf);
     hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
     hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+    Inquiry::add_events(nf);
     setsockopt(sock, SOL_HCI, HCI_FILTER, &nf, sizeof(nf));
 
+    bool inquiring = Inquiry::start(sock, duration_sec);
+
     unsigned char buf[HCI_MAX_EVENT_SIZE];
     struct pollfd p;
     p.fd = sock;
     p.events = POLLIN;
+    unordered_map<bdaddr_t, DeviceInfo*, BdaddrHash, BdaddrEqual> seen;
+    // Classic devices EIR did not name, with what paging them needs
+    unordered_map<bdaddr_t, Inquiry::NameRequest, BdaddrHash, BdaddrEqual> unnamed;
 
-    time_t start = time(NULL);
-    while (time(NULL) - start < duration_sec) {
+    // Format the address only the first time it is heard
+    auto lookup = [&](const bdaddr_t* addr, const char* type, bool& fresh) {
+        auto it = seen.find(*addr);
+        fresh = it == seen.end();
+        if (fresh) {
+            char text[18];
+            ba2str(addr, text);
+            string mac(text);
+
+            DeviceInfo& d = devices[mac];
+            if (d.mac.empty()) {
+                d.mac = mac;
+                d.name = "[Unknown]";
+                d.rssi = 0;
+                d.type = type;
+                d.vendor = get_vendor(mac);
+            }
+            it = seen.emplace(*addr, &d).first;
+        }
+        return it->second;
+    };
+
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(duration_sec);
+    while (chrono::steady_clock::now() < deadline) {
         int n = poll(&p, 1, 100);
-        if (n > 0 && (p.revents & POLLIN)) {
-            int len = read(sock, buf, sizeof(buf));
-            if (len > 0) {
-                evt_le_meta_event *meta = (evt_le_meta_event *)(buf + (1 + HCI_EVENT_HDR_SIZE));
-                if (meta->subevent == EVT_LE_ADVERTISING_REPORT) {
-                    le_advertising_info *info = (le_advertising_info *)(meta->data + 1);
-                    int reports = meta->data[0];
-                    void *offset = meta->data + 1;
-                    
-                    for (int i=0; i<reports; i++) {
-                        le_advertising_info *info_ptr = (le_advertising_info *)offset;
-                        char addr[18];
-                        ba2str(&info_ptr->bdaddr, addr);
-                        string mac(addr);
-                        
-                        int8_t rssi = *(int8_t*)(info_ptr->data + info_ptr->length);
-                        
-                        // Parse Name
-                        string name = "[Unknown]";
-                        uint8_t *data = info_ptr->data;
-                        size_t data_len = info_ptr->length;
-                        size_t pos = 0;
-                        while (pos < data_len) {
-                            uint8_t len = data[pos];
-                            if (len == 0) break;
-                            if (pos + 1 + len > data_len) break;
-                            uint8_t type = data[pos + 1];
-                            if (type == 0x08 || type == 0x09) { // Short or Complete Name
-                                name.assign((char*)&data[pos+2], len-1);
-                                break;
-                            }
-                            pos += len + 1;
-                        }
-
-                        if (devices.find(mac) == devices.end()) {
-                            DeviceInfo d;
-                            d.mac = mac;
-                            d.name = name;
-                            d.rssi = rssi;
-                            d.type = "BLE";
-                            d.vendor = get_vendor(mac);
-                            devices[mac] = d;
-                        } else {
-                            // Update RSSI
-                            devices[mac].rssi = rssi;
-                            if (name != "[Unknown]") devices[mac].name = name;
-                        }
-                        
-                        offset = (uint8_t*)info_ptr + 1 + 1 + 6 + 1 + info_ptr->length + 1;
-                    }
-                }
+        if (n <= 0 || !(p.revents & POLLIN)) continue;
+        int len = read(sock, buf, sizeof(buf));
+        if (len <= 0) continue;
+
+        if (buf[1] == EVT_INQUIRY_COMPLETE) {
+            inquiring = false;
+            continue;
+        }
+
+        AdvReportParser reports(buf, len);
+        AdvReport report;
+        while (reports.next(report)) {
+            bool fresh;
+            DeviceInfo* d = lookup(report.addr, "BLE", fresh);
+            string name = d->name;
+            string type = d->type;
+            // Dual-mode devices are listed, and probed, as BLE
+            d->type = "BLE";
+            d->rssi = report.rssi;
+
+            ByteSpan value;
+            if (find_ad_field(report.data, 0x09, value) || find_ad_field(report.data, 0x08, value)) { // Complete or Short Name
+                d->name.assign((const char*)value.data, value.size);
+            }
+            if (fresh) print_record("new", *d);
+            else if (d->name != name || d->type != type || abs(d->rssi - d->reported_rssi) >= RSSI_STEP) print_record("update", *d);
+        }
+
+        InquiryResultParser results(buf, len);
+        InquiryResult result;
+        while (results.next(result)) {
+            bool fresh;
+            DeviceInfo* d = lookup(result.addr, "BT", fresh);
+            string name = d->name;
+            if (result.rssi != -255) d->rssi = result.rssi;
+            d->dev_class = result.dev_class;
+
+            ByteSpan value;
+            if (find_ad_field(result.eir, 0x09, value) || find_ad_field(result.eir, 0x08, value)) { // Complete or Short Name
+                d->name.assign((const char*)value.data, value.size);
+                unnamed.erase(*result.addr);
+            } else if (d->name == "[Unknown]") {
+                Inquiry::NameRequest& request = unnamed[*result.addr];
+                bacpy(&request.addr, result.addr);
+                request.pscan_rep_mode = result.pscan_rep_mode;
+                request.clock_offset = result.clock_offset;
             }
+            if (fresh) print_record("new", *d);
+            else if (d->name != name || abs(d->rssi - d->reported_rssi) >= RSSI_STEP) print_record("update", *d);
         }
     }
+
     hci_le_set_scan_enable(sock, 0x00, 1, 1000);
+    if (inquiring) Inquiry::cancel(sock);
+
+    // Page for the names neither EIR nor an advert gave, all together
+    vector<Inquiry::NameRequest> requests;
+    for (auto& entry : unnamed) {
+        if (seen[entry.first]->name == "[Unknown]") requests.push_back(entry.second);
+    }
+    if (!requests.empty()) {
+        status() << "Resolving " << requests.size() << " names..." << endl;
+        Inquiry::resolve_names(sock, requests, 10240, 4, [&](const Inquiry::NameRequest& request) {
+            DeviceInfo* d = seen[request.addr];
+            d->name = request.name;
+            print_record("update", *d);
+        });
+    }
     close(sock);
 }
 
-// Classic Scan
-void scan_classic(int duration_sec) {
-    int dev_id = hci_get_route(NULL);
-    int sock = hci_open_dev(dev_id);
-    if (dev_id < 0 || sock < 0) return;
+// Runs a probe with its stdout captured and kills it at the deadline,
+// along with anything it started (it leads its own process group). The
+// pipe is close-on-exec so probes spawned by other workers do not hold it
+// open.
+string run_probe(const vector<string>& args, int timeout_ms, bool& timed_out) {
+    timed_out = false;
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0) return "";
 
-    inquiry_info *ii = NULL;
-    int max_rsp = 255;
-    int flags = IREQ_CACHE_FLUSH;
-    
-    // We use standard inquiry, which is blocking, so duration_sec is approximated by 'len' parameter (1.28s units)
-    int len = duration_sec; 
-    if (len < 1) len = 1;
-    if (len > 30) len = 30;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    vector<char*> argv;
+    for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    if (err != 0) {
+        close(out[0]);
+        return "";
+    }
 
-    ii = (inquiry_info*)malloc(max_rsp * sizeof(inquiry_info));
-    
-    // Note: Standard inquiry doesn't give RSSI easily without setting mode.
-    // We will just do a basic scan for discovery.
-    int num_rsp = hci_inquiry(dev_id, len, max_rsp, NULL, &ii, flags);
-    
-    for (int i = 0; i < num_rsp; i++) {
-        char addr[19] = {0};
-        char name[248] = {0};
-        ba2str(&(ii+i)->bdaddr, addr);
-        string mac(addr);
-        
-        // Get Name
-        if (hci_read_remote_name(sock, &(ii+i)->bdaddr, sizeof(name), name, 0) < 0)
-            strcpy(name, "[Unknown]");
-            
-        DeviceInfo d;
-        d.mac = mac;
-        d.name = name;
-        d.rssi = 0; // N/A for standard inquiry
-        d.type = "BT";
-        d.vendor = get_vendor(mac);
-        
-        // Prefer BLE entry if exists (dual mode devices), or just overwrite/add?
-        // Usually we treat them as separate unless we merge by MAC, but BT and BLE macs can be same or random.
-        // We'll index by MAC.
-        if (devices.find(mac) == devices.end()) {
-            devices[mac] = d;
-        } else {
-             // If existing was BLE, keep it as BLE but maybe update name
-             if (devices[mac].type == "BLE" && string(name) != "[Unknown]") {
-                 devices[mac].name = name;
-             }
+    string output;
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    char buf[4096];
+    while (true) {
+        int left = (int)chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        struct pollfd p = { out[0], POLLIN, 0 };
+        int n = left > 0 ? poll(&p, 1, left) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            timed_out = true;
+            kill(-pid, SIGKILL);
+            break;
         }
+        ssize_t len = read(out[0], buf, sizeof(buf));
+        if (len <= 0) break;
+        output.append(buf, len);
     }
-    
-    free(ii);
-    close(sock);
+    close(out[0]);
+
+    // A probe can close stdout and still hang; its exit is bounded by the
+    // same deadline
+    pid_t w;
+    while ((w = waitpid(pid, nullptr, WNOHANG)) == 0 || (w < 0 && errno == EINTR)) {
+        if (chrono::steady_clock::now() >= deadline) {
+            timed_out = true;
+            kill(-pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            break;
+        }
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    return output;
 }
 
-void get_services() {
-    cout << "\nScanning for services... this may take a minute or ten..." << endl;
-    
-    for (auto &pair : devices) {
-        DeviceInfo &d = pair.second;
-        cout << "Probing " << d.mac << " (" << d.type << ")..." << flush;
-        
-        if (d.type == "BT") {
-            string cmd = "sdptool browse " + d.mac;
-            string output = exec(cmd.c_str());
-            
-            // Grep for Service Names and Channels
-            string summary = "";
-            stringstream ss(output);
-            string line;
-            while(getline(ss, line)) {
-                if (line.find("Service Name:") != string::npos) {
-                    size_t pos = line.find(":");
-                    if (pos != string::npos) summary += line.substr(pos+1) + "; ";
-                }
-                if (line.find("Channel:") != string::npos) {
-                    size_t pos = line.find(":");
-                    if (pos != string::npos) summary += "Ch" + line.substr(pos+1) + " ";
-                }
+// sdptool for classic devices, gatttool for BLE; one line of summary
+string probe_services(DeviceInfo& d, int timeout_ms, bool& timed_out) {
+    string summary = "";
+    if (d.type == "BT") {
+        string output = run_probe({"sdptool", "browse", d.mac}, timeout_ms, timed_out);
+
+        // Grep for Service Names and Channels
+        stringstream ss(output);
+        string line;
+        while(getline(ss, line)) {
+            if (line.find("Service Name:") != string::npos) {
+                size_t pos = line.find(":");
+                if (pos != string::npos) summary += line.substr(pos+1) + "; ";
             }
-            d.services = summary;
-        } else {
-            // BLE
-            string cmd = "gatttool -b " + d.mac + " --primary";
-            // gatttool is tricky, sometimes hangs. add timeout?
-            // "timeout 5s gatttool ..."
-            cmd = "timeout 5s " + cmd;
-            string output = exec(cmd.c_str());
-            // Output format: attr handle = 0x0001, end grp handle = 0x0005, uuid: ...
-            // Just extract UUIDs
-            string summary = "";
-            stringstream ss(output);
-            string line;
-            while(getline(ss, line)) {
-                if (line.find("uuid:") != string::npos) {
-                     size_t pos = line.find("uuid:");
-                     string uuid = line.substr(pos+5);
-                     // Clean up UUID
-                     uuid.erase(remove(uuid.begin(), uuid.end(), ' '), uuid.end());
-                     // Try to map common UUIDs? Too much work. Just show first 4 chars.
-                     if (uuid.length() > 4) summary += uuid.substr(0, 4) + ".. ";
-                     else summary += uuid + " ";
-                }
+            if (line.find("Channel:") != string::npos) {
+                size_t pos = line.find(":");
+                if (pos != string::npos) summary += "Ch" + line.substr(pos+1) + " ";
+                if (pos != string::npos && !d.channel) d.channel = atoi(line.c_str() + pos + 1);
+            }
+        }
+    } else {
+        // BLE; gatttool sometimes hangs, which the deadline takes care of
+        string output = run_probe({"gatttool", "-b", d.mac, "--primary"}, timeout_ms, timed_out);
+        // Output format: attr handle = 0x0001, end grp handle = 0x0005, uuid: ...
+        // Just extract UUIDs
+        stringstream ss(output);
+        string line;
+        while(getline(ss, line)) {
+            if (line.find("uuid:") != string::npos) {
+                 size_t pos = line.find("uuid:");
+                 string uuid = line.substr(pos+5);
+                 // Clean up UUID
+                 uuid.erase(remove(uuid.begin(), uuid.end(), ' '), uuid.end());
+                 // Try to map common UUIDs? Too much work. Just show first 4 chars.
+                 if (uuid.length() > 4) summary += uuid.substr(0, 4) + ".. ";
+                 else summary += uuid + " ";
             }
-            d.services = summary;
         }
-        cout << " Done." << endl;
     }
+    return summary;
 }
 
-int main() {
-    cout << "Starting Bluetooth Scan (BT + BLE)..." << endl;
-    
-    cout << "Scanning BLE (5s)..." << endl;
-    scan_ble(5);
-    
-    cout << "Scanning Classic BT (5s)..." << endl;
-    scan_classic(5); // len=5 * 1.28s approx 6.4s
+// Probes run on `jobs` workers, each bounded by the deadline, so the total
+// is about the slowest probes rather than their sum. Every probe holds an
+// ACL link while it runs; a BR/EDR piconet has at most 7 active ones, so
+// -j is capped there.
+static const int MAX_LINKS = 7;
+
+void get_services(int jobs, int timeout_ms) {
+    vector<DeviceInfo*> queue;
+    for (auto &pair : devices) queue.push_back(&pair.second);
+    if (queue.empty()) return;
+    jobs = max(1, min(jobs, (int)queue.size()));
+
+    status() << "\nProbing services of " << queue.size() << " devices, " << jobs << " at a time, "
+         << timeout_ms / 1000.0 << "s each at most..." << endl;
+
+    auto started = chrono::steady_clock::now();
+    atomic<size_t> next(0);
+    atomic<size_t> done(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < queue.size()) {
+            DeviceInfo& d = *queue[i];
+            auto probe_started = chrono::steady_clock::now();
+            bool timed_out;
+            d.services = probe_services(d, timeout_ms, timed_out);
+            d.probed = true;
+            d.timed_out = timed_out;
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - probe_started).count();
+            ++done;
+            if (output != TABLE) {
+                print_record("update", d);
+                continue;
+            }
+
+            // Each result as it lands
+            lock_guard<mutex> lock(output_lock);
+            cout << "[" << done << "/" << queue.size() << "] " << d.mac << " (" << d.type << ") "
+                 << fixed << setprecision(1) << secs << "s" << (timed_out ? " timed out" : "")
+                 << (d.services.empty() ? "" : ": " + d.services) << defaultfloat << endl;
+        }
+    };
+    vector<thread> workers;
+    for (int j = 0; j < jobs; j++) workers.emplace_back(worker);
+    for (auto& t : workers) t.join();
+
+    double total = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    status() << "Probed " << queue.size() << " devices in " << fixed << setprecision(1) << total << "s" << defaultfloat << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int jobs = MAX_LINKS;
+    int timeout_ms = 10000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:f:h")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 't': timeout_ms = (int)(atof(optarg) * 1000); break;
+            case 'f':
+                if (strcmp(optarg, "table") == 0) output = TABLE;
+                else if (strcmp(optarg, "json") == 0) output = JSON;
+                else if (strcmp(optarg, "columns") == 0) output = COLUMNS;
+                else {
+                    cerr << "Error: unknown format " << optarg << " (table, json or columns)" << endl;
+                    return 1;
+                }
+                break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-j <parallel probes, default 7>] [-t <seconds per probe, default 10>]"
+                     << " [-f table|json|columns]" << endl;
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (jobs < 1 || timeout_ms < 1) {
+        cerr << "Error: -j and -t must be positive" << endl;
+        return 1;
+    }
+    if (jobs > MAX_LINKS) {
+        cerr << "Warning: the adapter holds at most " << MAX_LINKS << " links at once; probing " << MAX_LINKS
+             << " at a time, not " << jobs << endl;
+        jobs = MAX_LINKS;
+    }
+
+    status() << "Starting Bluetooth Scan (BT + BLE)..." << endl;
+    open_vendor_index();
+    if (!cache.open(DeviceCache::default_path())) {
+        cerr << "Cannot open device cache " << DeviceCache::default_path() << endl;
+    }
+
+    if (output == COLUMNS) {
+        cout << left << setw(7) << "EVENT" << right << setw(8) << "T" << "  " << left << setw(18) << "MAC" << setw(5) << "TYPE"
+             << setw(5) << "RSSI" << setw(30) << "NAME" << setw(25) << "VENDOR" << "SERVICES" << endl;
+    }
+    status() << "Scanning BLE and Classic BT together (5s)..." << endl;
+    discover(5);
+    cache_devices();
+
+    if (output != TABLE) {
+        get_services(jobs, timeout_ms);
+        cache_devices();
+        return 0;
+    }
     
     cout << "\nFound Devices:" << endl;
     cout << left << setw(20) << "MAC" << setw(30) << "Name" << setw(6) << "Type" << setw(6) << "RSSI" << " Vendor" << endl;
@@ -281,7 +537,8 @@ int main() {
         cout << left << setw(20) << d.mac << setw(30) << d.name << setw(6) << d.type << setw(6) << d.rssi << " " << vendor << endl;
     }
     
-    get_services();
+    get_services(jobs, timeout_ms);
+    cache_devices();
     
     cout << "\nFinal Report:" << endl;
     cout << string(120, '-') << endl;
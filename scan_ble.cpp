@@ -12,52 +12,8 @@
 #include <cerrno>
 #include <iomanip>
 #include <algorithm>
-
-// EIR/AD Data Types
-#define EIR_FLAGS                   0x01
-#define EIR_NAME_SHORT              0x08
-#define EIR_NAME_COMPLETE           0x09
-#define EIR_TX_POWER                0x0A
-
-struct DeviceData {
-    std::string mac;
-    std::string name;
-    int rssi;
-    int tx_power;
-    bool has_tx_power;
-};
-
-// Function to parse the advertising data
-void parse_ad_data(uint8_t *data, size_t len, DeviceData &device) {
-    size_t pos = 0;
-    while (pos < len) {
-        uint8_t length = data[pos];
-        if (length == 0) break;
-        
-        if (pos + 1 + length > len) break; // Safety check
-        
-        uint8_t type = data[pos + 1];
-        uint8_t *value = &data[pos + 2];
-        uint8_t value_len = length - 1;
-        
-        switch (type) {
-            case EIR_NAME_SHORT:
-            case EIR_NAME_COMPLETE:
-                if (device.name.empty() || type == EIR_NAME_COMPLETE) {
-                    device.name.assign((char*)value, value_len);
-                }
-                break;
-            case EIR_TX_POWER:
-                if (value_len == 1) {
-                    device.tx_power = (int8_t)value[0];
-                    device.has_tx_power = true;
-                }
-                break;
-        }
-        
-        pos += length + 1;
-    }
-}
+#include "AdData.hpp"
+#include "AdvParser.hpp"
 
 int main() {
     int dev_id = hci_get_route(NULL);
@@ -124,33 +80,23 @@ int main() {
                 break;
             }
 
-            evt_le_meta_event *meta = (evt_le_meta_event *)(buf + (1 + HCI_EVENT_HDR_SIZE));
-            if (meta->subevent == EVT_LE_ADVERTISING_REPORT) {
-                le_advertising_info *info = (le_advertising_info *)(meta->data + 1);
-                int reports = meta->data[0];
-                void *offset = meta->data + 1;
-                
-                for (int i=0; i<reports; i++) {
-                    le_advertising_info *info_ptr = (le_advertising_info *)offset;
-                    char addr[18];
-                    ba2str(&info_ptr->bdaddr, addr);
-                    
-                    int8_t rssi = *(int8_t*)(info_ptr->data + info_ptr->length);
-                    
-                    DeviceData dev;
-                    dev.mac = addr;
-                    dev.rssi = (int)rssi;
-                    dev.has_tx_power = false;
-                    
-                    parse_ad_data(info_ptr->data, info_ptr->length, dev);
-                    
-                    std::cout << std::left << std::setw(20) << dev.mac 
-                              << std::setw(10) << dev.rssi 
-                              << std::setw(10) << (dev.has_tx_power ? std::to_string(dev.tx_power) : "N/A")
-                              << dev.name << std::endl;
-                    
-                    offset = (uint8_t*)info_ptr + 1 + 1 + 6 + 1 + info_ptr->length + 1;
-                }
+            AdvReportParser reports(buf, len);
+            AdvReport report;
+            while (reports.next(report)) {
+                char addr[18];
+                ba2str(report.addr, addr);
+
+                DeviceData dev;
+                dev.mac = addr;
+                dev.rssi = report.rssi;
+                dev.has_tx_power = false;
+
+                parse_ad_data(report.data.data, report.data.size, dev);
+
+                std::cout << std::left << std::setw(20) << dev.mac 
+                          << std::setw(10) << dev.rssi 
+                          << std::setw(10) << (dev.has_tx_power ? std::to_string(dev.tx_power) : "N/A")
+                          << dev.name << std::endl;
             }
         }
     }